@@ -0,0 +1,111 @@
+/*
+ * Microbenchmark for the CIR search kernels.
+ *
+ * Runs over FFT_SIZE_POST*INTERP point random impulse responses, the size
+ * of the interpolated CIR extractToAs used to scan, and times the scalar
+ * loops it used against cir_kernels:
+ *
+ *   - magnitude into a fresh vector followed by a max loop, against the
+ *     fused squared-magnitude argmax into a preallocated buffer;
+ *   - a scan dividing every sample by the peak, against the early-exit
+ *     crossing search on squared magnitudes and a squared threshold.
+ *
+ * Checks that both give the same indices.
+ */
+
+#include "cir_kernels.h"
+#include <fast_square/defines.h>
+#include <volk/volk.h>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <time.h>
+
+using namespace gr::fast_square;
+
+static double now_us(){
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e6 + ts.tv_nsec*1e-3;
+}
+
+int main(int argc, char **argv){
+	int num_trials = (argc > 1) ? atoi(argv[1]) : 1000;
+	const int len = FFT_SIZE_POST*INTERP;
+	const float thresh = 0.2;
+
+	//A strong path somewhere in low-level noise, with a weaker one after it
+	std::vector<gr_complex> cir(len);
+	srand(1);
+	for(int ii=0; ii < len; ii++)
+		cir[ii] = gr_complex(0.1*rand()/RAND_MAX - .05, 0.1*rand()/RAND_MAX - .05);
+	int peak_at = len/3, echo_at = len/3 + 700;
+	for(int ii=-64; ii <= 64; ii++){
+		cir[peak_at + ii] += (float)exp(-ii*ii/200.0);
+		cir[echo_at + ii] += (float)(0.4*exp(-ii*ii/200.0));
+	}
+
+	//Old: magnitude into a fresh vector, then a scalar max
+	int ref_idx = 0;
+	float ref_max = 0.0;
+	double t0 = now_us();
+	for(int tt=0; tt < num_trials; tt++){
+		std::vector<float> cir_mag(len, 0);
+		volk_32fc_magnitude_32f_u(&cir_mag[0], &cir[0], len);
+		ref_max = 0.0;
+		for(int ii=0; ii < len; ii++){
+			if(cir_mag[ii] > ref_max){
+				ref_max = cir_mag[ii];
+				ref_idx = ii;
+			}
+		}
+	}
+	double t_max_old = (now_us() - t0)/num_trials;
+
+	std::vector<float> magsq(len);
+	float max_magsq = 0.0;
+	int max_idx = 0;
+	t0 = now_us();
+	for(int tt=0; tt < num_trials; tt++)
+		max_idx = cir_magsq_argmax(&cir[0], &magsq[0], len, max_magsq);
+	double t_max_new = (now_us() - t0)/num_trials;
+
+	//Old: walk back from the end, dividing every sample by the peak
+	std::vector<float> cir_mag(len);
+	volk_32fc_magnitude_32f_u(&cir_mag[0], &cir[0], len);
+	int ref_last = -1, ref_first = -1;
+	t0 = now_us();
+	for(int tt=0; tt < num_trials; tt++){
+		ref_last = -1;
+		for(int ii=len-1; ii >= 0; ii--){
+			if(cir_mag[ii]/ref_max >= thresh){
+				ref_last = ii;
+				break;
+			}
+		}
+		ref_first = -1;
+		for(int ii=0; ii < len; ii++){
+			if(cir_mag[ii]/ref_max >= thresh){
+				ref_first = ii;
+				break;
+			}
+		}
+	}
+	double t_search_old = (now_us() - t0)/num_trials;
+
+	float thresh_sq = thresh*thresh*max_magsq;
+	int last = -1, first = -1;
+	t0 = now_us();
+	for(int tt=0; tt < num_trials; tt++){
+		last = cir_last_at_or_above(&magsq[0], len, thresh_sq);
+		first = cir_first_at_or_above(&magsq[0], len, thresh_sq);
+	}
+	double t_search_new = (now_us() - t0)/num_trials;
+
+	printf("%d sample CIR, %d trials\n", len, num_trials);
+	printf("  magnitude + max    %8.2f us   magsq argmax   %8.2f us   (peak %d vs %d)\n", t_max_old, t_max_new, ref_idx, max_idx);
+	printf("  threshold scans    %8.2f us   crossing search %7.2f us   (first %d vs %d, last %d vs %d)\n",
+			t_search_old, t_search_new, ref_first, first, ref_last, last);
+	return (ref_idx == max_idx && ref_first == first && ref_last == last) ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+/*
+ * Microbenchmark and accuracy check for the two-stage CIR search.
+ *
+ * Builds random multipath spectra of FFT_SIZE_POST bins and finds the
+ * peak and first path of their INTERP times interpolated response two
+ * ways: the full FFT_SIZE_POST*INTERP point zero-padded FFT with linear
+ * scans the localizer used to run, and cir_zoom.  Prints the time of
+ * each and the worst index difference between them.
+ */
+
+#include "cir_zoom.h"
+#include <fast_square/defines.h>
+#include <gnuradio/fft/fft.h>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <time.h>
+
+using namespace gr::fast_square;
+
+static double now_us(){
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e6 + ts.tv_nsec*1e-3;
+}
+
+static int circDist(int a, int b, int len){
+	int d = abs(a - b);
+	return std::min(d, len - d);
+}
+
+int main(int argc, char **argv){
+	int num_trials = (argc > 1) ? atoi(argv[1]) : 200;
+	const int len = FFT_SIZE_POST, fine_len = FFT_SIZE_POST*INTERP;
+	const float thresh = 0.2;
+
+	//Up to four paths anywhere in the period, Hamming windowed (fftshifted) with a little noise
+	std::vector<std::vector<gr_complex> > spectra(num_trials, std::vector<gr_complex>(len));
+	srand(1);
+	for(int tt=0; tt < num_trials; tt++){
+		int num_paths = 1 + rand() % 4;
+		double delay[4], amp[4];
+		for(int pp=0; pp < num_paths; pp++){
+			delay[pp] = (double)(rand() % fine_len)/INTERP;
+			amp[pp] = pp ? 1.2*rand()/RAND_MAX : 1.0;
+		}
+		for(int kk=0; kk < len; kk++){
+			int freq = (kk < len/2) ? kk : kk - len;
+			gr_complex val(0.0, 0.0);
+			for(int pp=0; pp < num_paths; pp++)
+				val += std::polar((float)amp[pp], (float)(2.0*M_PI*freq*delay[pp]/len));
+			float window = 0.54 - 0.46*cos(2.0*M_PI*((kk + len/2) % len)/(len - 1));
+			spectra[tt][kk] = val*window + gr_complex(0.05*rand()/RAND_MAX - .025, 0.05*rand()/RAND_MAX - .025);
+		}
+	}
+
+	//Reference: zero-pad in the middle, full FFT, then the localizer's old scans
+	std::vector<int> ref_peak(num_trials), ref_first(num_trials);
+	gr::fft::fft_complex full(fine_len, true, 1);
+	std::vector<float> mag(fine_len);
+	memset(full.get_inbuf(), 0, fine_len*sizeof(gr_complex));
+	double t0 = now_us();
+	for(int tt=0; tt < num_trials; tt++){
+		memcpy(full.get_inbuf(), &spectra[tt][0], len/2*sizeof(gr_complex));
+		memcpy(full.get_inbuf() + fine_len - len/2, &spectra[tt][len/2], len/2*sizeof(gr_complex));
+		full.execute();
+		for(int ii=0; ii < fine_len; ii++)
+			mag[ii] = std::abs(full.get_outbuf()[ii]);
+
+		float max_mag = 0.0;
+		int max_idx = 0;
+		for(int ii=0; ii < fine_len; ii++){
+			if(mag[ii] > max_mag){
+				max_mag = mag[ii];
+				max_idx = ii;
+			}
+		}
+		int cur = max_idx, cand = max_idx, below = 0;
+		for(int ii=0; ii < fine_len; ii++){
+			if(mag[cur]/max_mag < thresh){
+				below++;
+				if(below > fine_len/4) break;
+			} else {
+				cand = cur;
+				below = 0;
+			}
+			cur = (cur + 1) % fine_len;
+		}
+		ref_peak[tt] = max_idx;
+		ref_first[tt] = cand;
+	}
+	double t_full = (now_us() - t0)/num_trials;
+
+	cir_zoom cir(len, INTERP, 1);
+	int worst_peak = 0, worst_first = 0, mismatches = 0;
+	t0 = now_us();
+	for(int tt=0; tt < num_trials; tt++){
+		float max_mag;
+		cir.set_spectrum(&spectra[tt][0]);
+		int peak = cir.find_peak(max_mag);
+		int first = cir.find_first_path(peak, max_mag, thresh);
+		worst_peak = std::max(worst_peak, circDist(peak, ref_peak[tt], fine_len));
+		worst_first = std::max(worst_first, circDist(first, ref_first[tt], fine_len));
+		if(first != ref_first[tt])
+			mismatches++;
+	}
+	double t_zoom = (now_us() - t0)/num_trials;
+
+	printf("%d bins interpolated %dx, %d trials\n", len, INTERP, num_trials);
+	printf("  full FFT + scans   %8.1f us/anchor\n", t_full);
+	printf("  coarse + zoom      %8.1f us/anchor\n", t_zoom);
+	printf("  worst peak diff    %d fine samples\n", worst_peak);
+	printf("  worst ToA diff     %d fine samples (%d of %d differ)\n", worst_first, mismatches, num_trials);
+	return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * Microbenchmark for the coarse PRF scan's gather-reduce kernel.
+ *
+ * Scores every level 0 candidate of the real defines.h geometry three
+ * ways: the original vector-of-vectors table with scalar loads, the flat
+ * table with scalar loads, and the flat table through gatherSum() (AVX2 or
+ * AVX-512 gathers when available).
+ */
+
+#include "prf_search.h"
+#include "gather_sum.h"
+#include <fast_square/defines.h>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <time.h>
+
+using namespace gr::fast_square;
+
+static double now_us(){
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e6 + ts.tv_nsec*1e-3;
+}
+
+int main(int argc, char **argv){
+	int fft_size = (argc > 1) ? atoi(argv[1]) : 1024;
+	int num_trials = (argc > 2) ? atoi(argv[2]) : 200;
+
+	std::vector<float> abs_array(fft_size*NUM_STEPS);
+	srand(1);
+	for(int ii=0; ii < abs_array.size(); ii++)
+		abs_array[ii] = (float)rand()/RAND_MAX;
+
+	const double precisions[] = {1e-7, COARSE_PRECISION};
+	for(int pp=0; pp < 2; pp++){
+		prf_search search(fft_size, precisions[pp], FINE_PRECISION, 0);
+		int rows = search.coarse_rows();
+		int stride = search.coarse_stride();
+		int n = search.harmonicsPerCandidate();
+
+		//Original layout: one heap vector per candidate
+		std::vector<std::vector<int> > nested(rows);
+		for(int rr=0; rr < rows; rr++)
+			nested[rr].assign(search.coarse_table() + rr*stride, search.coarse_table() + rr*stride + n);
+
+		std::vector<float> sums(rows);
+		float check_nested = 0.0, check_flat = 0.0, check_kernel = 0.0;
+
+		double start = now_us();
+		for(int trial=0; trial < num_trials; trial++){
+			for(int rr=0; rr < rows; rr++){
+				float sum = 0.0;
+				for(int ii=0; ii < nested[rr].size(); ii++)
+					sum += abs_array[nested[rr][ii]];
+				sums[rr] = sum;
+			}
+			check_nested += sums[trial % rows];
+		}
+		double nested_us = (now_us() - start)/num_trials;
+
+		start = now_us();
+		for(int trial=0; trial < num_trials; trial++){
+			const int32_t *table = search.coarse_table();
+			for(int rr=0; rr < rows; rr++){
+				float sum = 0.0;
+				for(int ii=0; ii < n; ii++)
+					sum += abs_array[table[rr*stride + ii]];
+				sums[rr] = sum;
+			}
+			check_flat += sums[trial % rows];
+		}
+		double flat_us = (now_us() - start)/num_trials;
+
+		start = now_us();
+		for(int trial=0; trial < num_trials; trial++){
+			gatherSum(&abs_array[0], search.coarse_table(), stride, n, rows, &sums[0]);
+			check_kernel += sums[trial % rows];
+		}
+		double kernel_us = (now_us() - start)/num_trials;
+
+		printf("precision %.1e: %d candidates x %d bins\n", precisions[pp], rows, n);
+		printf("  nested vectors, scalar: %8.2f us/scan\n", nested_us);
+		printf("  flat table, scalar:     %8.2f us/scan (%.2fx)\n", flat_us, nested_us/flat_us);
+		printf("  flat table, gatherSum:  %8.2f us/scan (%.2fx)\n", kernel_us, nested_us/kernel_us);
+		printf("  checksums: %.3f %.3f %.3f\n", check_nested, check_flat, check_kernel);
+	}
+	return 0;
+}
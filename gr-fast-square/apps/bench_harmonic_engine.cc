@@ -0,0 +1,102 @@
+/*
+ * Microbenchmark and accuracy check for the harmonic extraction GEMM.
+ *
+ * Extracts NUM_HARMONICS_PER_STEP harmonics from every step of
+ * NUM_ANCHORS random snapshots two ways: the per-harmonic loop the
+ * extractor used to run (offset mix, harmonic mix, double accumulation
+ * over FFT_SIZE samples) and harmonic_engine.  Prints the time of each
+ * and the worst phasor error of the engine relative to the loop.
+ */
+
+#include "harmonic_engine.h"
+#include <fast_square/defines.h>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <time.h>
+
+using namespace gr::fast_square;
+
+static double now_us(){
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e6 + ts.tv_nsec*1e-3;
+}
+
+int main(int argc, char **argv){
+	int num_trials = (argc > 1) ? atoi(argv[1]) : 50;
+	double prf_est = PRF*(1.0 + 3e-6);
+
+	std::vector<double> harmonic_freqs, step_offsets;
+	for(float harmonic_num = -1.0*NUM_HARMONICS_PER_STEP/2+.5; harmonic_num <= 1.0*NUM_HARMONICS_PER_STEP/2-.5; harmonic_num++)
+		harmonic_freqs.push_back(-2.0l*M_PI*harmonic_num*prf_est/(SAMPLE_RATE/DECIM_FACTOR));
+	for(int ii=0; ii < NUM_STEPS; ii++)
+		step_offsets.push_back(-2.0l*M_PI*((prf_est-PRF)*((START_LO_FREQ-IF_FREQ+STEP_FREQ*ii)/PRF)-TUNE_OFFSET)/(SAMPLE_RATE/DECIM_FACTOR));
+
+	std::vector<std::vector<gr_complex> > snapshots(NUM_ANCHORS, std::vector<gr_complex>(NUM_STEPS*FFT_SIZE));
+	const gr_complex *data[NUM_ANCHORS];
+	srand(1);
+	for(int aa=0; aa < NUM_ANCHORS; aa++){
+		for(int ii=0; ii < snapshots[aa].size(); ii++)
+			snapshots[aa][ii] = gr_complex((float)rand()/RAND_MAX - .5, (float)rand()/RAND_MAX - .5);
+		data[aa] = &snapshots[aa][0];
+	}
+
+	int num_out = NUM_ANCHORS*NUM_STEPS*NUM_HARMONICS_PER_STEP;
+	std::vector<gr_complex> ref(num_out), out(num_out);
+
+	//Reference: the old per-harmonic loop, with exact mixing tables in place of the NCO
+	std::vector<gr_complex> mix(NUM_HARMONICS_PER_STEP*FFT_SIZE), offs(NUM_STEPS*FFT_SIZE);
+	for(int hh=0; hh < NUM_HARMONICS_PER_STEP; hh++)
+		for(int kk=0; kk < FFT_SIZE; kk++)
+			mix[hh*FFT_SIZE + kk] = gr_complex(cos(harmonic_freqs[hh]*kk), sin(harmonic_freqs[hh]*kk));
+	for(int ss=0; ss < NUM_STEPS; ss++)
+		for(int kk=0; kk < FFT_SIZE; kk++)
+			offs[ss*FFT_SIZE + kk] = gr_complex(cos(step_offsets[ss]*kk), sin(step_offsets[ss]*kk));
+
+	double t0 = now_us();
+	for(int tt=0; tt < num_trials; tt++){
+		int idx = 0;
+		gr_complex pre[FFT_SIZE];
+		for(int aa=0; aa < NUM_ANCHORS; aa++){
+			for(int ss=0; ss < NUM_STEPS; ss++){
+				for(int kk=0; kk < FFT_SIZE; kk++)
+					pre[kk] = offs[ss*FFT_SIZE + kk]*data[aa][ss*FFT_SIZE + kk];
+				for(int hh=0; hh < NUM_HARMONICS_PER_STEP; hh++){
+					gr_complex_d cur_phasor(0.0, 0.0);
+					for(int kk=0; kk < FFT_SIZE; kk++)
+						cur_phasor += gr_complex_d(mix[hh*FFT_SIZE + kk]*pre[kk]);
+					ref[idx++] = gr_complex(cur_phasor);
+				}
+			}
+		}
+	}
+	double t_loop = (now_us() - t0)/num_trials;
+
+	harmonic_engine engine(NUM_HARMONICS_PER_STEP, FFT_SIZE, NUM_STEPS, NUM_ANCHORS);
+	mixing_tables *tables = engine.make_tables();
+	t0 = now_us();
+	for(int tt=0; tt < num_trials; tt++)
+		engine.build_tables(tables, harmonic_freqs, step_offsets);
+	double t_build = (now_us() - t0)/num_trials;
+
+	t0 = now_us();
+	for(int tt=0; tt < num_trials; tt++)
+		engine.extract(tables, data, NUM_ANCHORS, &out[0]);
+	double t_engine = (now_us() - t0)/num_trials;
+
+	double max_err = 0.0, max_mag = 0.0;
+	for(int ii=0; ii < num_out; ii++){
+		max_err = std::max(max_err, (double)std::abs(out[ii] - ref[ii]));
+		max_mag = std::max(max_mag, (double)std::abs(ref[ii]));
+	}
+
+	printf("%d anchors x %d steps x %d harmonics, %d samples per step\n", NUM_ANCHORS, NUM_STEPS, NUM_HARMONICS_PER_STEP, FFT_SIZE);
+	printf("  per-harmonic loop  %8.1f us/snapshot\n", t_loop);
+	printf("  engine extract     %8.1f us/snapshot\n", t_engine);
+	printf("  engine tables      %8.1f us/build\n", t_build);
+	printf("  max |error|        %g (largest phasor %g)\n", max_err, max_mag);
+	delete tables;
+	return 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * Microbenchmark for stream_parser's restart-marker search.
+ *
+ * Compares the original deque-based pop_front() loop against the
+ * vectorized scanRestartMarker() kernel when resynchronizing from a
+ * random offset into the stream (e.g. after a USB overrun).
+ */
+
+#include "marker_scan.h"
+#include <fast_square/defines.h>
+#include <deque>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <time.h>
+
+using namespace gr::fast_square;
+
+static double now_us(){
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e6 + ts.tv_nsec*1e-3;
+}
+
+int main(int argc, char **argv){
+	int num_trials = (argc > 1) ? atoi(argv[1]) : 200;
+
+	//Synthesize a few sequences worth of samples with a marker closing each sequence
+	const int num_seqs = 4;
+	std::vector<gr_complex> stream(SAMPLES_PER_SEQ*num_seqs);
+	srand(1);
+	for(int ii=0; ii < stream.size(); ii++){
+		if(ii % SAMPLES_PER_SEQ == SAMPLES_PER_SEQ-1)
+			stream[ii] = gr_complex(-1.0, -1.0);
+		else
+			stream[ii] = gr_complex(2.0*rand()/RAND_MAX-1.0, 1.8*rand()/RAND_MAX-0.9);
+	}
+
+	double deque_us = 0.0, scan_us = 0.0;
+	size_t deque_skipped = 0, scan_skipped = 0;
+	for(int trial=0; trial < num_trials; trial++){
+		int offset = rand() % SAMPLES_PER_SEQ;
+
+		//Original approach: pop one sample at a time until the marker lines up
+		std::deque<gr_complex> history(stream.begin() + offset, stream.end());
+		double start = now_us();
+		size_t popped = 0;
+		while(history.size() > SAMPLES_PER_SEQ && history[SAMPLES_PER_SEQ].imag() > -1.0){
+			history.pop_front();
+			popped++;
+		}
+		deque_us += now_us() - start;
+		deque_skipped += popped;
+
+		//Vectorized scan over contiguous history
+		start = now_us();
+		restart_marker marker = scanRestartMarker(&stream[offset], stream.size() - offset);
+		scan_us += now_us() - start;
+		scan_skipped += marker.skipped;
+
+		if(marker.skipped != popped){
+			fprintf(stderr, "mismatch at offset %d: %zu vs %zu\n", offset, marker.skipped, popped);
+			return 1;
+		}
+	}
+
+	printf("trials: %d, mean samples skipped: %.1f\n", num_trials, (double)scan_skipped/num_trials);
+	printf("deque pop_front loop: %10.2f us/resync\n", deque_us/num_trials);
+	printf("scanRestartMarker:    %10.2f us/resync (%.1fx)\n", scan_us/num_trials, deque_us/scan_us);
+	return 0;
+}
@@ -0,0 +1,118 @@
+/*
+ * Acquisition accuracy of the full PRF search against its coarse grid spacing.
+ *
+ * Synthesizes NUM_STEPS steps of a harmonic comb at a random PRF inside the
+ * PRF_ACCURACY window, with random harmonic amplitudes and phases and
+ * complex Gaussian noise, takes the same zero-padded magnitude spectra the
+ * estimator searches, and runs prf_search::search() once per coarse
+ * precision on identical spectra.  A trial acquires when the final estimate
+ * lands within the finest coarse spacing (1e-7) of the true PRF, i.e. the
+ * refinement started on the right peak; it is fine when it also lands within
+ * the tracker's single-measurement error (TRACK_MEAS_NOISE).
+ */
+
+#include "prf_search.h"
+#include "sparse_dft.h"
+#include <fast_square/defines.h>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <time.h>
+
+using namespace gr::fast_square;
+
+static double now_us(){
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e6 + ts.tv_nsec*1e-3;
+}
+
+static double uniform(){
+	return (rand() + 0.5)/((double)RAND_MAX + 1.0);
+}
+
+static double gaussian(){
+	return sqrt(-2.0*log(uniform()))*cos(2*M_PI*uniform());
+}
+
+static void synthesize(double prf, double noise_sigma, int fft_size, std::vector<gr_complex> &samples){
+	double fs = SAMPLE_RATE/DECIM_FACTOR;
+	samples.assign(fft_size*NUM_STEPS, gr_complex(0.0, 0.0));
+	for(int jj=0; jj < NUM_STEPS; jj++){
+		gr_complex *x = &samples[jj*fft_size];
+		double center = calculateCenterFreqHarmonicNum(jj);
+		for(float harmonic_num = -NUM_HARMONICS_PER_STEP/2+.5; harmonic_num <= NUM_HARMONICS_PER_STEP/2-.5; harmonic_num++){
+			double freq = prf*harmonic_num + (prf-PRF)*center - TUNE_OFFSET;
+			double amp = 0.5 + 0.5*uniform();
+			double phase = 2*M_PI*uniform();
+			for(int nn=0; nn < FFT_SIZE; nn++){
+				double arg = 2*M_PI*freq*nn/fs + phase;
+				x[nn] += gr_complex(amp*cos(arg), amp*sin(arg));
+			}
+		}
+		for(int nn=0; nn < FFT_SIZE; nn++)
+			x[nn] += gr_complex(noise_sigma*gaussian()/M_SQRT2, noise_sigma*gaussian()/M_SQRT2);
+	}
+}
+
+int main(int argc, char **argv){
+	int fft_size = (argc > 1) ? atoi(argv[1]) : 1024;
+	int num_trials = (argc > 2) ? atoi(argv[2]) : 200;
+
+	const double precisions[] = {1e-7, 2e-7, 5e-7};
+	const int num_precisions = sizeof(precisions)/sizeof(precisions[0]);
+	const double noise_sigmas[] = {0.0, 16.0, 32.0, 48.0, 64.0};
+	const int num_noise = sizeof(noise_sigmas)/sizeof(noise_sigmas[0]);
+
+	std::vector<prf_search *> searches;
+	for(int pp=0; pp < num_precisions; pp++)
+		searches.push_back(new prf_search(fft_size, precisions[pp], FINE_PRECISION, REFINE_DEPTH));
+
+	sparse_dft dft(fft_size, true);
+	dft.set_length(std::min(FFT_SIZE, fft_size));
+	std::vector<int> all_bins(fft_size*NUM_STEPS);
+	for(int ii=0; ii < all_bins.size(); ii++)
+		all_bins[ii] = ii;
+
+	printf("%d trials, PRF uniform in +/-%g, acquired = |error| < 1e-7, fine = |error| < %g\n\n", num_trials, PRF_ACCURACY, TRACK_MEAS_NOISE);
+	printf("noise sigma  precision  acquired     fine  median |err|  p90 |err|  search us\n");
+
+	std::vector<gr_complex> samples;
+	std::vector<float> abs_array(fft_size*NUM_STEPS);
+	for(int nn=0; nn < num_noise; nn++){
+		std::vector<std::vector<double> > errors(num_precisions);
+		std::vector<double> search_us(num_precisions, 0.0);
+		srand(1);
+		for(int trial=0; trial < num_trials; trial++){
+			double prf = PRF*(1.0 + PRF_ACCURACY*(2*uniform() - 1.0));
+			synthesize(prf, noise_sigmas[nn], fft_size, samples);
+			dft.magnitudes(&samples[0], all_bins, &abs_array[0]);
+			for(int pp=0; pp < num_precisions; pp++){
+				double start = now_us();
+				prf_search_result res = searches[pp]->search(&abs_array[0], PRF*(1.0-PRF_ACCURACY), PRF*(1.0+PRF_ACCURACY));
+				search_us[pp] += now_us() - start;
+				errors[pp].push_back(fabs(res.prf - prf)/PRF);
+			}
+		}
+
+		for(int pp=0; pp < num_precisions; pp++){
+			std::vector<double> &err = errors[pp];
+			int acquired = 0, fine = 0;
+			for(int ii=0; ii < err.size(); ii++){
+				if(err[ii] < 1e-7)
+					acquired++;
+				if(err[ii] < TRACK_MEAS_NOISE)
+					fine++;
+			}
+			std::sort(err.begin(), err.end());
+			printf("%11.1f  %9.0e  %7.1f%%  %6.1f%%  %12.2e  %9.2e  %9.1f\n", noise_sigmas[nn], precisions[pp],
+				100.0*acquired/num_trials, 100.0*fine/num_trials, err[err.size()/2], err[err.size()*9/10], search_us[pp]/num_trials);
+		}
+	}
+
+	for(int pp=0; pp < num_precisions; pp++)
+		delete searches[pp];
+	return 0;
+}
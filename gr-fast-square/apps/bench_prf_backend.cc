@@ -0,0 +1,73 @@
+/*
+ * Microbenchmark for prf_estimator's spectrum backends.
+ *
+ * For a range of PRF search half-widths (the PRF_ACCURACY setting for
+ * acquisition, or the tracking window once locked) this times the batched
+ * FFT + magnitude path against Goertzel on only the bins the search can
+ * read, and reports where the sparse path stops paying off.
+ */
+
+#include "batched_fft.h"
+#include "prf_search.h"
+#include "sparse_dft.h"
+#include <fast_square/defines.h>
+#include <volk/volk.h>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <time.h>
+
+using namespace gr::fast_square;
+
+static double now_us(){
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e6 + ts.tv_nsec*1e-3;
+}
+
+int main(int argc, char **argv){
+	int fft_size = (argc > 1) ? atoi(argv[1]) : 1024;
+	int num_trials = (argc > 2) ? atoi(argv[2]) : 50;
+
+	batched_fft fft(fft_size, NUM_STEPS, true, 1);
+	sparse_dft sparse(fft_size, true);
+	sparse.set_length(FFT_SIZE);
+	prf_search search(fft_size, COARSE_PRECISION, FINE_PRECISION, REFINE_DEPTH);
+	std::vector<float> abs_array(fft_size*NUM_STEPS);
+
+	//Noise in the valid part of every step, zeros after it like packSteps() leaves them
+	srand(1);
+	for(int ii=0; ii < NUM_STEPS; ii++)
+		for(int jj=0; jj < FFT_SIZE; jj++)
+			fft.get_inbuf()[ii*fft_size+jj] = gr_complex(2.0*rand()/RAND_MAX-1.0, 2.0*rand()/RAND_MAX-1.0);
+
+	double start = now_us();
+	for(int trial=0; trial < num_trials; trial++){
+		fft.execute();
+		volk_32fc_magnitude_32f(&abs_array[0], fft.get_outbuf(), fft_size*NUM_STEPS);
+	}
+	double fft_us = (now_us() - start)/num_trials;
+	printf("fft_size %d, %d steps: batched FFT + magnitude %.1f us/snapshot\n\n", fft_size, NUM_STEPS, fft_us);
+
+	const double accuracies[] = {1e-8, 3e-8, 1e-7, 3e-7, 1e-6, 3e-6, 1e-5, 2e-5, 5e-5};
+	const int num_accuracies = sizeof(accuracies)/sizeof(accuracies[0]);
+	double crossover = 0.0;
+	std::vector<int> bins;
+	printf("%12s %12s %14s %10s\n", "accuracy", "bins/step", "goertzel us", "speedup");
+	for(int ii=0; ii < num_accuracies; ii++){
+		search.binsFor(1.0l*PRF*(1-accuracies[ii]), 1.0l*PRF*(1+accuracies[ii]), bins);
+		start = now_us();
+		for(int trial=0; trial < num_trials; trial++)
+			sparse.magnitudes(fft.get_inbuf(), bins, &abs_array[0]);
+		double sparse_us = (now_us() - start)/num_trials;
+		printf("%12.1e %12.1f %14.1f %9.2fx\n", accuracies[ii], (double)bins.size()/NUM_STEPS, sparse_us, fft_us/sparse_us);
+		if(sparse_us < fft_us)
+			crossover = accuracies[ii];
+	}
+
+	if(crossover > 0.0)
+		printf("\nGoertzel is faster up to a half-width of about %.1e (relative PRF)\n", crossover);
+	else
+		printf("\nGoertzel never beats the FFT at this size\n");
+	return 0;
+}
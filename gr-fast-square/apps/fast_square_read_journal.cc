@@ -0,0 +1,61 @@
+/*
+ * Dumps a stream_parser timestamp journal as text.
+ *
+ * With an anchor argument the output matches the old per-anchor
+ * timestamps_anchor%d.txt files ("<seq> <ctime>.<usec>"); without one,
+ * every record is printed with its anchor index first.
+ */
+
+#include "timestamp_journal.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+
+using namespace gr::fast_square;
+
+int main(int argc, char **argv){
+	if(argc < 2){
+		fprintf(stderr, "usage: %s <journal file> [anchor]\n", argv[0]);
+		return 1;
+	}
+	int anchor_filter = (argc > 2) ? atoi(argv[2]) : -1;
+
+	FILE *source = fopen(argv[1], "rb");
+	if(source == NULL){
+		perror(argv[1]);
+		return 1;
+	}
+
+	journal_header hdr;
+	if(fread(&hdr, sizeof(hdr), 1, source) != 1 || memcmp(hdr.magic, JOURNAL_MAGIC, sizeof(hdr.magic)) != 0){
+		fprintf(stderr, "%s: not a timestamp journal\n", argv[1]);
+		fclose(source);
+		return 1;
+	}
+	if(hdr.record_size != sizeof(timestamp_record)){
+		fprintf(stderr, "%s: unexpected record size %u\n", argv[1], hdr.record_size);
+		fclose(source);
+		return 1;
+	}
+
+	timestamp_record rec;
+	for(uint64_t ii=0; ii < hdr.num_records && fread(&rec, sizeof(rec), 1, source) == 1; ii++){
+		if(anchor_filter >= 0 && (int)rec.anchor != anchor_filter)
+			continue;
+
+		//Convert the monotonic stamp back to wall-clock time using the pair sampled at open
+		uint64_t real_ns = hdr.realtime_ns_at_open + (rec.mono_ns - hdr.mono_ns_at_open);
+		time_t secs = real_ns/1000000000ull;
+		int usecs = (real_ns % 1000000000ull)/1000;
+		char *ct_out = ctime(&secs);
+		ct_out[19] = 0;
+
+		if(anchor_filter < 0)
+			printf("%u ", rec.anchor);
+		printf("%u %s.%06d\n", rec.sequence_num, ct_out, usecs);
+	}
+
+	fclose(source);
+	return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef INCLUDED_FAST_SQUARE_ANCHOR_CONFIG_H
+#define INCLUDED_FAST_SQUARE_ANCHOR_CONFIG_H
+
+#include <fast_square/api.h>
+#include <string>
+#include <vector>
+
+namespace gr {
+  namespace fast_square {
+
+    /*!
+     * Number, positions and first-path thresholds of the anchors, read at
+     * runtime so the flowgraph can be sized for the room.  Input ii of
+     * every block carries anchor ii, in the order of the file.
+     *
+     * The file holds one anchor per line as "x y z [threshold]", in
+     * meters, with the threshold relative to the CIR peak (default
+     * ANCHOR_THRESHOLD).  Blank lines and anything after a '#' are
+     * ignored.  Between four and MAX_ANCHORS anchors are accepted.
+     *
+     * An empty path gives the four anchors of the original testbed.
+     */
+    class FAST_SQUARE_API anchor_config
+    {
+    private:
+      std::vector<std::vector<float> > d_positions;
+      std::vector<float> d_thresholds;
+
+    public:
+      anchor_config(const std::string &path="");
+
+      int num_anchors() const { return d_positions.size(); }
+
+      //x, y, z of every anchor
+      const std::vector<std::vector<float> > &positions() const { return d_positions; }
+
+      //First-path threshold of every anchor, relative to its CIR peak
+      const std::vector<float> &thresholds() const { return d_thresholds; }
+    };
+
+  } /* namespace fast_square */
+} /* namespace gr */
+
+#endif /* INCLUDED_FAST_SQUARE_ANCHOR_CONFIG_H */
@@ -0,0 +1,86 @@
+#ifndef INCLUDED_FAST_SQUARE_BLOCK_STATS_H
+#define INCLUDED_FAST_SQUARE_BLOCK_STATS_H
+
+#include <fast_square/api.h>
+#include <vector>
+#include <stdint.h>
+
+namespace gr {
+  namespace fast_square {
+
+    //Stages the blocks time; each block only fills the ones it runs
+    enum stat_stage {
+      STAGE_PARSE = 0,   //stream_parser: aligning and copying out one snapshot
+      STAGE_PRF_FFT,     //prf_estimator: windowing, FFT and magnitudes of one snapshot
+      STAGE_PRF_SEARCH,  //prf_estimator: PRF search and tracking of one snapshot
+      STAGE_EXTRACT,     //harmonic_extractor: harmonic extraction of one batch of snapshots
+      STAGE_COMPENSATE,  //harmonic_localizer: rearranging and calibrating one tag's phasors
+      STAGE_CIR_FFT,     //harmonic_localizer: CIR search of one anchor of one tag
+      STAGE_SOLVE,       //harmonic_localizer: position solve of one tag
+      STAGE_END_TO_END,  //harmonic_localizer: snapshot ingest to position output
+      NUM_STAGES
+    };
+
+    //Hot-path counters; each block only updates the ones that apply to it
+    enum stat_counter {
+      COUNTER_SNAPSHOTS = 0, //Snapshots processed
+      COUNTER_SKIPPED,       //Snapshots dropped because they could not be used
+      COUNTER_SEQ_DROPPED,   //Sequence numbers missing between consecutive snapshots
+      COUNTER_SEQ_RESYNC,    //Times an anchor was realigned after a skipped, stale or restarted sequence
+      COUNTER_PRF_LOCKED,    //Tags currently locked (a level rather than a count)
+      COUNTER_PRF_LOCKS,     //Acquisitions that locked onto a tag
+      COUNTER_PRF_LOSSES,    //Locks lost after TRACK_LOSS_COUNT bad snapshots
+      COUNTER_ALLOCATIONS,   //Heap allocations on the hot path (cache misses and pool growth)
+      COUNTER_JOURNAL_DROPPED, //Timestamp journal records dropped because the writer fell behind
+      COUNTER_FRAMES_DROPPED,  //Tags not extracted, or not located, for lack of a valid phasor frame
+      NUM_COUNTERS
+    };
+
+#define STATS_BUCKETS 32 //Bucket b counts latencies in [2^b, 2^(b+1)) ns; the last one also takes anything longer
+
+    /*!
+     * Latency histograms and counters of one block.  Updates are relaxed
+     * atomics, so worker threads can record into the same histogram and
+     * ControlPort can read it while the block runs.
+     *
+     * Counters are always kept, since they only change on rare events or
+     * once per snapshot.  Timing needs two clock reads per stage, so it
+     * is off unless the FAST_SQUARE_STATS environment variable is set or
+     * set_enabled(true) is called; while off a stage costs one branch.
+     */
+    class FAST_SQUARE_API block_stats
+    {
+    private:
+      uint64_t d_buckets[NUM_STAGES][STATS_BUCKETS];
+      uint64_t d_counters[NUM_COUNTERS];
+
+    public:
+      block_stats();
+
+      static bool enabled();
+      static void set_enabled(bool enabled);
+
+      void record(int stage, uint64_t ns){
+        int bucket = (ns == 0) ? 0 : 63 - __builtin_clzll(ns);
+        if(bucket >= STATS_BUCKETS)
+          bucket = STATS_BUCKETS-1;
+        __atomic_fetch_add(&d_buckets[stage][bucket], 1, __ATOMIC_RELAXED);
+      }
+
+      void increment(int counter, uint64_t count=1){
+        __atomic_fetch_add(&d_counters[counter], count, __ATOMIC_RELAXED);
+      }
+
+      void set(int counter, uint64_t value){
+        __atomic_store_n(&d_counters[counter], value, __ATOMIC_RELAXED);
+      }
+
+      //Bucket counts of stage, and every counter indexed by stat_counter; saturated to fit an int for ControlPort
+      std::vector<int> histogram(int stage) const;
+      std::vector<int> counters() const;
+    };
+
+  } /* namespace fast_square */
+} /* namespace gr */
+
+#endif /* INCLUDED_FAST_SQUARE_BLOCK_STATS_H */
@@ -30,17 +30,42 @@
 #define FFT_SHIFT_POST (FFT_SIZE_POST-132)
 
 #define NUM_ANCHORS 4
+#define MAX_ANCHORS 16        //Most anchors a flowgraph can carry; every one needs a bit of snapshot_header::anchor_mask
+#define ANCHOR_THRESHOLD 0.2  //Default first-path threshold, relative to the CIR peak
 #define PRF_EST_ANCHOR 0
 
 #define NUM_HIST 10
+#define PARSER_HISTORY_SEQS 4
 
 #define PRF_ACCURACY 20e-6
-#define COARSE_PRECISION 1e-7
+#define COARSE_PRECISION 5e-7 //Acquires at most 1.6 points less often than 1e-7 (worst at sigma 64) in apps/bench_prf_acquisition
 #define FINE_PRECISION 1e-9
+#define REFINE_DEPTH 3
+#define PRF_TOP_K 4 //Coarse peaks reported after every full search
+#define FLOOR_MEDIAN_BINS 2048 //Most bins of the searched band whose median sets an anchor's floor until lock
+
+#define TRACK_PROCESS_NOISE 2e-9 //Relative PRF wander per snapshot (1 sigma)
+#define TRACK_MEAS_NOISE 5e-9    //Relative error of a single PRF measurement (1 sigma)
+#define TRACK_WINDOW_SIGMAS 4
+#define TRACK_LOCK_RATIO 2.0     //Minimum peak-to-average ratio of the best candidate while locked
+#define TRACK_LOSS_COUNT 3       //Consecutive bad snapshots before falling back to acquisition
+
+#define MAX_TAGS 8                //Most tags prf_estimator follows at once
+#define TAG_MIN_SEPARATION 1e-6   //Relative PRF distance below which two peaks are the same tag
+#define TAG_EXPIRY 64             //Snapshots after which the estimator and localizer forget a tag they have not seen
+
+#define HARMONIC_TABLE_CACHE 8      //PRF estimates whose mixing tables harmonic_extractor keeps
+#define HARMONIC_BATCH_SIZE 8       //Snapshot tags harmonic_extractor extracts together in one call to work
+#define HARMONIC_TABLE_QUANTUM 2e-9  //Relative PRF step the mixing tables are keyed on (see harmonic_extractor.h)
+#define PHASOR_FRAME_POOL 32         //Phasor frames preallocated for snapshots in flight between extractor and localizer
+#define PHASOR_FRAME_LIMIT 256       //Most phasor frames the pool creates; beyond that, tags are dropped and counted
 
 #define INTERP 64
 
-#define POW2_CEIL(x) ((int)pow(2,ceil(log2(x))))
+#define TDOA_MAX_ITERATIONS 20    //Levenberg-Marquardt iterations per fix
+#define TDOA_STEP_TOLERANCE 1e-5  //Converged once a step moves the estimate less than this (m)
+#define TDOA_MAX_RANGE 10.0       //Fixes farther than this from the origin (m) are rejected
+#define TDOA_OUTLIER_RESIDUAL 0.1 //RMS residual (m) above which outlier rejection drops an anchor
 
 typedef std::complex<double> gr_complex_d ;
 
@@ -5,6 +5,7 @@
 #include <fast_square/api.h>
 #include <gnuradio/sync_block.h>
 #include <gnuradio/msg_queue.h>
+#include <fast_square/defines.h>
 
 namespace gr {
   namespace fast_square {
@@ -14,7 +15,77 @@ namespace gr {
     public:
       typedef boost::shared_ptr<harmonic_extractor> sptr;
 
-      static sptr make(int fft_size, int nthreads, const std::string &prf_tag_name, const std::string &phasor_tag_name, const std::string &hfreq_tag_name);
+      /*!
+       * Input and output ii carry anchor ii; connect one of each per
+       * anchor, up to MAX_ANCHORS.
+       *
+       * PRF estimates arrive on the "prf_in" message port from
+       * prf_estimator's "prf_out".  A snapshot is held until its estimate
+       * has arrived; the estimate and its companion values are then
+       * attached as tags on the matching output item.
+       *
+       * Only harmonics harmonic_start .. harmonic_start+num_harmonics-1
+       * of the NUM_HARMONICS_PER_STEP in every step are extracted, and the
+       * output frame headers carry that range.  The localizer only needs
+       * HARMONIC_NON_OVERLAP_START..HARMONIC_NON_OVERLAP_END; calibration
+       * keeps the default of all of them.
+       *
+       * Mixing tables are kept in an LRU cache keyed by the PRF estimate
+       * rounded to prf_quantum*PRF, and are built for the rounded PRF.
+       * The quantum has to exceed the snapshot-to-snapshot movement of a
+       * locked estimate or the cache never hits: the tracker's steady
+       * state (TRACK_PROCESS_NOISE, TRACK_MEAS_NOISE) leaves a posterior
+       * sigma of 2.9e-9 and moves the estimate by about 2e-9 per update.
+       * The default of 2e-9 keeps one locked tag's estimate within a few
+       * cache entries (about 87% hits on a drifting PRF, all hits on a
+       * steady one).  Rounding changes the PRF by at most 1e-9 relative,
+       * a third of the tracker's own error.  At the highest LO harmonic
+       * (about 1090) that is a frequency error of 4.4 Hz, which over the
+       * FFT_SIZE samples (403 us) of a step accumulates at most 0.011 rad
+       * (0.6 degrees) of phase.
+       * Every entry holds about (num_harmonics + NUM_STEPS)*FFT_SIZE*8
+       * bytes (roughly 300 kB for all 16 harmonics); table_cache_size
+       * bounds the number of entries.
+       *
+       * With nthreads > 1 the snapshots available to one call to work are
+       * extracted in parallel, one task per snapshot, tag and anchor.  A
+       * batch holds at most batch_size tags and never more distinct PRFs
+       * than the table cache, so no table in use is recycled.  Tags and
+       * items still leave in input order.  fft_size is no longer used.
+       *
+       * The phasors and harmonic frequencies of every snapshot leave in a
+       * phasor_frame from phasor_frame_pool, pointed to by the header of
+       * the item on output 0 (the other outputs carry NULL).  Whatever
+       * reads output 0 owns that frame and must release() it once done,
+       * so output 0 must feed exactly one block; start() throws otherwise.
+       * If the consumer falls behind (or never releases) until the pool is
+       * at its limit, tags are dropped and counted in
+       * COUNTER_FRAMES_DROPPED.  phasor_tag_name and hfreq_tag_name are no
+       * longer used.
+       *
+       * When prf_estimator reports several tags (prf_tag_name_tags and
+       * prf_tag_name_prfs), each tag is extracted from the same snapshot
+       * with its own PRF's tables, into its own frame, and the frames are
+       * chained in the order reported.  A snapshot without tags carries no
+       * frame.  The table cache should hold at least one entry per tag;
+       * each snapshot, tag and anchor is one task.
+       */
+      static sptr make(int fft_size, int nthreads, const std::string &prf_tag_name, const std::string &phasor_tag_name, const std::string &hfreq_tag_name,
+                       int harmonic_start=0, int num_harmonics=NUM_HARMONICS_PER_STEP,
+                       int table_cache_size=HARMONIC_TABLE_CACHE, double prf_quantum=HARMONIC_TABLE_QUANTUM,
+                       int batch_size=HARMONIC_BATCH_SIZE);
+
+      //! Snapshots whose mixing tables came from the cache
+      virtual uint64_t table_cache_hits() const = 0;
+
+      //! Snapshots that had to build their mixing tables
+      virtual uint64_t table_cache_misses() const = 0;
+
+      //! Latency histogram of a stat_stage, in STATS_BUCKETS log2 buckets of ns (see block_stats)
+      virtual std::vector<int> stage_histogram(int stage) const = 0;
+
+      //! Hot-path counters, indexed by stat_counter
+      virtual std::vector<int> stat_counters() const = 0;
     };
 
   } /* namespace fast_square */
@@ -14,8 +14,46 @@ namespace gr {
     public:
       typedef boost::shared_ptr<harmonic_localizer> sptr;
 
-      static sptr make(const std::string &phasor_tag_name, const std::string &hfreq_tag_name, const std::string &prf_tag_name, const std::string &gatd_id, int threads);
-
+      /*!
+       * Reads the phasor_frame in each snapshot header from
+       * harmonic_extractor's output 0, and every frame chained after it
+       * (one per tag), and releases them back to the pool.
+       * phasor_tag_name, hfreq_tag_name and prf_tag_name are no longer used.
+       *
+       * The anchors come from anchor_file (see anchor_config; empty for
+       * the original four), and one input must be connected per anchor.
+       * The fix is a least-squares solve over all of them.  With
+       * max_outliers > 0, up to that many anchors whose ranges do not fit
+       * the rest are dropped from a fix, keeping at least five.
+       *
+       * Every tag gets its own fix, warm-started from that tag's previous
+       * fix, and its own frame_out PDU whose metadata holds the tag id
+       * under "tag".  A tag unseen for TAG_EXPIRY snapshots is forgotten.
+       *
+       * The metadata also traces the snapshot the fix came from: "seq" is
+       * its sequence number, "ingest_ns" the CLOCK_MONOTONIC time
+       * stream_parser emitted it, and "latency_ns" the time from then to
+       * the PDU.  "trace_ns" holds snapshot_header::trace_ns followed by
+       * this block's own start and end, all in ns after ingest_ns.
+       *
+       * "valid" is false when the solver found no fix; the position is
+       * then all zeros and means nothing.  A valid fix also carries its
+       * RMS range-difference "residual" (m), its row-major 3x3 position
+       * "covariance" (m^2, an f64vector) and "rejected", a mask with bit
+       * a set if anchor a was dropped as an outlier.  Dropping anchors can
+       * leave too little to fix on; that is reported as not valid too.
+       *
+       * The CIR of every anchor of every tag is searched in parallel on up
+       * to threads threads.
+       */
+      static sptr make(const std::string &phasor_tag_name, const std::string &hfreq_tag_name, const std::string &prf_tag_name, const std::string &gatd_id, int threads,
+                       const std::string &anchor_file="", int max_outliers=0);
+
+      //! Latency histogram of a stat_stage, in STATS_BUCKETS log2 buckets of ns (see block_stats)
+      virtual std::vector<int> stage_histogram(int stage) const = 0;
+
+      //! Hot-path counters, indexed by stat_counter
+      virtual std::vector<int> stat_counters() const = 0;
     };
 
   } /* namespace fast_square */
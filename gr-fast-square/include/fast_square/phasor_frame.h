@@ -0,0 +1,95 @@
+#ifndef INCLUDED_FAST_SQUARE_PHASOR_FRAME_H
+#define INCLUDED_FAST_SQUARE_PHASOR_FRAME_H
+
+#include <fast_square/api.h>
+#include <gnuradio/gr_complex.h>
+#include <boost/thread/mutex.hpp>
+#include <vector>
+#include <set>
+#include <stdint.h>
+
+namespace gr {
+  namespace fast_square {
+
+    class phasor_frame_pool;
+
+    /*!
+     * Harmonic phasors of one snapshot as harmonic_extractor produced
+     * them.  Frames come from phasor_frame_pool and travel by pointer in
+     * snapshot_header::phasors; the block that consumes a frame hands it
+     * back with release().  The vectors keep their capacity across uses,
+     * so refilling a recycled frame does not allocate.
+     *
+     * A snapshot carries one frame per tag, chained through next, all
+     * extracted from the same raw samples.  Each frame is released on its
+     * own, exactly once.
+     */
+    class FAST_SQUARE_API phasor_frame
+    {
+    public:
+      uint32_t sequence_num;
+      int tag_id;                          //Tag id assigned by prf_estimator
+      double prf_est;                      //PRF of this tag
+      double table_prf;                    //prf_est as harmonic_extractor quantized it for harmonic_freqs
+      int harmonic_start;                  //First of the NUM_HARMONICS_PER_STEP harmonics present
+      int num_harmonics;                   //Harmonics per step
+      std::vector<gr_complex> phasors;     //Anchor-major, then step, then harmonic
+      std::vector<double> harmonic_freqs;  //Step-major, then harmonic, in Hz
+      phasor_frame *next;                  //Frame of the next tag in the same snapshot, or NULL
+
+      //Return the frame to the pool it came from; the caller must not touch it afterwards
+      void release();
+
+    private:
+      friend class phasor_frame_pool;
+      phasor_frame_pool *d_pool;
+      bool d_pooled; //Waiting in the pool rather than in flight
+    };
+
+    /*!
+     * Free list of phasor frames shared by every block in the process.
+     * acquire() only allocates when every frame is in flight, so in steady
+     * state passing phasors between blocks allocates nothing.  The pool
+     * never grows past PHASOR_FRAME_LIMIT frames (or what reserve() asked
+     * for, if more): a consumer that never releases its frames then costs
+     * dropped tags instead of unbounded memory.
+     */
+    class FAST_SQUARE_API phasor_frame_pool
+    {
+    private:
+      boost::mutex d_mutex;
+      std::vector<phasor_frame *> d_free;
+      std::set<const phasor_frame *> d_frames; //Every frame the pool created
+      size_t d_allocated;
+      size_t d_limit;
+
+      phasor_frame *create(size_t num_phasors);
+
+      phasor_frame_pool();
+      ~phasor_frame_pool();
+
+    public:
+      static phasor_frame_pool &instance();
+
+      //Make sure at least nframes frames exist, each able to hold num_phasors phasors without growing
+      void reserve(size_t nframes, size_t num_phasors);
+
+      //A recycled frame, or NULL once the pool is at its limit with every frame in flight
+      phasor_frame *acquire();
+
+      //Throws if the frame is already back in the pool
+      void release(phasor_frame *frame);
+
+      //True if frame came from this pool and has not been released, so a pointer read
+      //back from a recording or a second consumer is never dereferenced
+      bool in_flight(const phasor_frame *frame);
+
+      //Frames ever created, and frames currently waiting in the pool
+      size_t allocated();
+      size_t available();
+    };
+
+  } /* namespace fast_square */
+} /* namespace gr */
+
+#endif /* INCLUDED_FAST_SQUARE_PHASOR_FRAME_H */
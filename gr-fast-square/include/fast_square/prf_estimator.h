@@ -5,22 +5,96 @@
 #include <fast_square/api.h>
 #include <gnuradio/sync_block.h>
 #include <gnuradio/msg_queue.h>
+#include <fast_square/defines.h>
 
 namespace gr {
   namespace fast_square {
 
+    //! How prf_estimator obtains the magnitude spectra its search reads
+    enum prf_backend {
+      PRF_BACKEND_FFT = 0,      //!< Full batched FFT of every step
+      PRF_BACKEND_GOERTZEL = 1, //!< Goertzel on only the bins the search can touch
+      PRF_BACKEND_AUTO = 2      //!< Per search, whichever of the two is cheaper on this host
+    };
+
     class FAST_SQUARE_API prf_estimator : virtual public gr::sync_block
     {
     public:
       typedef boost::shared_ptr<prf_estimator> sptr;
 
-      static sptr make(int fft_size, bool forward, const std::vector<float> &window, bool shift, int nthreads, const std::string &tag_name);
+      /*!
+       * \param coarse_precision Spacing of the initial PRF grid, relative to PRF
+       * \param fine_precision Spacing reached after refine_depth refinement levels, relative to PRF
+       * \param refine_depth Number of local refinement levels after the coarse grid (0 = coarse grid only)
+       * \param tracking Once a PRF is acquired, only search a narrow window around the filtered estimate
+       * \param backend Spectrum backend.  Goertzel costs the same per bin at
+       *        any fft_size while the FFT grows with it, so Goertzel only pays
+       *        off for narrow windows at large fft_size (apps/bench_prf_backend).
+       *        PRF_BACKEND_AUTO times both at construction and picks per search.
+       * \param anchor_mask Bit ii fuses the spectrum of input ii into the search
+       *
+       * The block is a sink on the stream_parser outputs, so snapshots are
+       * never copied; input ii carries anchor ii.  With more than one anchor
+       * selected, each spectrum is normalized by its own noise floor and the
+       * results are summed before scoring, so a shadowed anchor cannot pull
+       * the estimate away.  The anchors share one batched FFT plan, which
+       * nthreads splits across threads.  For every snapshot it publishes a
+       * dict on the "prf_out" message port, which harmonic_extractor's
+       * "prf_in" port turns back into tags on the matching item.  The dict
+       * holds the snapshot's item offset ("offset") and sequence number
+       * ("seq"), the PRF estimate (tag_name), tag_name_state ("acquire" or
+       * "track") and tag_name_var with the variance of the filtered
+       * estimate in Hz^2.  Snapshots that ran a full search also carry
+       * tag_name_top, an f64vector of (prf, score) pairs for the
+       * PRF_TOP_K strongest coarse peaks.  tag_name_conf is an f64vector of
+       * per-anchor confidences, one per input (see anchor_confidence()).
+       * prf_start_ns and prf_done_ns bracket the estimate on
+       * CLOCK_MONOTONIC; harmonic_extractor moves them into the snapshot
+       * header's trace instead of tagging them.
+       *
+       * With max_tags > 1 the estimator follows up to that many tags at
+       * once, each with its own tracker, all reading the one spectrum
+       * computed per snapshot.  A full search runs only while fewer than
+       * max_tags tags are locked; its strongest coarse peaks that clear
+       * TRACK_LOCK_RATIO and lie at least TAG_MIN_SEPARATION*PRF from
+       * every other tag become new tags.  Every tag keeps its id for as
+       * long as it is followed, and a tag found again near the PRF of one
+       * lost within the last TAG_EXPIRY snapshots gets that id back, as the
+       * localizer still holds its state.  tag_name_tags (an
+       * s32vector of ids) and tag_name_prfs (an f64vector) list the tags
+       * of the snapshot; tag_name, _state and _var describe the first one.
+       * With max_tags = 1 there is always exactly one tag, id 0.
+       */
+      static sptr make(int fft_size, bool forward, const std::vector<float> &window, bool shift, int nthreads, const std::string &tag_name,
+                       double coarse_precision=COARSE_PRECISION, double fine_precision=FINE_PRECISION, int refine_depth=REFINE_DEPTH,
+                       bool tracking=true, prf_backend backend=PRF_BACKEND_FFT, int anchor_mask=(1 << PRF_EST_ANCHOR), int max_tags=1);
       
       virtual void set_nthreads(int n) = 0;
 
       virtual int nthreads() const = 0;
 
       virtual bool set_window(const std::vector<float> &window) = 0;
+
+      //! Number of magnitude bins gathered by the PRF search of the last snapshot
+      virtual int search_cost() const = 0;
+
+      //! True while the estimator is locked on the first tag and running narrow-window searches
+      virtual bool is_tracking() const = 0;
+
+      //! Tags reported for the last snapshot
+      virtual int num_tags() const = 0;
+
+      /*!
+       * Peak-to-floor ratio of each anchor's own spectrum at the last
+       * estimate, indexed by input.  Anchors not in anchor_mask read 0.
+       */
+      virtual std::vector<float> anchor_confidence() const = 0;
+
+      //! Latency histogram of a stat_stage, in STATS_BUCKETS log2 buckets of ns (see block_stats)
+      virtual std::vector<int> stage_histogram(int stage) const = 0;
+
+      //! Hot-path counters, indexed by stat_counter
+      virtual std::vector<int> stat_counters() const = 0;
     };
 
   } /* namespace fast_square */
@@ -0,0 +1,94 @@
+#ifndef INCLUDED_FAST_SQUARE_SNAPSHOT_FRAME_H
+#define INCLUDED_FAST_SQUARE_SNAPSHOT_FRAME_H
+
+#include <gnuradio/gr_complex.h>
+#include <fast_square/defines.h>
+#include <boost/static_assert.hpp>
+#include <stdint.h>
+
+namespace gr {
+  namespace fast_square {
+
+    class phasor_frame;
+
+    //Stage start and end times a snapshot collects on its way to harmonic_localizer
+    enum trace_point {
+      TRACE_PRF_START = 0,
+      TRACE_PRF_DONE,
+      TRACE_EXTRACT_START,
+      TRACE_EXTRACT_DONE,
+      TRACE_POINTS
+    };
+
+    /*!
+     * Header at the start of every snapshot item passed between the
+     * fast_square blocks.  It is padded to 64 bytes so the samples that
+     * follow keep the alignment of the item itself.
+     *
+     * ingest_ns is the monotonic time stream_parser emitted the snapshot.
+     * Each later stage records when it started and finished on the
+     * snapshot in trace_ns, as ns after ingest_ns.  The gap between one
+     * stage's end and the next stage's start is time spent queued.
+     */
+    struct snapshot_header
+    {
+      uint32_t sequence_num;  //Sequence number decoded by stream_parser
+      uint32_t anchor_mask;   //Bit ii is set if anchor ii contributed to this snapshot
+      double prf_est;         //PRF estimate, 0 until prf_estimator has seen the snapshot
+      phasor_frame *phasors;  //Harmonic phasors on harmonic_extractor's output 0, owned by the block that reads them
+      uint8_t harmonic_start; //First of the NUM_HARMONICS_PER_STEP harmonics harmonic_extractor computed
+      uint8_t num_harmonics;  //Harmonics per step in the phasor frame, 0 until harmonic_extractor has run
+      uint8_t reserved0[6];
+      uint64_t ingest_ns;     //CLOCK_MONOTONIC when stream_parser emitted the snapshot
+      uint32_t trace_ns[TRACE_POINTS]; //Indexed by trace_point, ns after ingest_ns, 0 until the stage has run
+      uint8_t reserved[8];
+    };
+
+    //now_ns as a trace_ns entry, saturating rather than wrapping after about four seconds
+    inline uint32_t traceOffset(const snapshot_header *hdr, uint64_t now_ns){
+      if(now_ns <= hdr->ingest_ns)
+        return 0;
+      uint64_t offset = now_ns - hdr->ingest_ns;
+      return (offset > 0xffffffffull) ? 0xffffffffu : (uint32_t)offset;
+    }
+
+    //A snapshot item is the header followed by NUM_STEPS steps of FFT_SIZE samples, padded
+    //to whole pages.  GNU Radio sizes a stream buffer in multiples of lcm(page, item)/item
+    //items: an item of 49 pages costs one item per multiple, while the unpadded 200256 bytes
+    //would cost 64 items (12.8 MB) per buffer.  The padding (448 bytes) is never written.
+#define SNAPSHOT_SAMPLES (NUM_STEPS*FFT_SIZE)
+#define SNAPSHOT_PAGE_SIZE 4096
+#define SNAPSHOT_FRAME_SIZE ((sizeof(gr::fast_square::snapshot_header) + SNAPSHOT_SAMPLES*sizeof(gr_complex) + \
+		SNAPSHOT_PAGE_SIZE-1)/SNAPSHOT_PAGE_SIZE*SNAPSHOT_PAGE_SIZE)
+    BOOST_STATIC_ASSERT(sizeof(snapshot_header) == 64);
+    BOOST_STATIC_ASSERT(SNAPSHOT_FRAME_SIZE % SNAPSHOT_PAGE_SIZE == 0);
+
+    inline snapshot_header *snapshotHeader(void *frame){
+      return (snapshot_header *)frame;
+    }
+
+    inline const snapshot_header *snapshotHeader(const void *frame){
+      return (const snapshot_header *)frame;
+    }
+
+    inline gr_complex *snapshotData(void *frame){
+      return (gr_complex *)((uint8_t *)frame + sizeof(snapshot_header));
+    }
+
+    inline const gr_complex *snapshotData(const void *frame){
+      return (const gr_complex *)((const uint8_t *)frame + sizeof(snapshot_header));
+    }
+
+    //Item idx of a snapshot stream buffer
+    inline void *snapshotFrame(void *items, int idx){
+      return (uint8_t *)items + (size_t)idx*SNAPSHOT_FRAME_SIZE;
+    }
+
+    inline const void *snapshotFrame(const void *items, int idx){
+      return (const uint8_t *)items + (size_t)idx*SNAPSHOT_FRAME_SIZE;
+    }
+
+  } /* namespace fast_square */
+} /* namespace gr */
+
+#endif /* INCLUDED_FAST_SQUARE_SNAPSHOT_FRAME_H */
@@ -15,7 +15,21 @@ namespace gr {
       // gr::digital::framer_sink_1::sptr
       typedef boost::shared_ptr<stream_parser> sptr;
 
-      static sptr make();
+      /*!
+       * Input ii carries anchor ii; connect one input per anchor, up to
+       * MAX_ANCHORS.  Output ii carries the aligned snapshots of anchor ii.
+       *
+       * \param journal log a binary timestamp for every aligned snapshot
+       * \param journal_file file the timestamp journal is written to
+       * \param sc16 inputs carry raw 16-bit I/Q (sc16) instead of fc32
+       */
+      static sptr make(bool journal=true, const std::string &journal_file="timestamps.journal", bool sc16=false);
+
+      //! Latency histogram of a stat_stage, in STATS_BUCKETS log2 buckets of ns (see block_stats)
+      virtual std::vector<int> stage_histogram(int stage) const = 0;
+
+      //! Hot-path counters, indexed by stat_counter
+      virtual std::vector<int> stat_counters() const = 0;
     };
 
   } /* namespace fast_square */
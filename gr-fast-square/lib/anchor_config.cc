@@ -0,0 +1,73 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <fast_square/anchor_config.h>
+#include <gnuradio/gr_complex.h>
+#include <fast_square/defines.h>
+#include <stdexcept>
+#include <fstream>
+#include <sstream>
+
+namespace gr {
+namespace fast_square {
+
+anchor_config::anchor_config(const std::string &path){
+	if(path.empty()){
+		//Anchors of the original four-anchor testbed
+		float ax[4] = {2.405, 2.105, 4.108, 0.273};
+		float ay[4] = {3.815, 0.034, 0.347, 0.343};
+		float az[4] = {2.992, 2.494, 1.543, 1.560};
+		for(int ii=0; ii < 4; ii++){
+			std::vector<float> cur_anchor_pos(3);
+			cur_anchor_pos[0] = ax[ii];
+			cur_anchor_pos[1] = ay[ii];
+			cur_anchor_pos[2] = az[ii];
+			d_positions.push_back(cur_anchor_pos);
+			d_thresholds.push_back(ANCHOR_THRESHOLD);
+		}
+		return;
+	}
+
+	std::ifstream file(path.c_str());
+	if(!file)
+		throw std::runtime_error("anchor_config: cannot open " + path);
+
+	std::string line;
+	int line_num = 0;
+	while(std::getline(file, line)){
+		line_num++;
+		line = line.substr(0, line.find('#'));
+		std::istringstream fields(line);
+		std::vector<float> cur_anchor_pos(3);
+		if(!(fields >> cur_anchor_pos[0])){
+			//Blank or comment-only line
+			continue;
+		}
+
+		std::ostringstream where;
+		where << path << ":" << line_num;
+		float threshold = ANCHOR_THRESHOLD;
+		if(!(fields >> cur_anchor_pos[1] >> cur_anchor_pos[2]))
+			throw std::runtime_error("anchor_config: " + where.str() + ": expected x y z [threshold]");
+		std::string token;
+		if(fields >> token){
+			std::istringstream value(token);
+			if(!(value >> threshold) || !value.eof())
+				throw std::runtime_error("anchor_config: " + where.str() + ": bad threshold \"" + token + "\"");
+			if(threshold <= 0.0 || threshold > 1.0)
+				throw std::out_of_range("anchor_config: " + where.str() + ": threshold must lie in (0, 1]");
+			if(fields >> token)
+				throw std::runtime_error("anchor_config: " + where.str() + ": unexpected \"" + token + "\"");
+		}
+
+		d_positions.push_back(cur_anchor_pos);
+		d_thresholds.push_back(threshold);
+	}
+
+	if(d_positions.size() < 4 || d_positions.size() > MAX_ANCHORS)
+		throw std::out_of_range("anchor_config: " + path + " must list between 4 and MAX_ANCHORS anchors");
+}
+
+} /* namespace fast_square */
+} /* namespace gr */
@@ -0,0 +1,79 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "batched_fft.h"
+#include <gnuradio/fft/fft.h>
+#include <stdexcept>
+#include <cstring>
+
+namespace gr {
+namespace fast_square {
+
+batched_fft::batched_fft(int fft_size, int batch, bool forward, int nthreads)
+	: d_fft_size(fft_size), d_batch(batch), d_forward(forward), d_nthreads(nthreads), d_plan(NULL)
+{
+	if(d_fft_size <= 0 || d_batch <= 0)
+		throw std::out_of_range("batched_fft: invalid fft size or batch count");
+
+	d_inbuf = (gr_complex *)fftwf_malloc(sizeof(gr_complex)*d_fft_size*d_batch);
+	d_outbuf = (gr_complex *)fftwf_malloc(sizeof(gr_complex)*d_fft_size*d_batch);
+	if(d_inbuf == NULL || d_outbuf == NULL)
+		throw std::runtime_error("batched_fft: unable to allocate buffers");
+
+	makePlan();
+
+	//Planning may scribble on the buffers, so start callers off with zero padding
+	memset((void *)d_inbuf, 0, sizeof(gr_complex)*d_fft_size*d_batch);
+}
+
+batched_fft::~batched_fft(){
+	fft::planner::scoped_lock lock(fft::planner::mutex());
+	fftwf_destroy_plan(d_plan);
+	fftwf_free(d_inbuf);
+	fftwf_free(d_outbuf);
+}
+
+void batched_fft::makePlan(){
+	//FFTW's planner isn't thread safe, so share GNU Radio's planner lock
+	fft::planner::scoped_lock lock(fft::planner::mutex());
+
+	static bool threads_initialized = false;
+	if(!threads_initialized){
+		fftwf_init_threads();
+		threads_initialized = true;
+	}
+
+	if(d_plan)
+		fftwf_destroy_plan(d_plan);
+
+	fftwf_plan_with_nthreads(d_nthreads);
+	int n[1] = {d_fft_size};
+	d_plan = fftwf_plan_many_dft(1, n, d_batch,
+			reinterpret_cast<fftwf_complex *>(d_inbuf), NULL, 1, d_fft_size,
+			reinterpret_cast<fftwf_complex *>(d_outbuf), NULL, 1, d_fft_size,
+			d_forward ? FFTW_FORWARD : FFTW_BACKWARD, FFTW_MEASURE);
+	if(d_plan == NULL)
+		throw std::runtime_error("batched_fft: fftwf_plan_many_dft failed");
+}
+
+void batched_fft::execute(){
+	fftwf_execute(d_plan);
+}
+
+void batched_fft::set_nthreads(int n){
+	if(n <= 0)
+		throw std::out_of_range("batched_fft: nthreads must be > 0");
+	d_nthreads = n;
+
+	//Re-planning with FFTW_MEASURE overwrites the input buffer, so keep its contents
+	int nbytes = sizeof(gr_complex)*d_fft_size*d_batch;
+	gr_complex *saved = (gr_complex *)fftwf_malloc(nbytes);
+	memcpy((void *)saved, d_inbuf, nbytes);
+	makePlan();
+	memcpy((void *)d_inbuf, saved, nbytes);
+	fftwf_free(saved);
+}
+
+} /* namespace fast_square */
+} /* namespace gr */
@@ -0,0 +1,47 @@
+#ifndef INCLUDED_FAST_SQUARE_BATCHED_FFT_H
+#define INCLUDED_FAST_SQUARE_BATCHED_FFT_H
+
+#include <gnuradio/gr_complex.h>
+#include <fftw3.h>
+
+namespace gr {
+namespace fast_square {
+
+/*!
+ * A batch of equally sized complex FFTs executed through a single FFTW
+ * plan.  Transform ii reads get_inbuf()[ii*fft_size() ...] and writes
+ * get_outbuf()[ii*fft_size() ...].  With more than one thread, FFTW splits
+ * the batch across threads rather than parallelizing inside each transform.
+ */
+class batched_fft
+{
+private:
+	int d_fft_size;
+	int d_batch;
+	bool d_forward;
+	int d_nthreads;
+	gr_complex *d_inbuf;
+	gr_complex *d_outbuf;
+	fftwf_plan d_plan;
+
+	void makePlan();
+
+public:
+	batched_fft(int fft_size, int batch, bool forward, int nthreads);
+	~batched_fft();
+
+	gr_complex *get_inbuf() const { return d_inbuf; }
+	gr_complex *get_outbuf() const { return d_outbuf; }
+	int fft_size() const { return d_fft_size; }
+	int batch() const { return d_batch; }
+
+	void execute();
+
+	void set_nthreads(int n);
+	int nthreads() const { return d_nthreads; }
+};
+
+} /* namespace fast_square */
+} /* namespace gr */
+
+#endif /* INCLUDED_FAST_SQUARE_BATCHED_FFT_H */
@@ -0,0 +1,50 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <fast_square/block_stats.h>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+
+namespace gr {
+namespace fast_square {
+
+static bool s_stats_enabled = (getenv("FAST_SQUARE_STATS") != NULL);
+
+static int saturate(uint64_t value){
+	return (value > INT_MAX) ? INT_MAX : (int)value;
+}
+
+block_stats::block_stats(){
+	memset(d_buckets, 0, sizeof(d_buckets));
+	memset(d_counters, 0, sizeof(d_counters));
+}
+
+bool block_stats::enabled(){
+	return __atomic_load_n(&s_stats_enabled, __ATOMIC_RELAXED);
+}
+
+void block_stats::set_enabled(bool enabled){
+	__atomic_store_n(&s_stats_enabled, enabled, __ATOMIC_RELAXED);
+}
+
+std::vector<int> block_stats::histogram(int stage) const{
+	if(stage < 0 || stage >= NUM_STAGES)
+		throw std::out_of_range("block_stats: no such stage");
+	std::vector<int> ret(STATS_BUCKETS);
+	for(int ii=0; ii < STATS_BUCKETS; ii++)
+		ret[ii] = saturate(__atomic_load_n(&d_buckets[stage][ii], __ATOMIC_RELAXED));
+	return ret;
+}
+
+std::vector<int> block_stats::counters() const{
+	std::vector<int> ret(NUM_COUNTERS);
+	for(int ii=0; ii < NUM_COUNTERS; ii++)
+		ret[ii] = saturate(__atomic_load_n(&d_counters[ii], __ATOMIC_RELAXED));
+	return ret;
+}
+
+} /* namespace fast_square */
+} /* namespace gr */
@@ -0,0 +1,158 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "cir_kernels.h"
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#include <immintrin.h>
+#define CIR_KERNELS_X86
+#endif
+
+namespace gr {
+namespace fast_square {
+
+typedef int (*magsq_argmax_fn)(const gr_complex *in, float *magsq, int n, float &max_magsq);
+typedef int (*search_fn)(const float *magsq, int n, float thresh_sq);
+
+static int magsq_argmax_generic(const gr_complex *in, float *magsq, int n, float &max_magsq){
+	int max_idx = 0;
+	max_magsq = -1.0;
+	for(int ii=0; ii < n; ii++){
+		float re = in[ii].real(), im = in[ii].imag();
+		magsq[ii] = re*re + im*im;
+		if(magsq[ii] > max_magsq){
+			max_magsq = magsq[ii];
+			max_idx = ii;
+		}
+	}
+	return max_idx;
+}
+
+static int first_at_or_above_generic(const float *magsq, int n, float thresh_sq){
+	for(int ii=0; ii < n; ii++)
+		if(magsq[ii] >= thresh_sq)
+			return ii;
+	return -1;
+}
+
+static int last_at_or_above_generic(const float *magsq, int n, float thresh_sq){
+	for(int ii=n-1; ii >= 0; ii--)
+		if(magsq[ii] >= thresh_sq)
+			return ii;
+	return -1;
+}
+
+#ifdef CIR_KERNELS_X86
+__attribute__((target("avx2")))
+static int magsq_argmax_avx2(const gr_complex *in, float *magsq, int n, float &max_magsq){
+	const float *src = (const float *)in;
+	//hadd leaves samples 0,1,4,5 | 2,3,6,7 in the two lanes; this puts them back in order
+	const __m256i order = _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7);
+	__m256 max_v = _mm256_set1_ps(-1.0f);
+	__m256i idx_v = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i max_idx_v = idx_v;
+	const __m256i eight = _mm256_set1_epi32(8);
+
+	int ii = 0;
+	for(; ii + 8 <= n; ii += 8){
+		__m256 lo = _mm256_loadu_ps(src + 2*ii), hi = _mm256_loadu_ps(src + 2*ii + 8);
+		__m256 sq = _mm256_hadd_ps(_mm256_mul_ps(lo, lo), _mm256_mul_ps(hi, hi));
+		sq = _mm256_permutevar8x32_ps(sq, order);
+		_mm256_storeu_ps(magsq + ii, sq);
+
+		//Strictly greater keeps the earliest index in every lane
+		__m256 gt = _mm256_cmp_ps(sq, max_v, _CMP_GT_OQ);
+		max_v = _mm256_blendv_ps(max_v, sq, gt);
+		max_idx_v = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(max_idx_v), _mm256_castsi256_ps(idx_v), gt));
+		idx_v = _mm256_add_epi32(idx_v, eight);
+	}
+
+	float lane_max[8];
+	int lane_idx[8];
+	_mm256_storeu_ps(lane_max, max_v);
+	_mm256_storeu_si256((__m256i *)lane_idx, max_idx_v);
+	int max_idx = 0;
+	max_magsq = -1.0;
+	for(int ll=0; ll < 8; ll++){
+		if(lane_max[ll] > max_magsq || (lane_max[ll] == max_magsq && lane_idx[ll] < max_idx)){
+			max_magsq = lane_max[ll];
+			max_idx = lane_idx[ll];
+		}
+	}
+
+	for(; ii < n; ii++){
+		float re = in[ii].real(), im = in[ii].imag();
+		magsq[ii] = re*re + im*im;
+		if(magsq[ii] > max_magsq){
+			max_magsq = magsq[ii];
+			max_idx = ii;
+		}
+	}
+	return max_idx;
+}
+
+__attribute__((target("avx2")))
+static int first_at_or_above_avx2(const float *magsq, int n, float thresh_sq){
+	const __m256 thresh = _mm256_set1_ps(thresh_sq);
+	int ii = 0;
+	for(; ii + 8 <= n; ii += 8){
+		int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(magsq + ii), thresh, _CMP_GE_OQ));
+		if(mask)
+			return ii + __builtin_ctz(mask);
+	}
+	for(; ii < n; ii++)
+		if(magsq[ii] >= thresh_sq)
+			return ii;
+	return -1;
+}
+
+__attribute__((target("avx2")))
+static int last_at_or_above_avx2(const float *magsq, int n, float thresh_sq){
+	const __m256 thresh = _mm256_set1_ps(thresh_sq);
+	int ii = n;
+	for(; ii - 8 >= 0; ii -= 8){
+		int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(magsq + ii - 8), thresh, _CMP_GE_OQ));
+		if(mask)
+			return ii - 8 + 31 - __builtin_clz(mask);
+	}
+	for(ii--; ii >= 0; ii--)
+		if(magsq[ii] >= thresh_sq)
+			return ii;
+	return -1;
+}
+#endif
+
+static magsq_argmax_fn pickMagsqArgmax(){
+#ifdef CIR_KERNELS_X86
+	if(__builtin_cpu_supports("avx2"))
+		return magsq_argmax_avx2;
+#endif
+	return magsq_argmax_generic;
+}
+
+static search_fn pickSearch(bool last){
+#ifdef CIR_KERNELS_X86
+	if(__builtin_cpu_supports("avx2"))
+		return last ? last_at_or_above_avx2 : first_at_or_above_avx2;
+#endif
+	return last ? last_at_or_above_generic : first_at_or_above_generic;
+}
+
+int cir_magsq_argmax(const gr_complex *in, float *magsq, int n, float &max_magsq){
+	static const magsq_argmax_fn fn = pickMagsqArgmax();
+	return fn(in, magsq, n, max_magsq);
+}
+
+int cir_first_at_or_above(const float *magsq, int n, float thresh_sq){
+	static const search_fn fn = pickSearch(false);
+	return fn(magsq, n, thresh_sq);
+}
+
+int cir_last_at_or_above(const float *magsq, int n, float thresh_sq){
+	static const search_fn fn = pickSearch(true);
+	return fn(magsq, n, thresh_sq);
+}
+
+} /* namespace fast_square */
+} /* namespace gr */
@@ -0,0 +1,26 @@
+#ifndef INCLUDED_FAST_SQUARE_CIR_KERNELS_H
+#define INCLUDED_FAST_SQUARE_CIR_KERNELS_H
+
+#include <gnuradio/gr_complex.h>
+
+namespace gr {
+namespace fast_square {
+
+/*
+ * Kernels for searching a channel impulse response.  They work on squared
+ * magnitudes throughout, so callers square their thresholds once instead
+ * of taking a square root per sample.  Each uses AVX2 when the CPU has it,
+ * picked at runtime, and falls back to plain loops otherwise.
+ */
+
+//Writes |in[i]|^2 to magsq[i] and returns the index of the first largest one, with its value in max_magsq
+int cir_magsq_argmax(const gr_complex *in, float *magsq, int n, float &max_magsq);
+
+//Index of the first / last magsq[i] >= thresh_sq, or -1 if there is none; stops at the first hit
+int cir_first_at_or_above(const float *magsq, int n, float thresh_sq);
+int cir_last_at_or_above(const float *magsq, int n, float thresh_sq);
+
+} /* namespace fast_square */
+} /* namespace gr */
+
+#endif /* INCLUDED_FAST_SQUARE_CIR_KERNELS_H */
@@ -0,0 +1,168 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "cir_zoom.h"
+#include "cir_kernels.h"
+#include <volk/volk.h>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+namespace gr {
+namespace fast_square {
+
+cir_zoom::cir_zoom(int length, int interp, int nthreads)
+	: d_length(length), d_interp(interp), d_span(2*interp+1)
+{
+	if(length <= 0 || (length & 1) || interp <= 0)
+		throw std::out_of_range("cir_zoom: length must be even and positive, interp positive");
+
+	//The linear convolution of length chirped bins with the span-long filter must not wrap
+	d_conv_len = 1;
+	while(d_conv_len < d_length + d_span - 1)
+		d_conv_len <<= 1;
+
+	d_coarse_fft = new fft::fft_complex(d_length, true, nthreads);
+	d_fwd = new fft::fft_complex(d_conv_len, true, 1);
+	d_inv = new fft::fft_complex(d_conv_len, false, 1);
+
+	d_spectrum.resize(d_length);
+	d_coarse_magsq.resize(d_length);
+	d_zoom_magsq.resize(d_span);
+
+	//Chirp in double: k^2 gets large enough that float phases would drift
+	int fine_len = d_length*d_interp;
+	d_chirp.resize(std::max(d_length, d_span));
+	for(int kk=0; kk < d_chirp.size(); kk++){
+		double phase = -M_PI*(double)(((long)kk*kk) % (2*fine_len))/fine_len;
+		d_chirp[kk] = gr_complex(cos(phase), sin(phase));
+	}
+
+	//Filter taps conj(chirp[|d|]) for lags -(length-1)..span-1, negative lags wrapped to the end
+	gr_complex *taps = d_fwd->get_inbuf();
+	memset(taps, 0, d_conv_len*sizeof(gr_complex));
+	for(int dd=0; dd < d_span; dd++)
+		taps[dd] = std::conj(d_chirp[dd]);
+	for(int dd=1; dd < d_length; dd++)
+		taps[d_conv_len-dd] = std::conj(d_chirp[dd]);
+	d_fwd->execute();
+	d_filter.assign(d_fwd->get_outbuf(), d_fwd->get_outbuf() + d_conv_len);
+	for(int ii=0; ii < d_conv_len; ii++)
+		d_filter[ii] /= (float)d_conv_len;
+}
+
+cir_zoom::~cir_zoom(){
+	delete d_coarse_fft;
+	delete d_fwd;
+	delete d_inv;
+}
+
+void cir_zoom::set_spectrum(const gr_complex *spectrum){
+	//Every interp-th sample of the zero-padded response is just the unpadded transform
+	memcpy(d_coarse_fft->get_inbuf(), spectrum, d_length*sizeof(gr_complex));
+	d_coarse_fft->execute();
+	cir_magsq_argmax(d_coarse_fft->get_outbuf(), &d_coarse_magsq[0], d_length, d_coarse_max);
+
+	//Put the bins in frequency order so the zoom can treat them as a plain polynomial
+	int half = d_length/2;
+	memcpy(&d_spectrum[0], spectrum + half, half*sizeof(gr_complex));
+	memcpy(&d_spectrum[half], spectrum, half*sizeof(gr_complex));
+}
+
+void cir_zoom::zoom(int coarse_idx){
+	//Fine samples (coarse_idx-1)*interp .. (coarse_idx+1)*interp.  Reordering the bins
+	//only rotates every sample's phase, which the magnitude ignores.
+	int fine_len = d_length*d_interp;
+	int start = (coarse_idx - 1)*d_interp;
+	if(start < 0)
+		start += fine_len;
+
+	//Shift to the window start, then chirp
+	gr_complex *buf = d_fwd->get_inbuf();
+	for(int qq=0; qq < d_length; qq++){
+		double phase = -2.0*M_PI*(double)(((long)qq*start) % fine_len)/fine_len;
+		buf[qq] = d_spectrum[qq]*gr_complex(cos(phase), sin(phase))*d_chirp[qq];
+	}
+	memset(buf + d_length, 0, (d_conv_len - d_length)*sizeof(gr_complex));
+	d_fwd->execute();
+
+	volk_32fc_x2_multiply_32fc(d_inv->get_inbuf(), d_fwd->get_outbuf(), &d_filter[0], d_conv_len);
+	d_inv->execute();
+
+	//The trailing chirp is unit magnitude too
+	d_zoom_max_idx = cir_magsq_argmax(d_inv->get_outbuf(), &d_zoom_magsq[0], d_span, d_zoom_max);
+}
+
+int cir_zoom::fineIndex(int coarse_idx, int zoom_idx) const{
+	int fine_len = d_length*d_interp;
+	return ((coarse_idx - 1)*d_interp + zoom_idx + fine_len) % fine_len;
+}
+
+int cir_zoom::find_peak(float &max_mag){
+	//A peak falling between coarse samples shows up lower than it is, so zoom in on
+	//every coarse local maximum that could still be the strongest
+	float floor_sq = CIR_ZOOM_MARGIN*CIR_ZOOM_MARGIN*d_coarse_max;
+	int peak_idx = 0;
+	float max_magsq = -1.0;
+	for(int ii=0; ii < d_length; ii++){
+		float cur = d_coarse_magsq[ii];
+		if(cur < floor_sq || cur < d_coarse_magsq[(ii+d_length-1) % d_length] || cur < d_coarse_magsq[(ii+1) % d_length])
+			continue;
+		zoom(ii);
+		if(d_zoom_max > max_magsq){
+			max_magsq = d_zoom_max;
+			peak_idx = fineIndex(ii, d_zoom_max_idx);
+		}
+	}
+	max_mag = sqrt(max_magsq);
+	return peak_idx;
+}
+
+bool cir_zoom::zoomCrossing(int coarse_idx, float thresh_sq, bool last, int &fine_idx){
+	zoom(coarse_idx);
+	int idx = last ? cir_last_at_or_above(&d_zoom_magsq[0], d_span, thresh_sq) : cir_first_at_or_above(&d_zoom_magsq[0], d_span, thresh_sq);
+	if(idx < 0)
+		return false;
+	fine_idx = fineIndex(coarse_idx, idx);
+	return true;
+}
+
+int cir_zoom::find_first_path(int peak_idx, float max_mag, float thresh){
+	//Coarse walk from the peak until a quarter period in a row stays below the threshold.
+	//Samples clearly above it count as above; those just under it may hide a crossing
+	//between coarse samples, so only those get zoomed in on.
+	//Everything compares squared magnitudes
+	int fine_len = d_length*d_interp;
+	float fine_thresh = thresh*max_mag*thresh*max_mag;
+	float coarse_thresh = CIR_ZOOM_MARGIN*CIR_ZOOM_MARGIN*fine_thresh;
+	int cur = ((peak_idx + d_interp/2)/d_interp) % d_length;
+	int last_above = cur;
+	int below_threshold_count = 0;
+	int first_idx, last_idx;
+	for(int ii=1; ii < d_length; ii++){
+		cur = (cur + 1) % d_length;
+		float mag = d_coarse_magsq[cur];
+		if(mag >= fine_thresh || (mag >= coarse_thresh && zoomCrossing(cur, fine_thresh, false, first_idx))){
+			//A gap within a coarse sample of the limit is measured at full resolution
+			if(below_threshold_count >= d_length/4 - 1 &&
+					zoomCrossing(cur, fine_thresh, false, first_idx) && zoomCrossing(last_above, fine_thresh, true, last_idx) &&
+					(first_idx - last_idx - 1 + fine_len) % fine_len > fine_len/4)
+				break;
+			last_above = cur;
+			below_threshold_count = 0;
+		} else {
+			below_threshold_count++;
+			if(below_threshold_count > d_length/4) break;
+		}
+	}
+
+	//Fine pass: the last sample over the threshold around the last coarse sample above it
+	if(zoomCrossing(last_above, fine_thresh, true, last_idx))
+		return last_idx;
+	return peak_idx;
+}
+
+} /* namespace fast_square */
+} /* namespace gr */
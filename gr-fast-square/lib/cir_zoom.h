@@ -0,0 +1,81 @@
+#ifndef INCLUDED_FAST_SQUARE_CIR_ZOOM_H
+#define INCLUDED_FAST_SQUARE_CIR_ZOOM_H
+
+#include <gnuradio/gr_complex.h>
+#include <gnuradio/fft/fft.h>
+#include <vector>
+
+namespace gr {
+namespace fast_square {
+
+#define CIR_ZOOM_MARGIN 0.7 //Coarse samples down to this fraction of a level may still reach it between them
+
+/*!
+ * Two-stage search of the interpolated channel impulse response of one
+ * anchor.  The response the localizer used to build, the length*interp
+ * point FFT of the spectrum zero-padded in the middle, is only ever
+ * searched for its peak and for the first path, so neither needs the
+ * whole thing:
+ *
+ *   - a length point FFT gives every interp-th sample of it (the coarse
+ *     response), which is enough to locate the peak and the region the
+ *     first path lies in;
+ *   - a chirp-z transform then evaluates the response at full resolution
+ *     over 2*interp+1 samples around a coarse index.
+ *
+ * The chirp-z transform runs as a convolution through FFTs of the next
+ * power of two at or above length + 2*interp, whose chirp filter is
+ * precomputed.  Indices returned are in the fine grid 0..length*interp-1,
+ * the same as those of the full response.
+ */
+class cir_zoom
+{
+private:
+	int d_length;
+	int d_interp;
+	int d_span;     //Fine samples per zoom window
+	int d_conv_len;
+	fft::fft_complex *d_coarse_fft;
+	fft::fft_complex *d_fwd;
+	fft::fft_complex *d_inv;
+	std::vector<gr_complex> d_spectrum; //Bins reordered from -length/2 to length/2-1
+	std::vector<gr_complex> d_chirp;    //exp(-j*pi*k^2/(length*interp))
+	std::vector<gr_complex> d_filter;   //FFT of the conjugate chirp, scaled by 1/d_conv_len
+	std::vector<float> d_coarse_magsq;  //Squared magnitudes, like everything compared below
+	std::vector<float> d_zoom_magsq;
+	float d_coarse_max;
+	float d_zoom_max;
+	int d_zoom_max_idx;
+
+	void zoom(int coarse_idx);
+	bool zoomCrossing(int coarse_idx, float thresh_sq, bool last, int &fine_idx);
+	int fineIndex(int coarse_idx, int zoom_idx) const;
+
+public:
+	cir_zoom(int length, int interp, int nthreads);
+	~cir_zoom();
+
+	/*!
+	 * Load the spectrum of one anchor in FFT order (DC first, negative
+	 * frequencies in the upper half) and compute its coarse response.
+	 */
+	void set_spectrum(const gr_complex *spectrum);
+
+	//Fine index and magnitude of the strongest sample of the response
+	int find_peak(float &max_mag);
+
+	/*!
+	 * Walking forward from the peak, the last fine sample at or above
+	 * thresh*max_mag before the response stays below it for more than a
+	 * quarter of the period.
+	 */
+	int find_first_path(int peak_idx, float max_mag, float thresh);
+
+	const std::vector<float> &coarse_magsq() const { return d_coarse_magsq; }
+	int fine_length() const { return d_length*d_interp; }
+};
+
+} /* namespace fast_square */
+} /* namespace gr */
+
+#endif /* INCLUDED_FAST_SQUARE_CIR_ZOOM_H */
@@ -0,0 +1,81 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gather_sum.h"
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#include <immintrin.h>
+#define GATHER_SUM_X86
+#endif
+
+namespace gr {
+namespace fast_square {
+
+static void gatherSum_generic(const float *data, const int32_t *table, int stride, int n, int rows, float *sums){
+	for(int rr=0; rr < rows; rr++){
+		const int32_t *idxs = table + (long)rr*stride;
+		float sum = 0.0;
+		for(int ii=0; ii < n; ii++)
+			sum += data[idxs[ii]];
+		sums[rr] = sum;
+	}
+}
+
+#ifdef GATHER_SUM_X86
+__attribute__((target("avx2")))
+static void gatherSum_avx2(const float *data, const int32_t *table, int stride, int n, int rows, float *sums){
+	for(int rr=0; rr < rows; rr++){
+		const int32_t *idxs = table + (long)rr*stride;
+		//Two accumulators so consecutive gathers do not wait on each other's adds
+		__m256 acc0 = _mm256_setzero_ps();
+		__m256 acc1 = _mm256_setzero_ps();
+		int ii = 0;
+		for(; ii + 16 <= n; ii += 16){
+			acc0 = _mm256_add_ps(acc0, _mm256_i32gather_ps(data, _mm256_loadu_si256((const __m256i *)(idxs + ii)), 4));
+			acc1 = _mm256_add_ps(acc1, _mm256_i32gather_ps(data, _mm256_loadu_si256((const __m256i *)(idxs + ii + 8)), 4));
+		}
+		acc0 = _mm256_add_ps(acc0, acc1);
+		__m128 acc = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+		acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+		acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+		float sum = _mm_cvtss_f32(acc);
+		for(; ii < n; ii++)
+			sum += data[idxs[ii]];
+		sums[rr] = sum;
+	}
+}
+
+__attribute__((target("avx512f")))
+static void gatherSum_avx512(const float *data, const int32_t *table, int stride, int n, int rows, float *sums){
+	for(int rr=0; rr < rows; rr++){
+		const int32_t *idxs = table + (long)rr*stride;
+		__m512 acc0 = _mm512_setzero_ps();
+		__m512 acc1 = _mm512_setzero_ps();
+		int ii = 0;
+		for(; ii + 32 <= n; ii += 32){
+			acc0 = _mm512_add_ps(acc0, _mm512_i32gather_ps(_mm512_loadu_si512(idxs + ii), data, 4));
+			acc1 = _mm512_add_ps(acc1, _mm512_i32gather_ps(_mm512_loadu_si512(idxs + ii + 16), data, 4));
+		}
+		float sum = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+		for(; ii < n; ii++)
+			sum += data[idxs[ii]];
+		sums[rr] = sum;
+	}
+}
+#endif
+
+void gatherSum(const float *data, const int32_t *table, int stride, int n, int rows, float *sums){
+#ifdef GATHER_SUM_X86
+	static const bool have_avx512 = __builtin_cpu_supports("avx512f");
+	static const bool have_avx2 = __builtin_cpu_supports("avx2");
+	if(have_avx512)
+		return gatherSum_avx512(data, table, stride, n, rows, sums);
+	if(have_avx2)
+		return gatherSum_avx2(data, table, stride, n, rows, sums);
+#endif
+	gatherSum_generic(data, table, stride, n, rows, sums);
+}
+
+} /* namespace fast_square */
+} /* namespace gr */
@@ -0,0 +1,19 @@
+#ifndef INCLUDED_FAST_SQUARE_GATHER_SUM_H
+#define INCLUDED_FAST_SQUARE_GATHER_SUM_H
+
+#include <stdint.h>
+
+namespace gr {
+namespace fast_square {
+
+/*!
+ * For each of rows rows of a flat index table (row r starts at
+ * table + r*stride), sums data[table[r*stride + 0..n)] into sums[r].
+ * Uses AVX-512 or AVX2 gathers when the CPU has them, picked at runtime.
+ */
+void gatherSum(const float *data, const int32_t *table, int stride, int n, int rows, float *sums);
+
+} /* namespace fast_square */
+} /* namespace gr */
+
+#endif /* INCLUDED_FAST_SQUARE_GATHER_SUM_H */
@@ -0,0 +1,226 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "harmonic_engine.h"
+#include <fast_square/defines.h>
+#include <volk/volk.h>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#include <immintrin.h>
+#define HARMONIC_ENGINE_X86
+#endif
+
+namespace gr {
+namespace fast_square {
+
+//C[h][c] = sum_k A[h][k]*B[c][k] over split complex rows of stride floats
+typedef void (*cgemm_fn)(const float *a_re, const float *a_im, int rows,
+		const float *b_re, const float *b_im, int cols, int stride, gr_complex *out);
+
+static void cgemm_generic(const float *a_re, const float *a_im, int rows,
+		const float *b_re, const float *b_im, int cols, int stride, gr_complex *out){
+	for(int cc=0; cc < cols; cc++){
+		const float *xr = b_re + (long)cc*stride, *xi = b_im + (long)cc*stride;
+		for(int hh=0; hh < rows; hh++){
+			const float *mr = a_re + (long)hh*stride, *mi = a_im + (long)hh*stride;
+			double tot_re = 0.0, tot_im = 0.0;
+			for(int kb=0; kb < stride; kb += HARMONIC_ENGINE_BLOCK){
+				//Independent lanes so the compiler can vectorize without reassociating
+				float acc_re[8] = {0}, acc_im[8] = {0};
+				int kend = std::min(stride, kb + HARMONIC_ENGINE_BLOCK);
+				for(int kk=kb; kk < kend; kk += 8){
+					for(int ll=0; ll < 8; ll++){
+						acc_re[ll] += mr[kk+ll]*xr[kk+ll] - mi[kk+ll]*xi[kk+ll];
+						acc_im[ll] += mr[kk+ll]*xi[kk+ll] + mi[kk+ll]*xr[kk+ll];
+					}
+				}
+				for(int ll=0; ll < 8; ll++){
+					tot_re += acc_re[ll];
+					tot_im += acc_im[ll];
+				}
+			}
+			out[(long)cc*rows + hh] = gr_complex(tot_re, tot_im);
+		}
+	}
+}
+
+#ifdef HARMONIC_ENGINE_X86
+__attribute__((target("avx2,fma")))
+static inline double hsum_avx2(__m256 v){
+	__m128 lo = _mm256_castps256_ps128(v), hi = _mm256_extractf128_ps(v, 1);
+	__m256d wide = _mm256_add_pd(_mm256_cvtps_pd(lo), _mm256_cvtps_pd(hi));
+	__m128d acc = _mm_add_pd(_mm256_castpd256_pd128(wide), _mm256_extractf128_pd(wide, 1));
+	return _mm_cvtsd_f64(_mm_add_sd(acc, _mm_unpackhi_pd(acc, acc)));
+}
+
+__attribute__((target("avx2,fma")))
+static void cgemm_avx2(const float *a_re, const float *a_im, int rows,
+		const float *b_re, const float *b_im, int cols, int stride, gr_complex *out){
+	//2x2 register block: every loaded mixing row is reused for two columns and vice versa
+	int cc = 0;
+	for(; cc + 2 <= cols; cc += 2){
+		const float *xr0 = b_re + (long)cc*stride, *xi0 = b_im + (long)cc*stride;
+		const float *xr1 = xr0 + stride, *xi1 = xi0 + stride;
+		int hh = 0;
+		for(; hh + 2 <= rows; hh += 2){
+			const float *mr0 = a_re + (long)hh*stride, *mi0 = a_im + (long)hh*stride;
+			const float *mr1 = mr0 + stride, *mi1 = mi0 + stride;
+			double tot[8] = {0};
+			for(int kb=0; kb < stride; kb += HARMONIC_ENGINE_BLOCK){
+				__m256 re00 = _mm256_setzero_ps(), im00 = _mm256_setzero_ps();
+				__m256 re01 = _mm256_setzero_ps(), im01 = _mm256_setzero_ps();
+				__m256 re10 = _mm256_setzero_ps(), im10 = _mm256_setzero_ps();
+				__m256 re11 = _mm256_setzero_ps(), im11 = _mm256_setzero_ps();
+				int kend = std::min(stride, kb + HARMONIC_ENGINE_BLOCK);
+				for(int kk=kb; kk < kend; kk += 8){
+					__m256 br0 = _mm256_load_ps(xr0 + kk), bi0 = _mm256_load_ps(xi0 + kk);
+					__m256 br1 = _mm256_load_ps(xr1 + kk), bi1 = _mm256_load_ps(xi1 + kk);
+					__m256 ar = _mm256_load_ps(mr0 + kk), ai = _mm256_load_ps(mi0 + kk);
+					re00 = _mm256_fnmadd_ps(ai, bi0, _mm256_fmadd_ps(ar, br0, re00));
+					im00 = _mm256_fmadd_ps(ai, br0, _mm256_fmadd_ps(ar, bi0, im00));
+					re01 = _mm256_fnmadd_ps(ai, bi1, _mm256_fmadd_ps(ar, br1, re01));
+					im01 = _mm256_fmadd_ps(ai, br1, _mm256_fmadd_ps(ar, bi1, im01));
+					ar = _mm256_load_ps(mr1 + kk); ai = _mm256_load_ps(mi1 + kk);
+					re10 = _mm256_fnmadd_ps(ai, bi0, _mm256_fmadd_ps(ar, br0, re10));
+					im10 = _mm256_fmadd_ps(ai, br0, _mm256_fmadd_ps(ar, bi0, im10));
+					re11 = _mm256_fnmadd_ps(ai, bi1, _mm256_fmadd_ps(ar, br1, re11));
+					im11 = _mm256_fmadd_ps(ai, br1, _mm256_fmadd_ps(ar, bi1, im11));
+				}
+				tot[0] += hsum_avx2(re00); tot[1] += hsum_avx2(im00);
+				tot[2] += hsum_avx2(re01); tot[3] += hsum_avx2(im01);
+				tot[4] += hsum_avx2(re10); tot[5] += hsum_avx2(im10);
+				tot[6] += hsum_avx2(re11); tot[7] += hsum_avx2(im11);
+			}
+			out[(long)cc*rows + hh] = gr_complex(tot[0], tot[1]);
+			out[(long)(cc+1)*rows + hh] = gr_complex(tot[2], tot[3]);
+			out[(long)cc*rows + hh+1] = gr_complex(tot[4], tot[5]);
+			out[(long)(cc+1)*rows + hh+1] = gr_complex(tot[6], tot[7]);
+		}
+		if(hh < rows){
+			//Odd harmonic count: finish the last row for both columns
+			gr_complex tail[2];
+			cgemm_generic(a_re + (long)hh*stride, a_im + (long)hh*stride, 1, xr0, xi0, 2, stride, tail);
+			out[(long)cc*rows + hh] = tail[0];
+			out[(long)(cc+1)*rows + hh] = tail[1];
+		}
+	}
+	if(cc < cols)
+		cgemm_generic(a_re, a_im, rows, b_re + (long)cc*stride, b_im + (long)cc*stride, cols - cc, stride, out + (long)cc*rows);
+}
+#endif
+
+static cgemm_fn pickCgemm(){
+#ifdef HARMONIC_ENGINE_X86
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return cgemm_avx2;
+#endif
+	return cgemm_generic;
+}
+
+mixing_tables::mixing_tables(int num_harmonics, int num_steps, int row_stride)
+	: stride(row_stride)
+{
+	size_t row_bytes = sizeof(float)*stride;
+	mix_re = (float *)volk_malloc(row_bytes*num_harmonics, 64);
+	mix_im = (float *)volk_malloc(row_bytes*num_harmonics, 64);
+	offs_re = (float *)volk_malloc(row_bytes*num_steps, 64);
+	offs_im = (float *)volk_malloc(row_bytes*num_steps, 64);
+
+	//Padding stays zero so it drops out of every product
+	memset(mix_re, 0, row_bytes*num_harmonics);
+	memset(mix_im, 0, row_bytes*num_harmonics);
+	memset(offs_re, 0, row_bytes*num_steps);
+	memset(offs_im, 0, row_bytes*num_steps);
+}
+
+mixing_tables::~mixing_tables(){
+	volk_free(mix_re);
+	volk_free(mix_im);
+	volk_free(offs_re);
+	volk_free(offs_im);
+}
+
+size_t mixing_tables::footprint(int num_harmonics, int num_steps, int stride){
+	return 2*sizeof(float)*stride*(num_harmonics + num_steps);
+}
+
+harmonic_engine::harmonic_engine(int num_harmonics, int length, int num_steps, int max_anchors)
+	: d_num_harmonics(num_harmonics), d_length(length), d_num_steps(num_steps)
+{
+	if(num_harmonics <= 0 || length <= 0 || num_steps <= 0 || max_anchors <= 0)
+		throw std::out_of_range("harmonic_engine: invalid geometry");
+
+	d_stride = (length + 15) & ~15;
+	d_max_columns = max_anchors*num_steps;
+	size_t row_bytes = sizeof(float)*d_stride;
+	d_cols_re = (float *)volk_malloc(row_bytes*d_max_columns, 64);
+	d_cols_im = (float *)volk_malloc(row_bytes*d_max_columns, 64);
+
+	//Padding stays zero so it drops out of every product
+	memset(d_cols_re, 0, row_bytes*d_max_columns);
+	memset(d_cols_im, 0, row_bytes*d_max_columns);
+}
+
+harmonic_engine::~harmonic_engine(){
+	volk_free(d_cols_re);
+	volk_free(d_cols_im);
+}
+
+mixing_tables *harmonic_engine::make_tables() const{
+	return new mixing_tables(d_num_harmonics, d_num_steps, d_stride);
+}
+
+static void fillTone(double freq, int length, float *re, float *im){
+	//Rotate in double, re-anchoring the phase every 64 samples so rounding cannot build up
+	gr_complex_d step = std::polar(1.0, freq), cur;
+	for(int kk=0; kk < length; kk++){
+		if((kk & 63) == 0)
+			cur = std::polar(1.0, freq*kk);
+		re[kk] = cur.real();
+		im[kk] = cur.imag();
+		cur *= step;
+	}
+}
+
+void harmonic_engine::build_tables(mixing_tables *tables, const std::vector<double> &harmonic_freqs, const std::vector<double> &step_offsets) const{
+	if(harmonic_freqs.size() != d_num_harmonics || step_offsets.size() != d_num_steps)
+		throw std::invalid_argument("harmonic_engine: frequency count does not match the geometry");
+
+	for(int hh=0; hh < d_num_harmonics; hh++)
+		fillTone(harmonic_freqs[hh], d_length, tables->mix_re + hh*d_stride, tables->mix_im + hh*d_stride);
+	for(int ss=0; ss < d_num_steps; ss++)
+		fillTone(step_offsets[ss], d_length, tables->offs_re + ss*d_stride, tables->offs_im + ss*d_stride);
+}
+
+void harmonic_engine::packColumn(const mixing_tables *tables, const gr_complex *x, int step, int col){
+	//De-interleave into split rows while applying the step's frequency offset
+	const float *orr = tables->offs_re + step*d_stride, *oi = tables->offs_im + step*d_stride;
+	float *cr = d_cols_re + (long)col*d_stride, *ci = d_cols_im + (long)col*d_stride;
+	for(int kk=0; kk < d_length; kk++){
+		float xr = x[kk].real(), xi = x[kk].imag();
+		cr[kk] = xr*orr[kk] - xi*oi[kk];
+		ci[kk] = xr*oi[kk] + xi*orr[kk];
+	}
+}
+
+void harmonic_engine::extract(const mixing_tables *tables, const gr_complex *const *data, int num_anchors, gr_complex *out){
+	static const cgemm_fn cgemm = pickCgemm();
+
+	int cols = num_anchors*d_num_steps;
+	if(cols > d_max_columns)
+		throw std::out_of_range("harmonic_engine: more anchors than the engine was built for");
+
+	for(int aa=0; aa < num_anchors; aa++)
+		for(int ss=0; ss < d_num_steps; ss++)
+			packColumn(tables, data[aa] + ss*d_length, ss, aa*d_num_steps + ss);
+
+	cgemm(tables->mix_re, tables->mix_im, d_num_harmonics, d_cols_re, d_cols_im, cols, d_stride, out);
+}
+
+} /* namespace fast_square */
+} /* namespace gr */
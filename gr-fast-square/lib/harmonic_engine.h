@@ -0,0 +1,89 @@
+#ifndef INCLUDED_FAST_SQUARE_HARMONIC_ENGINE_H
+#define INCLUDED_FAST_SQUARE_HARMONIC_ENGINE_H
+
+#include <gnuradio/gr_complex.h>
+#include <vector>
+
+namespace gr {
+namespace fast_square {
+
+#define HARMONIC_ENGINE_BLOCK 128 //Samples summed in float before folding into the double totals
+
+/*!
+ * Mixing matrix and per-step offset rows for one PRF, as split
+ * real/imaginary rows padded to stride floats.  Built by
+ * harmonic_engine::build_tables() and read by harmonic_engine::extract(),
+ * so callers can keep several around and switch between them for free.
+ */
+class mixing_tables
+{
+public:
+	int stride;
+	float *mix_re;  //num_harmonics rows
+	float *mix_im;
+	float *offs_re; //num_steps rows
+	float *offs_im;
+
+	mixing_tables(int num_harmonics, int num_steps, int stride);
+	~mixing_tables();
+
+	//Bytes held by one set of tables
+	static size_t footprint(int num_harmonics, int num_steps, int stride);
+
+private:
+	mixing_tables(const mixing_tables &);
+	mixing_tables &operator=(const mixing_tables &);
+};
+
+/*!
+ * Computes every harmonic phasor of a snapshot as one complex matrix
+ * product.  Harmonic h of step s is
+ *
+ *   sum_k x_s[k]*exp(j*(w_h + o_s)*k),  k = 0..length-1
+ *
+ * The (num_harmonics x length) mixing matrix exp(j*w_h*k) is built once
+ * per build_tables() call.  The per-step offsets exp(j*o_s*k) are folded into
+ * the right-hand operand while the steps of every anchor are packed into
+ * its (length x num_anchors*num_steps) columns, so extract() is a single
+ * GEMM.  Both operands are stored as split real/imaginary rows padded to
+ * 16 floats; the product runs in float over blocks of
+ * HARMONIC_ENGINE_BLOCK samples and accumulates the block sums in double.
+ * Uses AVX2/FMA when the CPU has it, picked at runtime.
+ */
+class harmonic_engine
+{
+private:
+	int d_num_harmonics;
+	int d_length;
+	int d_num_steps;
+	int d_stride;       //Padded row length in floats
+	int d_max_columns;
+	float *d_cols_re;   //One row per (anchor, step) column
+	float *d_cols_im;
+
+	void packColumn(const mixing_tables *tables, const gr_complex *x, int step, int col);
+
+public:
+	harmonic_engine(int num_harmonics, int length, int num_steps, int max_anchors);
+	~harmonic_engine();
+
+	//Empty tables sized for this engine; the caller owns them
+	mixing_tables *make_tables() const;
+
+	//Angular frequencies in radians/sample: w_h for every harmonic and o_s for every step
+	void build_tables(mixing_tables *tables, const std::vector<double> &harmonic_freqs, const std::vector<double> &step_offsets) const;
+
+	/*!
+	 * data[a] holds num_steps steps of length samples for anchor a, back
+	 * to back.  Writes out[(a*num_steps + s)*num_harmonics + h].
+	 */
+	void extract(const mixing_tables *tables, const gr_complex *const *data, int num_anchors, gr_complex *out);
+
+	int num_harmonics() const { return d_num_harmonics; }
+	size_t tables_footprint() const { return mixing_tables::footprint(d_num_harmonics, d_num_steps, d_stride); }
+};
+
+} /* namespace fast_square */
+} /* namespace gr */
+
+#endif /* INCLUDED_FAST_SQUARE_HARMONIC_ENGINE_H */
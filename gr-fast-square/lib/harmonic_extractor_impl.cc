@@ -4,72 +4,118 @@
 #endif
 
 #include "harmonic_extractor_impl.h"
+#include "monotonic_clock.h"
+#include "stats_rpc.h"
 #include <gnuradio/io_signature.h>
+#include <gnuradio/block_detail.h>
+#include <gnuradio/buffer.h>
 #include <volk/volk.h>
+#include <boost/bind.hpp>
 #include <cstdio>
+#include <cmath>
+#include <algorithm>
 #include <string>
 #include <fstream>
 
 namespace gr {
 namespace fast_square {
 
-harmonic_extractor::sptr harmonic_extractor::make(int fft_size, int nthreads, const std::string &prf_tag_name, const std::string &phasor_tag_name, const std::string &hfreq_tag_name){
+harmonic_extractor::sptr harmonic_extractor::make(int fft_size, int nthreads, const std::string &prf_tag_name, const std::string &phasor_tag_name, const std::string &hfreq_tag_name,
+		int harmonic_start, int num_harmonics, int table_cache_size, double prf_quantum, int batch_size){
 	return gnuradio::get_initial_sptr
-		(new harmonic_extractor_impl(fft_size, nthreads, prf_tag_name, phasor_tag_name, hfreq_tag_name));
+		(new harmonic_extractor_impl(fft_size, nthreads, prf_tag_name, phasor_tag_name, hfreq_tag_name, harmonic_start, num_harmonics, table_cache_size, prf_quantum, batch_size));
 }
 
-harmonic_extractor_impl::harmonic_extractor_impl(int fft_size, int nthreads, const std::string &prf_tag_name, const std::string &phasor_tag_name, const std::string &hfreq_tag_name)
+harmonic_extractor_impl::harmonic_extractor_impl(int fft_size, int nthreads, const std::string &prf_tag_name, const std::string &phasor_tag_name, const std::string &hfreq_tag_name,
+		int harmonic_start, int num_harmonics, int table_cache_size, double prf_quantum, int batch_size)
 	: sync_block("harmonic_extractor",
-			io_signature::make(4, 4, POW2_CEIL(NUM_STEPS*FFT_SIZE)*sizeof(gr_complex)),
-			io_signature::make(4, 4, POW2_CEIL(NUM_STEPS*FFT_SIZE)*sizeof(gr_complex))),
-	d_fft_size(fft_size), d_abs_count(0)
+			io_signature::make(1, MAX_ANCHORS, SNAPSHOT_FRAME_SIZE),
+			io_signature::make(1, MAX_ANCHORS, SNAPSHOT_FRAME_SIZE)),
+	d_fft_size(fft_size), d_abs_count(0), d_harmonic_start(harmonic_start),
+	d_warned_tags(false), d_prf_start_ns(0), d_prf_done_ns(0), d_table_cache_size(table_cache_size), d_prf_quantum(prf_quantum), d_table_hits(0), d_table_misses(0), d_cur_tables(NULL)
 {
+	if(harmonic_start < 0 || num_harmonics <= 0 || harmonic_start + num_harmonics > NUM_HARMONICS_PER_STEP)
+		throw std::out_of_range("harmonic_extractor: harmonic subset must lie within 0..NUM_HARMONICS_PER_STEP-1");
+	if(table_cache_size < 1 || prf_quantum <= 0.0)
+		throw std::out_of_range("harmonic_extractor: table cache needs at least one entry and a positive PRF quantum");
+	if(batch_size < 1)
+		throw std::out_of_range("harmonic_extractor: batch_size must be positive");
+
 	d_prf_key = pmt::string_to_symbol(prf_tag_name);
+	d_tags_key = pmt::string_to_symbol(prf_tag_name + "_tags");
+	d_prfs_key = pmt::string_to_symbol(prf_tag_name + "_prfs");
 	d_phasor_key = pmt::string_to_symbol(phasor_tag_name);
 	d_hfreq_key = pmt::string_to_symbol(hfreq_tag_name);
+	d_offset_key = pmt::mp("offset");
+	d_start_key = pmt::mp("prf_start_ns");
+	d_done_key = pmt::mp("prf_done_ns");
+
+	message_port_register_in(pmt::mp("prf_in"));
+	set_msg_handler(pmt::mp("prf_in"), boost::bind(&harmonic_extractor_impl::prfMsg, this, _1));
 
 	std::stringstream id;
 	id << name() << unique_id();
 	d_me = pmt::string_to_symbol(id.str());
 
-	d_fft = new fft::fft_complex(d_fft_size, true, nthreads);
+	//nthreads workers extract the snapshots (and anchors) of each call to work in parallel
+	d_pool = new worker_pool(std::max(1, nthreads));
 	
 	const int alignment_multiple =
 		volk_get_alignment() / sizeof(gr_complex);
 	set_alignment(std::max(1, alignment_multiple));
-	harmonicExtraction_bjt_init();
+	harmonicExtraction_bjt_init(num_harmonics, batch_size);
 }
 
 harmonic_extractor_impl::~harmonic_extractor_impl(){
+	for(std::map<int64_t, table_entry>::iterator it = d_table_cache.begin(); it != d_table_cache.end(); it++)
+		delete it->second.tables;
+	for(int ii=0; ii < d_engines.size(); ii++)
+		delete d_engines[ii];
+	delete d_pool;
 }
 
-void harmonic_extractor_impl::harmonicExtraction_bjt_init(){
-	//Initialize temporary d_harmonic_nums vector
+void harmonic_extractor_impl::harmonicExtraction_bjt_init(int num_harmonics, int batch_size){
+	//Initialize temporary d_harmonic_nums vector with the requested subset of each step's harmonics
 	d_harmonic_nums.clear();
-	for(float cur_harmonic_num = -1.0*NUM_HARMONICS_PER_STEP/2+.5; cur_harmonic_num <= 1.0*NUM_HARMONICS_PER_STEP/2-.5; cur_harmonic_num++)
-		d_harmonic_nums.push_back(cur_harmonic_num);
-
-	//d_sp_idx indexes the harmonics from the FFT once it's corrected for any frequency offsets
-	d_sp_idxs.clear();
-	for(int ii=0; ii < d_harmonic_nums.size(); ii++){
-		int cur_sp_idx = (int)(round(1.0*d_fft_size*d_harmonic_nums[ii]*PRF/(SAMPLE_RATE/DECIM_FACTOR))) % d_fft_size;
-		if(cur_sp_idx < 0)
-			cur_sp_idx += d_fft_size;
-		d_sp_idxs.push_back(cur_sp_idx);
-	}
+	for(int ii=d_harmonic_start; ii < d_harmonic_start + num_harmonics; ii++)
+		d_harmonic_nums.push_back(-1.0*NUM_HARMONICS_PER_STEP/2+.5 + ii);
+
+	//All harmonics of all steps of an anchor come out of one matrix product
+	for(int ii=0; ii < d_pool->size(); ii++)
+		d_engines.push_back(new harmonic_engine(d_harmonic_nums.size(), FFT_SIZE, NUM_STEPS, 1));
+
+	d_batch.resize(batch_size);
+	d_batch_keys.reserve(std::min(batch_size, d_table_cache_size));
+	d_pending_keys.reserve(MAX_TAGS);
+	d_tag_ids.reserve(MAX_TAGS);
+	d_tag_prfs.reserve(MAX_TAGS);
+}
+
+void harmonic_extractor_impl::setup_rpc(){
+#ifdef GR_CTRLPORT
+	add_rpc_variable(statsRpcVariable(this, "stat_counters", &harmonic_extractor_impl::stat_counters,
+			"Hot-path counters, indexed by stat_counter"));
+	add_rpc_variable(statsRpcVariable(this, "latency_extract", &harmonic_extractor_impl::stageHistogram<STAGE_EXTRACT>,
+			"Harmonic extraction of one batch of snapshots, log2 ns buckets"));
+#endif
+}
 
-	//Initialize space to contain NCO data
-	nco_array = new gr_complex[d_fft_size];
+bool harmonic_extractor_impl::check_topology(int ninputs, int noutputs){
+	//Output ii carries the snapshots of anchor ii
+	if(noutputs != ninputs)
+		return false;
 
-	//Set anything past FFT_SIZE to zero
-	memset(d_fft->get_inbuf()+FFT_SIZE, 0, d_fft_size-FFT_SIZE);
+	//Enough frames for a full batch plus the snapshots queued towards the localizer
+	phasor_frame_pool::instance().reserve(PHASOR_FRAME_POOL + d_batch.size(), ninputs*NUM_STEPS*d_harmonic_nums.size());
+	return true;
+}
 
-	//recreate harmonic mixing arrays depending on prf estimate
-	d_harm_mix.clear();
-	for(int ii=0; ii < d_harmonic_nums.size(); ii++){
-		gr_complex *new_harm_mix = new gr_complex[FFT_SIZE];
-		d_harm_mix.push_back(new_harm_mix);
-	}
+bool harmonic_extractor_impl::start(){
+	//Each frame on output 0 is released by the one block reading it, so a second reader would release it
+	//again.  check_topology() only sees port counts; by start() the buffers know their readers.
+	if(detail()->output(0)->nreaders() > 1)
+		throw std::runtime_error("harmonic_extractor: output 0 carries phasor frames and must feed exactly one block");
+	return block::start();
 }
 
 float harmonic_extractor_impl::calculateCenterFreqHarmonicNum(int step_num){
@@ -81,42 +127,66 @@ float harmonic_extractor_impl::calculateCenterFreqHarmonicNum(int step_num){
 	return ret;
 }
 
-void harmonic_extractor_impl::harmonicExtraction_bjt_reset(){
+void harmonic_extractor_impl::buildTables(table_entry &entry, double prf){
 	//Initialize frequency offset array
-	d_freq_offs.clear();
+	std::vector<double> freq_offs;
 	for(int ii=0; ii < NUM_STEPS; ii++)
-		d_freq_offs.push_back(-2.0l*M_PI*((d_prf_est-PRF)*((START_LO_FREQ-IF_FREQ+STEP_FREQ*ii)/PRF)-TUNE_OFFSET)/(SAMPLE_RATE/DECIM_FACTOR));
-
-	d_harmonic_phasors.clear();
-	d_harmonic_freqs.clear();
-
-	//recreate harmonic mixing arrays depending on prf estimate
-	for(int ii=0; ii < d_harmonic_nums.size(); ii++){
-		d_nco.set_freq(-2.0l*M_PI*d_harmonic_nums[ii]*d_prf_est/(SAMPLE_RATE/DECIM_FACTOR));
-		d_nco.set_phase(0.0);
-		d_nco.sincos(d_harm_mix[ii], FFT_SIZE, 1.0);
-		//gr_complex_d d_i(0.0, 1.0);
-		//double freq = -2.0l*M_PI*d_harmonic_nums[ii]*d_prf_est/(SAMPLE_RATE/DECIM_FACTOR);
-		//for(int jj=0; jj < FFT_SIZE; jj++){
-		//	d_harm_mix[ii][jj] = std::exp(d_i*gr_complex_d(freq*jj, 0.0));
-		//}
-	}
+		freq_offs.push_back(-2.0l*M_PI*((prf-PRF)*((START_LO_FREQ-IF_FREQ+STEP_FREQ*ii)/PRF)-TUNE_OFFSET)/(SAMPLE_RATE/DECIM_FACTOR));
+
+	//recreate harmonic mixing matrix depending on prf estimate
+	std::vector<double> mix_freqs;
+	for(int ii=0; ii < d_harmonic_nums.size(); ii++)
+		mix_freqs.push_back(-2.0l*M_PI*d_harmonic_nums[ii]*prf/(SAMPLE_RATE/DECIM_FACTOR));
+	d_engines[0]->build_tables(entry.tables, mix_freqs, freq_offs);
 
 	//Prepare the harmonic frequency array from the received PRF estimate
+	entry.harmonic_freqs.clear();
 	for(int ii=0; ii < NUM_STEPS; ii++){
 		float center_freq_harmonic_num = calculateCenterFreqHarmonicNum(ii);
 		for(int jj=0; jj < d_harmonic_nums.size(); jj++){
 			//d_harmonic_freqs_abs.push_back(d_prf_est*d_harmonic_nums_abs[ii][jj]);
-			double harmonic_freq = ((double)d_prf_est*d_harmonic_nums[jj] + 
-					(d_prf_est-PRF)*center_freq_harmonic_num - 
+			double harmonic_freq = ((double)prf*d_harmonic_nums[jj] + 
+					(prf-PRF)*center_freq_harmonic_num - 
 					TUNE_OFFSET);
-			d_harmonic_freqs.push_back(harmonic_freq);//(d_harmonic_nums_abs[ii][jj]-center_freq_harmonic_num)*d_prf_est);
+			entry.harmonic_freqs.push_back(harmonic_freq);//(d_harmonic_nums_abs[ii][jj]-center_freq_harmonic_num)*d_prf_est);
 		}
 	}
+}
+
+void harmonic_extractor_impl::harmonicExtraction_bjt_reset(double prf){
+	//Tables only depend on the PRF estimate, so reuse them while it stays put
+	int64_t key = tableKey(prf);
+	std::map<int64_t, table_entry>::iterator it = d_table_cache.find(key);
+	if(it != d_table_cache.end()){
+		d_table_hits++;
+		d_table_lru.splice(d_table_lru.begin(), d_table_lru, it->second.lru_pos);
+		d_cur_tables = &it->second;
+		return;
+	}
+
+	//Miss: recycle the least recently used tables once the cache is full
+	d_table_misses++;
+	mixing_tables *tables;
+	if(d_table_cache.size() >= d_table_cache_size){
+		std::map<int64_t, table_entry>::iterator victim = d_table_cache.find(d_table_lru.back());
+		tables = victim->second.tables;
+		d_table_cache.erase(victim);
+		d_table_lru.pop_back();
+	} else {
+		tables = d_engines[0]->make_tables();
+		d_stats.increment(COUNTER_ALLOCATIONS);
+	}
 
+	d_table_lru.push_front(key);
+	table_entry &entry = d_table_cache[key];
+	entry.tables = tables;
+	entry.lru_pos = d_table_lru.begin();
+	entry.prf = PRF*(1.0 + key*d_prf_quantum);
+	buildTables(entry, entry.prf);
+	d_cur_tables = &entry;
 }
 
-void harmonic_extractor_impl::harmonicExtraction_bjt_fast(const gr_complex *data){
+void harmonic_extractor_impl::harmonicExtraction_bjt_fast(int item, int anchor, int worker){
 	//%Subtract any frequency offset including tune offset and prf-induced offset at each snapshot
 	//if(use_image)
 	//	freq_offs = 2*pi*((prf_est-prf)*((start_lo_freq-if_freq+step_freq*(0:num_steps-1))/prf)-tune_offset)/(sample_rate/decim_factor);
@@ -130,35 +200,81 @@ void harmonic_extractor_impl::harmonicExtraction_bjt_fast(const gr_complex *data
 	//
 	//harmonic_freqs = harmonic_nums_abs.*prf_est;
 
-	gr_complex data_step_pre[FFT_SIZE];
-	gr_complex data_step_post[FFT_SIZE];
-	for(int ii=0; ii < NUM_STEPS; ii++){
-		float center_freq_harmonic_num = calculateCenterFreqHarmonicNum(ii);
+	//Brute-force DFT at the exact harmonic frequencies since FFT bins aren't close enough to where they should be,
+	//done for every step of the anchor at once; phasors are laid out anchor-major, then step, then harmonic
+	snapshot_job &job = d_batch[item];
+	int num_phasors = NUM_STEPS*d_harmonic_nums.size();
+	d_engines[worker]->extract(job.tables->tables, &job.data[anchor], 1, &job.frame->phasors[anchor*num_phasors]);
+}
 
-		//Apply frequency offset to all the raw data
-		d_nco.set_freq(d_freq_offs[ii]);
-		d_nco.set_phase(0.0);
-		d_nco.sincos(nco_array, FFT_SIZE, 1.0);
-		volk_32fc_x2_multiply_32fc(data_step_pre, nco_array, data+ii*FFT_SIZE, FFT_SIZE);
+void harmonic_extractor_impl::prfMsg(pmt::pmt_t msg){
+	//Handled on the block's own thread between calls to work, so no locking is needed
+	d_prf_queue.push(msg);
+}
 
-		//Calculate phasors through brute-force approach since FFT bins aren't close enough to where they should be
-		for(int jj=0; jj < d_harmonic_nums.size(); jj++){
-			volk_32fc_x2_multiply_32fc(data_step_post, d_harm_mix[jj], data_step_pre, FFT_SIZE);
+int harmonic_extractor_impl::pendingTags(uint64_t offset){
+	//Drop estimates for snapshots that have already gone by
+	while(!d_prf_queue.empty() && pmt::to_uint64(pmt::dict_ref(d_prf_queue.front(), d_offset_key, pmt::PMT_NIL)) < offset)
+		d_prf_queue.pop();
+	if(d_prf_queue.empty() || pmt::to_uint64(pmt::dict_ref(d_prf_queue.front(), d_offset_key, pmt::PMT_NIL)) != offset)
+		return -1;
+
+	//Estimators that do not list tags report exactly one
+	d_pending_keys.clear();
+	pmt::pmt_t prfs = pmt::dict_ref(d_prf_queue.front(), d_prfs_key, pmt::PMT_NIL);
+	if(pmt::is_f64vector(prfs)){
+		size_t num_tags;
+		const double *tag_prfs = pmt::f64vector_elements(prfs, num_tags);
+		for(size_t ii=0; ii < num_tags; ii++)
+			d_pending_keys.push_back(tableKey(tag_prfs[ii]));
+	} else {
+		d_pending_keys.push_back(tableKey(pmt::to_double(pmt::dict_ref(d_prf_queue.front(), d_prf_key, pmt::from_double(PRF)))));
+	}
+	return d_pending_keys.size();
+}
 
-			//Sum everything up to get resulting phasor
-			gr_complex_d cur_phasor(0.0, 0.0);
-			for(int kk=0; kk < FFT_SIZE; kk++){
-				cur_phasor += data_step_post[kk];
-			}
-			d_harmonic_phasors.push_back(gr_complex(cur_phasor));
+void harmonic_extractor_impl::applyPrfEstimate(uint64_t out_offset){
+	//Re-attach everything prf_estimator reported as tags so the localizer sees them as before
+	pmt::pmt_t tag_ids = pmt::PMT_NIL, tag_prfs = pmt::PMT_NIL;
+	d_prf_start_ns = d_prf_done_ns = 0;
+	pmt::pmt_t items = pmt::dict_items(d_prf_queue.front());
+	for(; pmt::is_pair(items); items = pmt::cdr(items)){
+		pmt::pmt_t key = pmt::car(pmt::car(items));
+		pmt::pmt_t value = pmt::cdr(pmt::car(items));
+		if(pmt::eqv(key, d_offset_key))
+			continue;
+		//Stage times go into the snapshot header rather than the tags
+		if(pmt::eqv(key, d_start_key)){
+			d_prf_start_ns = pmt::to_uint64(value);
+			continue;
 		}
-		
-		////Take FFT and extract corresponding harmonics
-		//d_fft->execute();
-
-		////Extract harmonics based on indices computed previously
-		//for(int jj=0; jj < d_sp_idxs.size(); jj++)
-		//	d_harmonic_phasors.push_back(d_fft->get_outbuf()[d_sp_idxs[jj]]);
+		if(pmt::eqv(key, d_done_key)){
+			d_prf_done_ns = pmt::to_uint64(value);
+			continue;
+		}
+		if(pmt::eqv(key, d_prf_key))
+			d_prf_est = pmt::to_double(value);
+		else if(pmt::eqv(key, d_tags_key))
+			tag_ids = value;
+		else if(pmt::eqv(key, d_prfs_key))
+			tag_prfs = value;
+		add_item_tag(0, out_offset, key, value, d_me);
+	}
+	d_prf_queue.pop();
+
+	d_tag_ids.clear();
+	d_tag_prfs.clear();
+	if(pmt::is_f64vector(tag_prfs)){
+		size_t num_tags, num_ids = 0;
+		const double *prfs = pmt::f64vector_elements(tag_prfs, num_tags);
+		const int32_t *ids = pmt::is_s32vector(tag_ids) ? pmt::s32vector_elements(tag_ids, num_ids) : NULL;
+		for(size_t ii=0; ii < num_tags; ii++){
+			d_tag_ids.push_back((ii < num_ids) ? ids[ii] : ii);
+			d_tag_prfs.push_back(prfs[ii]);
+		}
+	} else {
+		d_tag_ids.push_back(0);
+		d_tag_prfs.push_back(d_prf_est);
 	}
 }
 
@@ -167,60 +283,114 @@ int harmonic_extractor_impl::work(int noutput_items,
 		gr_vector_void_star &output_items){
 
 
-	signed int input_data_size_padded = input_signature()->sizeof_stream_item(0)/sizeof(gr_complex);
-	std::vector<tag_t> tags;
-	const gr_complex *in = (const gr_complex *) input_items[0];
-	gr_complex *out = (gr_complex *) output_items[0];
 	int count=0;
-	int out_count = 0;
 
 	const uint64_t nread = nitems_read(0);
 	uint64_t abs_out_sample_cnt = nitems_written(0);
 
+	//Frames the pool has to create count as allocations of this block
+	size_t pool_frames = phasor_frame_pool::instance().allocated();
+
+	//Gather every snapshot whose PRF estimate is in, up to batch_size tags; the batch never holds more
+	//distinct PRFs than the cache, so the tables it uses are its most recent entries and none is recycled
+	d_tasks.clear();
+	d_batch_keys.clear();
+	int max_tags = std::min((int)d_batch.size(), d_table_cache_size);
+	int num_jobs = 0;
 	while(count < noutput_items){
-		//Extract PRF estimate from tag
-		get_tags_in_range(tags, 0, nread+count, nread+count+1);
-		for(unsigned ii=0; ii < tags.size(); ii++){
-			if(tags[ii].key == d_prf_key)
-				d_prf_est = pmt::to_double(tags[ii].value);
+		//Wait for prf_estimator to report on this snapshot
+		int num_tags = pendingTags(nread+count);
+		if(num_tags < 0)
+			break;
+		if(num_tags > max_tags){
+			if(!d_warned_tags)
+				GR_LOG_WARN(d_logger, num_tags << " tags exceed the batch or table cache, extracting the first " << max_tags);
+			d_warned_tags = true;
+			num_tags = max_tags;
 		}
-
-		//Run harmonic extraction logic
-		harmonicExtraction_bjt_reset();
-		for(int ii=0; ii < input_items.size(); ii++)
-			harmonicExtraction_bjt_fast(((const gr_complex *) input_items[ii]) + count*input_data_size_padded);
-		if(d_abs_count == 9){
-		//std::cout << "start" << std::endl;
-		//gr_complex *data = ((gr_complex *)input_items[0]);
-		//for(int jj=0; jj < NUM_STEPS*FFT_SIZE; jj++)
-		//	std::cout << data[jj].real() << " " << data[jj].imag() << std::endl;
-		//printf("%0.15f\n", d_prf_est);
-		//std::cout << "start len = " << d_harmonic_freqs.size() << std::endl;
-		//for(int jj=0; jj < d_harmonic_phasors.size(); jj++){
-		//	std::cout << d_harmonic_phasors[jj].real() << " " << d_harmonic_phasors[jj].imag() << std::endl;//printf("%0.15f", d_harmonic_freqs[jj]);
-		//}
+		size_t old_keys = d_batch_keys.size();
+		for(int tt=0; tt < num_tags; tt++)
+			if(std::find(d_batch_keys.begin(), d_batch_keys.end(), d_pending_keys[tt]) == d_batch_keys.end())
+				d_batch_keys.push_back(d_pending_keys[tt]);
+		if(num_jobs > 0 && (num_jobs + num_tags > d_batch.size() || d_batch_keys.size() > d_table_cache_size)){
+			d_batch_keys.resize(old_keys);
+			break;
 		}
+		applyPrfEstimate(abs_out_sample_cnt+count);
+
+		//Every tag is extracted from the same raw samples, into its own frame
+		const snapshot_header *in_hdr = snapshotHeader(snapshotFrame(input_items[0], count));
+		phasor_frame *first = NULL, *last = NULL;
+		for(int tt=0; tt < num_tags; tt++){
+			//With every frame still in flight downstream, the tag is dropped rather than the pool grown
+			phasor_frame *frame = phasor_frame_pool::instance().acquire();
+			if(frame == NULL){
+				d_stats.increment(COUNTER_FRAMES_DROPPED);
+				continue;
+			}
 
+			harmonicExtraction_bjt_reset(d_tag_prfs[tt]);
+			snapshot_job &job = d_batch[num_jobs];
+			job.tables = d_cur_tables;
+			for(int ii=0; ii < input_items.size(); ii++){
+				job.data[ii] = snapshotData(snapshotFrame(input_items[ii], count));
+				d_tasks.push_back(boost::bind(&harmonic_extractor_impl::harmonicExtraction_bjt_fast, this, num_jobs, ii, _1));
+			}
 
-		//Add new phasors and computed frequencies as tags to data stream
-		add_item_tag(0,
-			abs_out_sample_cnt + count,
-			d_phasor_key,
-			pmt::init_c32vector(d_harmonic_phasors.size(), &d_harmonic_phasors[0]),
-			d_me
-		);
-		add_item_tag(0,
-			abs_out_sample_cnt + count,
-			d_hfreq_key,
-			pmt::init_f64vector(d_harmonic_freqs.size(), &d_harmonic_freqs[0]),
-			d_me
-		);
-
-		d_abs_count++;
+			//The frame is filled in place by the workers; its vectors already have the capacity
+			job.frame = frame;
+			job.frame->sequence_num = in_hdr->sequence_num;
+			job.frame->tag_id = d_tag_ids[tt];
+			job.frame->prf_est = d_tag_prfs[tt];
+			job.frame->table_prf = d_cur_tables->prf;
+			job.frame->harmonic_start = d_harmonic_start;
+			job.frame->num_harmonics = d_harmonic_nums.size();
+			job.frame->phasors.resize(input_items.size()*NUM_STEPS*d_harmonic_nums.size());
+			job.frame->harmonic_freqs.assign(d_cur_tables->harmonic_freqs.begin(), d_cur_tables->harmonic_freqs.end());
+			if(last)
+				last->next = job.frame;
+			else
+				first = job.frame;
+			last = job.frame;
+			num_jobs++;
+		}
+
+		//Only the headers travel on to the localizer; the phasors ride along in the frames on output 0
+		for(int ii=0; ii < output_items.size(); ii++){
+			memcpy(snapshotFrame(output_items[ii], count), snapshotFrame(input_items[ii], count), sizeof(snapshot_header));
+			snapshot_header *hdr = snapshotHeader(snapshotFrame(output_items[ii], count));
+			hdr->prf_est = d_prf_est;
+			hdr->phasors = (ii == 0) ? first : NULL;
+			hdr->harmonic_start = d_harmonic_start;
+			hdr->num_harmonics = d_harmonic_nums.size();
+			if(d_prf_start_ns){
+				hdr->trace_ns[TRACE_PRF_START] = traceOffset(hdr, d_prf_start_ns);
+				hdr->trace_ns[TRACE_PRF_DONE] = traceOffset(hdr, d_prf_done_ns);
+			}
+		}
 		count++;
-	}   // while
+	}
+
+	//Run harmonic extraction logic for the whole batch, one task per snapshot, tag and anchor
+	uint64_t start_ns = monotonicNs();
+	d_pool->run(d_tasks);
+	uint64_t done_ns = monotonicNs();
+	d_abs_count += count;
+	if(count > 0 && block_stats::enabled())
+		d_stats.record(STAGE_EXTRACT, done_ns - start_ns);
+	d_stats.increment(COUNTER_SNAPSHOTS, count);
+	d_stats.increment(COUNTER_ALLOCATIONS, phasor_frame_pool::instance().allocated() - pool_frames);
+
+	//The whole batch is extracted together, so every snapshot in it gets the same stage times
+	for(int ss=0; ss < count; ss++){
+		for(int ii=0; ii < output_items.size(); ii++){
+			snapshot_header *hdr = snapshotHeader(snapshotFrame(output_items[ii], ss));
+			hdr->trace_ns[TRACE_EXTRACT_START] = traceOffset(hdr, start_ns);
+			hdr->trace_ns[TRACE_EXTRACT_DONE] = traceOffset(hdr, done_ns);
+		}
+	}
 
-	return noutput_items;
+	return count;
 }
 
 } /* namespace fast_square */
@@ -4,8 +4,15 @@
 
 #include <fast_square/harmonic_extractor.h>
 #include <fast_square/defines.h>
-#include <gnuradio/fft/fft.h>
-#include <gnuradio/fxpt_nco.h>
+#include <fast_square/snapshot_frame.h>
+#include <fast_square/block_stats.h>
+#include <fast_square/phasor_frame.h>
+#include "harmonic_engine.h"
+#include "worker_pool.h"
+#include <queue>
+#include <list>
+#include <map>
+#include <cmath>
 
 namespace gr {
 namespace fast_square {
@@ -13,32 +20,81 @@ namespace fast_square {
 class harmonic_extractor_impl : public harmonic_extractor
 {
 private:
-	fft::fft_complex *d_fft;
 	int d_fft_size;
 	int d_abs_count;
-	std::vector<float> d_freq_offs;
-	std::vector<int> d_sp_idxs;
-	std::vector<gr_complex> d_harmonic_phasors;
-	std::vector<double> d_harmonic_freqs;
 	std::vector<float> d_harmonic_nums;
-	std::vector<gr_complex*> d_harm_mix;
-	pmt::pmt_t d_prf_key, d_phasor_key, d_hfreq_key, d_me;
+	int d_harmonic_start;
+	pmt::pmt_t d_prf_key, d_tags_key, d_prfs_key, d_phasor_key, d_hfreq_key, d_me;
 	double d_prf_est;
+	std::vector<int> d_tag_ids;      //Tags of the current snapshot and their PRFs
+	std::vector<double> d_tag_prfs;
+	bool d_warned_tags;
 
-	gr::fxpt_nco d_nco;
-	gr_complex *nco_array;
+	//PRF estimates published by prf_estimator, oldest first
+	std::queue<pmt::pmt_t> d_prf_queue;
+	pmt::pmt_t d_offset_key, d_start_key, d_done_key;
+	uint64_t d_prf_start_ns, d_prf_done_ns; //When prf_estimator worked on the current snapshot, 0 if it did not say
+	std::vector<int64_t> d_pending_keys; //Table keys of the tags pendingTags() found
+	void prfMsg(pmt::pmt_t msg);
+	int pendingTags(uint64_t offset);
+	void applyPrfEstimate(uint64_t out_offset);
 
-	void harmonicExtraction_bjt_init();
-	void harmonicExtraction_bjt_reset();
-	void harmonicExtraction_bjt_fast(const gr_complex *data);
+	std::vector<harmonic_engine *> d_engines; //One per worker, since each packs its own operand
+	worker_pool *d_pool;
+
+	//Mixing tables and harmonic frequencies for one quantized PRF
+	struct table_entry
+	{
+		mixing_tables *tables;
+		double prf; //Quantized PRF the tables were built for
+		std::vector<double> harmonic_freqs;
+		std::list<int64_t>::iterator lru_pos;
+	};
+	std::map<int64_t, table_entry> d_table_cache;
+	std::list<int64_t> d_table_lru; //Most recently used first
+	int d_table_cache_size;
+	double d_prf_quantum;
+	uint64_t d_table_hits, d_table_misses;
+	const table_entry *d_cur_tables;
+	block_stats d_stats;
+
+	int64_t tableKey(double prf) const { return llround((prf/PRF - 1.0)/d_prf_quantum); }
+	void buildTables(table_entry &entry, double prf);
+
+	//Tags of the snapshots extracted together in one call to work; results stay in input order
+	struct snapshot_job
+	{
+		const table_entry *tables;
+		const gr_complex *data[MAX_ANCHORS];
+		phasor_frame *frame;
+	};
+	std::vector<snapshot_job> d_batch;
+	std::vector<int64_t> d_batch_keys; //Distinct table keys the batch uses
+	std::vector<worker_pool::task> d_tasks;
+
+	void harmonicExtraction_bjt_init(int num_harmonics, int batch_size);
+	void harmonicExtraction_bjt_reset(double prf);
+	void harmonicExtraction_bjt_fast(int item, int anchor, int worker);
 	float calculateCenterFreqHarmonicNum(int step_num);
 
 protected:
 
 public:
-	harmonic_extractor_impl(int fft_size, int nthreads, const std::string &prf_tag_name, const std::string &phasor_tag_name, const std::string &hfreq_tag_name);
+	harmonic_extractor_impl(int fft_size, int nthreads, const std::string &prf_tag_name, const std::string &phasor_tag_name, const std::string &hfreq_tag_name,
+			int harmonic_start, int num_harmonics, int table_cache_size, double prf_quantum, int batch_size);
 	~harmonic_extractor_impl();
 
+	bool check_topology(int ninputs, int noutputs);
+	bool start();
+
+	uint64_t table_cache_hits() const { return d_table_hits; }
+	uint64_t table_cache_misses() const { return d_table_misses; }
+
+	std::vector<int> stage_histogram(int stage) const { return d_stats.histogram(stage); }
+	std::vector<int> stat_counters() const { return d_stats.counters(); }
+	template<int STAGE> std::vector<int> stageHistogram() const { return d_stats.histogram(STAGE); }
+	void setup_rpc();
+
 	int work(int noutput_items,
 			gr_vector_const_void_star &input_items,
 			gr_vector_void_star &output_items);
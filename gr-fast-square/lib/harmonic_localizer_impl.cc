@@ -4,8 +4,11 @@
 #endif
 
 #include "harmonic_localizer_impl.h"
+#include "stage_timer.h"
+#include "stats_rpc.h"
 #include <gnuradio/io_signature.h>
 #include <volk/volk.h>
+#include <boost/bind.hpp>
 #include <cstdio>
 #include <string>
 #include <fstream>
@@ -13,36 +16,62 @@
 namespace gr {
 namespace fast_square {
 
-harmonic_localizer::sptr harmonic_localizer::make(const std::string &phasor_tag_name, const std::string &hfreq_tag_name, const std::string &prf_tag_name, const std::string &gatd_id, int nthreads){
+harmonic_localizer::sptr harmonic_localizer::make(const std::string &phasor_tag_name, const std::string &hfreq_tag_name, const std::string &prf_tag_name, const std::string &gatd_id, int nthreads,
+		const std::string &anchor_file, int max_outliers){
 	return gnuradio::get_initial_sptr
-		(new harmonic_localizer_impl(phasor_tag_name, hfreq_tag_name, prf_tag_name, gatd_id, nthreads));
+		(new harmonic_localizer_impl(phasor_tag_name, hfreq_tag_name, prf_tag_name, gatd_id, nthreads, anchor_file, max_outliers));
 }
 
-harmonic_localizer_impl::harmonic_localizer_impl(const std::string &phasor_tag_name, const std::string &hfreq_tag_name, const std::string &prf_tag_name, const std::string &gatd_id, int nthreads)
+harmonic_localizer_impl::harmonic_localizer_impl(const std::string &phasor_tag_name, const std::string &hfreq_tag_name, const std::string &prf_tag_name, const std::string &gatd_id, int nthreads,
+		const std::string &anchor_file, int max_outliers)
 	: sync_block("harmonic_localizer",
-			io_signature::make(4, 4, POW2_CEIL(NUM_STEPS*FFT_SIZE)*sizeof(gr_complex)),
+			io_signature::make(1, MAX_ANCHORS, SNAPSHOT_FRAME_SIZE),
 			io_signature::make(0, 0, 0)),
-	d_gatd_id(gatd_id), d_abs_count(0)
+	d_anchors(anchor_file), d_num_slots(0), d_harmonic_start(-1), d_harmonics_per_step(0), d_warned_harmonics(false), d_warned_anchors(false),
+	d_abs_count(0), d_gatd_id(gatd_id)
 {
+	d_num_anchors = d_anchors.num_anchors();
+	d_anchor_pos = d_anchors.positions();
+
 	d_phasor_key = pmt::string_to_symbol(phasor_tag_name);
 	d_hfreq_key = pmt::string_to_symbol(hfreq_tag_name);
 	d_prf_key = pmt::string_to_symbol(prf_tag_name);
+	d_tag_key = pmt::mp("tag");
+	d_seq_key = pmt::mp("seq");
+	d_ingest_key = pmt::mp("ingest_ns");
+	d_latency_key = pmt::mp("latency_ns");
+	d_trace_key = pmt::mp("trace_ns");
+	d_valid_key = pmt::mp("valid");
+	d_residual_key = pmt::mp("residual");
+	d_cov_key = pmt::mp("covariance");
+	d_rejected_key = pmt::mp("rejected");
 	
 	d_i = gr_complex(0, 1);
 
 	readActualFFT();
 	readToAErrors();
 
-	//Pre-calculated vector generated for compensateStepTime step
-	for(int ii=0; ii < NUM_ANCHORS * NUM_STEPS * NUM_HARMONICS_PER_STEP; ii++){
-		d_time_delay_in_samples.push_back(((ii/NUM_HARMONICS_PER_STEP) % NUM_STEPS)*SAMPLES_PER_FREQ);
-	}
-
 	//Pre-compute hamming window for later use in super-resolution generation of impulse response plots
 	genFFTWindow();
 
-	d_fft = new fft::fft_complex(FFT_SIZE_POST*INTERP, true, nthreads);
-	memset(d_fft->get_inbuf(), 0, FFT_SIZE_POST*INTERP*sizeof(gr_complex));
+	//The window and the division by the expected phasors do not depend on the PRF, so every tag shares them
+	d_cal_base.resize(d_num_anchors*FFT_SIZE_POST);
+	for(int ii=0; ii < d_num_anchors; ii++)
+		for(int jj=0; jj < FFT_SIZE_POST; jj++)
+			d_cal_base[ii*FFT_SIZE_POST + jj] = d_fft_window[jj]/d_actual_fft[ii*FFT_SIZE_POST + jj];
+
+	//Room for the most tags a snapshot can carry, so a snapshot does not allocate
+	d_hp_rearranged.reserve(MAX_TAGS*d_num_anchors*FFT_SIZE_POST);
+	d_slot_tags.resize(MAX_TAGS);
+	d_slot_prfs.resize(MAX_TAGS);
+
+	//Anchors (of every tag) are searched in parallel, each worker with its own CIR search over the CIR interpolated INTERP times
+	d_pool = new worker_pool(std::max(1, std::min(nthreads, MAX_TAGS*d_num_anchors)));
+	for(int ii=0; ii < d_pool->size(); ii++)
+		d_cirs.push_back(new cir_zoom(FFT_SIZE_POST, INTERP, 1));
+	d_toas.resize(MAX_TAGS*d_num_anchors);
+	for(int ii=0; ii < MAX_TAGS*d_num_anchors; ii++)
+		d_toa_tasks.push_back(boost::bind(&harmonic_localizer_impl::findToA, this, ii, _1));
 	
 	const int alignment_multiple =
 		volk_get_alignment() / sizeof(gr_complex);
@@ -51,48 +80,68 @@ harmonic_localizer_impl::harmonic_localizer_impl(const std::string &phasor_tag_n
 	//Message port for UDP to GATD
 	message_port_register_out(pmt::mp("frame_out"));
 
-	//Populate antenna array
-	float ax[4] = {2.405, 2.105, 4.108, 0.273};
-	float ay[4] = {3.815, 0.034, 0.347, 0.343};
-	float az[4] = {2.992, 2.494, 1.543, 1.560};
-	d_anchor_pos.clear();
-	std::vector<float> cur_anchor_pos(3);
-	for(int ii=0; ii < 4; ii++){
-		cur_anchor_pos[0] = ax[ii];
-		cur_anchor_pos[1] = ay[ii];
-		cur_anchor_pos[2] = az[ii];
-		d_anchor_pos.push_back(cur_anchor_pos);
-	}
-	float poss_steps[81] = {-0.0100, -0.0100, -0.0100, -0.0100, -0.0100, 0, -0.0100, -0.0100, 0.0100, -0.0100, 0, -0.0100, -0.0100, 0, 0, -0.0100, 0, 0.0100, -0.0100, 0.0100, -0.0100, -0.0100, 0.0100, 0, -0.0100, 0.0100, 0.0100, 0, -0.0100, -0.0100, 0, -0.0100, 0, 0, -0.0100, 0.0100, 0, 0, -0.0100, 0, 0, 0, 0, 0, 0.0100, 0, 0.0100, -0.0100, 0, 0.0100, 0, 0, 0.0100, 0.0100, 0.0100, -0.0100, -0.0100, 0.0100, -0.0100, 0, 0.0100, -0.0100, 0.0100, 0.0100, 0, -0.0100, 0.0100, 0, 0, 0.0100, 0, 0.0100, 0.0100, 0.0100, -0.0100, 0.0100, 0.0100, 0, 0.0100, 0.0100, 0.0100};
-	d_poss_steps.clear();
-	std::vector<float> cur_poss_steps(3);
-	for(int ii=0; ii < 27; ii++){
-		cur_poss_steps[0] = poss_steps[ii*3+0];
-		cur_poss_steps[1] = poss_steps[ii*3+1];
-		cur_poss_steps[2] = poss_steps[ii*3+2];
-		d_poss_steps.push_back(cur_poss_steps);
-	}
-
+	//Least-squares TDoA solver over every anchor; one CIR sample of range error is the noise floor of a single fix
+	d_tdoa = new tdoa_solver(d_anchor_pos, 3e8/(PRF*FFT_SIZE_POST*INTERP), TDOA_MAX_ITERATIONS, TDOA_STEP_TOLERANCE,
+			max_outliers, TDOA_OUTLIER_RESIDUAL);
 }
 
 harmonic_localizer_impl::~harmonic_localizer_impl(){
+	delete d_tdoa;
+	delete d_pool;
+	for(int ii=0; ii < d_cirs.size(); ii++)
+		delete d_cirs[ii];
+}
+
+void harmonic_localizer_impl::setup_rpc(){
+#ifdef GR_CTRLPORT
+	add_rpc_variable(statsRpcVariable(this, "stat_counters", &harmonic_localizer_impl::stat_counters,
+			"Hot-path counters, indexed by stat_counter"));
+	add_rpc_variable(statsRpcVariable(this, "latency_compensate", &harmonic_localizer_impl::stageHistogram<STAGE_COMPENSATE>,
+			"Rearranging and calibrating one tag's phasors, log2 ns buckets"));
+	add_rpc_variable(statsRpcVariable(this, "latency_cir_fft", &harmonic_localizer_impl::stageHistogram<STAGE_CIR_FFT>,
+			"CIR search of one anchor of one tag, log2 ns buckets"));
+	add_rpc_variable(statsRpcVariable(this, "latency_solve", &harmonic_localizer_impl::stageHistogram<STAGE_SOLVE>,
+			"Position solve of one tag, log2 ns buckets"));
+	add_rpc_variable(statsRpcVariable(this, "latency_end_to_end", &harmonic_localizer_impl::stageHistogram<STAGE_END_TO_END>,
+			"Snapshot ingest to position output, log2 ns buckets"));
+#endif
+}
+
+bool harmonic_localizer_impl::check_topology(int ninputs, int noutputs){
+	//One input per anchor of the configured geometry
+	if(ninputs != d_num_anchors){
+		std::cerr << "harmonic_localizer: " << ninputs << " inputs connected for " << d_num_anchors << " anchors" << std::endl;
+		return false;
+	}
+	return true;
 }
 
 void harmonic_localizer_impl::readActualFFT(){
 	//Open file for reading
 	FILE *source = fopen("tx_phasors.dat", "r");
+	if(source == NULL)
+		throw std::runtime_error("harmonic_localizer: cannot open tx_phasors.dat");
 		
 	//Read complex numbers in one at a time
-	for(int ii=0; ii < NUM_ANCHORS*NUM_STEPS*NUM_HARM_PER_STEP_POST; ii++){
+	for(int ii=0; ii < d_num_anchors*FFT_SIZE_POST; ii++){
 		float real, imag;
-		fread((void*)(&real), sizeof(real), 1, source);
-		fread((void*)(&imag), sizeof(imag), 1, source);
+		if(fread((void*)(&real), sizeof(real), 1, source) != 1 ||
+				fread((void*)(&imag), sizeof(imag), 1, source) != 1)
+			break;
 		gr_complex cur_phasor(real, imag);
 		d_actual_fft.push_back(cur_phasor);
 	}
 	
 	//Close file
 	fclose(source);
+
+	//The expected phasors are the transmitter's; anchors past the end of the file reuse the ones recorded for earlier anchors
+	int recorded = d_actual_fft.size()/FFT_SIZE_POST;
+	if(recorded == 0)
+		throw std::runtime_error("harmonic_localizer: tx_phasors.dat holds no full anchor");
+	d_actual_fft.resize(recorded*FFT_SIZE_POST);
+	for(int ii=recorded*FFT_SIZE_POST; ii < d_num_anchors*FFT_SIZE_POST; ii++)
+		d_actual_fft.push_back(d_actual_fft[ii % (recorded*FFT_SIZE_POST)]);
 }
 
 void harmonic_localizer_impl::readToAErrors(){
@@ -107,11 +156,14 @@ void harmonic_localizer_impl::readToAErrors(){
 
 	//Open file for reading
 	FILE *source = fopen("measured_toa_errors.dat", "r");
+	if(source == NULL)
+		throw std::runtime_error("harmonic_localizer: cannot open measured_toa_errors.dat");
 		
-	//Read complex numbers in one at a time
-	for(int ii=0; ii < NUM_ANCHORS*NUM_STEPS*NUM_HARM_PER_STEP_POST; ii++){
+	//Read one error per anchor; anchors the file does not cover are uncorrected
+	for(int ii=0; ii < d_num_anchors; ii++){
 		int cur_toa_error;
-		fread((void*)(&cur_toa_error), sizeof(cur_toa_error), 1, source);
+		if(fread((void*)(&cur_toa_error), sizeof(cur_toa_error), 1, source) != 1)
+			cur_toa_error = 0;
 		d_toa_errors.push_back(cur_toa_error);
 	}
 	
@@ -120,66 +172,6 @@ void harmonic_localizer_impl::readToAErrors(){
 
 }
 
-std::vector<float> harmonic_localizer_impl::tdoa4_slow(std::vector<double> &toas){
-	for(int ii=toas.size()-1; ii >= 0; ii--)
-		toas[ii] -= toas[0];
-
-	bool new_est = true;
-	std::vector<float> est_position(3,0.0);
-	std::vector<float> cand_position(3, 0.0);
-	std::vector<float> cand_dist(toas.size(), 0.0);
-	float best_error = INFINITY;
-	while(new_est){
-		float cur_best_error = best_error;
-		int cur_best_error_idx = 0;
-		for(int jj=0; jj < d_poss_steps.size(); jj++){
-			for(int kk=0; kk < est_position.size(); kk++)
-				cand_position[kk] = est_position[kk] + d_poss_steps[jj][kk];
-			for(int ll=0; ll < d_anchor_pos.size(); ll++){
-				float anchor_dist = 0.0;
-				for(int kk=0; kk < est_position.size(); kk++){
-					float sub_dist = d_anchor_pos[ll][kk]-cand_position[kk];
-					anchor_dist += sub_dist*sub_dist;
-				}
-				if(ll > 0)
-					cand_dist[ll] = sqrt(anchor_dist) - cand_dist[0];
-				else
-					cand_dist[ll] = sqrt(anchor_dist);
-			}
-			float error = 0.0;
-			for(int kk=1; kk < d_anchor_pos.size(); kk++){
-				float cur_error = cand_dist[kk]-toas[kk];
-				error += cur_error*cur_error;
-			}
-			if(error < cur_best_error){
-				cur_best_error = error;
-				cur_best_error_idx = jj;
-			}
-		}
-
-		if(cur_best_error < best_error){
-			best_error = cur_best_error;
-			for(int kk=0; kk < est_position.size(); kk++)
-				est_position[kk] = est_position[kk] + d_poss_steps[cur_best_error_idx][kk];
-			new_est = true;
-		} else {
-			new_est = false;
-		}
-
-		//Check to make sure we don't go too far
-		float mag = 0.0;
-		for(int ii=0; ii < est_position.size(); ii++)
-			mag += est_position[ii]*est_position[ii];
-		if(mag > 100.0){
-			for(int ii=0; ii < est_position.size(); ii++)
-				est_position[ii] = 0.0;
-			break;
-		}
-	}
-
-	return est_position;
-}
-
 std::vector<float> harmonic_localizer_impl::tdoa4(std::vector<double> toas){
 
 	//double ti=67335898; double tk=86023981; double tj=78283279;  double tl=75092320;
@@ -194,9 +186,13 @@ std::vector<float> harmonic_localizer_impl::tdoa4(std::vector<double> toas){
 	//cout<<"zi = "<<zi<<endl;  cout<<"zj = "<<zj<<endl;  cout<<"zk = "<<zk<<endl;
 	//cout<<"zl = "<<zl<<endl;
 
-	static double ax[4] = {2.405, 2.105, 4.108, 0.273};
-	static double ay[4] = {3.815, 0.034, 0.347, 0.343};
-	static double az[4] = {2.992, 2.494, 1.543, 1.560};
+	//Closed form over the first four anchors
+	double ax[4], ay[4], az[4];
+	for(int ii=0; ii < 4; ii++){
+		ax[ii] = d_anchor_pos[ii][0];
+		ay[ii] = d_anchor_pos[ii][1];
+		az[ii] = d_anchor_pos[ii][2];
+	}
 	
 	double xji=ax[1]-ax[0]; double xki=ax[2]-ax[0]; double xjk=ax[1]-ax[2]; double xlk=ax[3]-ax[2];
 	double xik=ax[0]-ax[2]; double yji=ay[1]-ay[0]; double yki=ay[2]-ay[0]; double yjk=ay[1]-ay[2];
@@ -273,14 +269,37 @@ void harmonic_localizer_impl::sendToGATD(std::vector<float> &positions){
 	message_port_pub(pmt::mp("frame_out"), new_message);
 }
 
-void harmonic_localizer_impl::sendRawSingle(std::vector<float> &position){
+void harmonic_localizer_impl::sendRawSingle(std::vector<float> &position, const tdoa_fix *fix, int tag_id, const snapshot_header *hdr, uint64_t start_ns){
 	//Construct outgoing packet
 	uint8_t outgoing_packet[12];
 	memcpy(&outgoing_packet[0], &position[0], 12);
 
-	//Push to GATD
+	//Every stage's start and end, this one's last, as ns after the snapshot was ingested
+	uint64_t done_ns = monotonicNs();
+	if(block_stats::enabled())
+		d_stats.record(STAGE_END_TO_END, done_ns - hdr->ingest_ns);
+	uint32_t trace[TRACE_POINTS+2];
+	memcpy(trace, hdr->trace_ns, sizeof(hdr->trace_ns));
+	trace[TRACE_POINTS] = traceOffset(hdr, start_ns);
+	trace[TRACE_POINTS+1] = traceOffset(hdr, done_ns);
+
+	//Push to GATD, with the tag and the snapshot's trace in the PDU metadata so the payload stays three floats
+	pmt::pmt_t meta = pmt::make_dict();
+	meta = pmt::dict_add(meta, d_tag_key, pmt::from_long(tag_id));
+	meta = pmt::dict_add(meta, d_seq_key, pmt::from_long(hdr->sequence_num));
+	meta = pmt::dict_add(meta, d_ingest_key, pmt::from_uint64(hdr->ingest_ns));
+	meta = pmt::dict_add(meta, d_latency_key, pmt::from_uint64(done_ns - hdr->ingest_ns));
+	meta = pmt::dict_add(meta, d_trace_key, pmt::init_u32vector(TRACE_POINTS+2, trace));
+
+	//Without a fix the position is all zeros, which would otherwise read as a tag at the origin
+	meta = pmt::dict_add(meta, d_valid_key, pmt::from_bool(fix != NULL));
+	if(fix != NULL){
+		meta = pmt::dict_add(meta, d_residual_key, pmt::from_double(fix->residual));
+		meta = pmt::dict_add(meta, d_cov_key, pmt::init_f64vector(9, fix->covariance));
+		meta = pmt::dict_add(meta, d_rejected_key, pmt::from_long(fix->rejected));
+	}
 	pmt::pmt_t value = pmt::init_u8vector(12, outgoing_packet);
-	pmt::pmt_t new_message = pmt::cons(pmt::PMT_NIL, value);
+	pmt::pmt_t new_message = pmt::cons(meta, value);
 	message_port_pub(pmt::mp("frame_out"), new_message);
 }
 
@@ -352,8 +371,8 @@ void harmonic_localizer_impl::correctCOMBPhase(){
 	std::vector<gr_complex> comb_h = freqz(b_v, a_v, w);
 
 	//Correct any imparted amplitude/phase from the two cascaded COMB filters
-	for(int ii=0; ii < d_harmonic_phasors.size(); ii++){
-		d_harmonic_phasors[ii] = gr_complex(d_harmonic_phasors[ii])/comb_h[ii%comb_h.size()]/comb_h[ii%comb_h.size()];
+	for(int ii=0; ii < d_harmonic_corr.size(); ii++){
+		d_harmonic_corr[ii] = d_harmonic_corr[ii]/comb_h[ii]/comb_h[ii];
 	}
 }
 
@@ -374,8 +393,8 @@ void harmonic_localizer_impl::compensateRCLP(){
 	std::vector<gr_complex> rc_phase = freqs(b_v, a_v, d_harmonic_freqs_f);
 	
 	//Correct any imparted amplitude/phase from the RC low-pass filter
-	for(int ii=0; ii < d_harmonic_phasors.size(); ii++){
-		d_harmonic_phasors[ii] = gr_complex(d_harmonic_phasors[ii])/rc_phase[ii%rc_phase.size()];
+	for(int ii=0; ii < d_harmonic_corr.size(); ii++){
+		d_harmonic_corr[ii] = d_harmonic_corr[ii]/rc_phase[ii];
 	}
 }
 
@@ -398,8 +417,8 @@ void harmonic_localizer_impl::compensateRCHP(){
 	std::vector<gr_complex> rc_phase = freqs(b_v, a_v, w);
 
 	//Correct any imparted amplitude/phase from the RC high-pass filter
-	for(int ii=0; ii < d_harmonic_phasors.size(); ii++){
-		d_harmonic_phasors[ii] = gr_complex(d_harmonic_phasors[ii])/rc_phase[ii%rc_phase.size()];
+	for(int ii=0; ii < d_harmonic_corr.size(); ii++){
+		d_harmonic_corr[ii] = d_harmonic_corr[ii]/rc_phase[ii];
 	}
 }
 
@@ -416,16 +435,133 @@ void harmonic_localizer_impl::compensateStepTime(){
 
 
 	//Correct any imparted phase from the time difference between observations
-	//TODO: This could be simplified a bit since phase_corr doesn't need to be computed separately for each anchor
-	int num_h = NUM_STEPS*NUM_HARMONICS_PER_STEP;
-	for(int ii=0; ii < d_harmonic_phasors.size(); ii++){
-		double phase_corr = (double)(d_time_delay_in_samples[ii])*d_harmonic_freqs[ii%num_h]/SAMPLE_RATE*DECIM_FACTOR;
+	for(int ii=0; ii < d_harmonic_corr.size(); ii++){
+		float time_delay_in_samples = (ii/d_harmonics_per_step)*SAMPLES_PER_FREQ;
+		double phase_corr = (double)(time_delay_in_samples)*d_harmonic_freqs[ii]/SAMPLE_RATE*DECIM_FACTOR;
 		phase_corr = fmod(phase_corr, (2.0*M_PI));
-		d_harmonic_phasors[ii] = d_harmonic_phasors[ii]*std::exp(-d_i*(float)(phase_corr));
+		d_harmonic_corr[ii] = d_harmonic_corr[ii]*std::exp(-d_i*(float)(phase_corr));
+	}
+}
+
+void harmonic_localizer_impl::updateCalibration(std::vector<gr_complex> &calibration){
+	//Translate Hz to rad/sec
+	for(int ii=0; ii < d_harmonic_freqs.size(); ii++)
+		d_harmonic_freqs[ii] *= 2.0*M_PI;
+
+	//Lower-fidelity harmonic freqs for most calculations
+	d_harmonic_freqs_f.clear();
+	for(int ii=0; ii < d_harmonic_freqs.size(); ii++)
+		d_harmonic_freqs_f.push_back((float)d_harmonic_freqs[ii]);
+
+	//Combined response of the calibration steps for every harmonic of every step
+	d_harmonic_corr.assign(d_harmonic_freqs.size(), gr_complex(1.0, 0.0));
+	correctCOMBPhase();
+	compensateRCLP();
+	compensateRCHP();
+	compensateStepTime();
+
+	//Lay it out the way gatherTag() rearranges the phasors, then fold in the
+	//super-resolution window and the division by each anchor's expected phasors
+	calibration.resize(d_num_anchors*FFT_SIZE_POST);
+	for(int ii=0; ii < d_num_anchors; ii++){
+		int hp_idx = 0;
+		for(int jj=0; jj < NUM_STEPS; jj++){
+			for(int kk=HARMONIC_NON_OVERLAP_START; kk <= HARMONIC_NON_OVERLAP_END; kk++){
+				int harmonic_idx = (NUM_STEPS-jj-1)*d_harmonics_per_step+kk-d_harmonic_start;
+				int res_idx = ii*FFT_SIZE_POST + ((hp_idx + FFT_SHIFT_POST) % FFT_SIZE_POST);
+				calibration[res_idx] = d_harmonic_corr[harmonic_idx]*d_cal_base[res_idx];
+				hp_idx++;
+			}
+		}
+	}
+}
+
+const std::vector<gr_complex> &harmonic_localizer_impl::calibrationFor(const phasor_frame *frame){
+	//The calibration only depends on the harmonic frequencies, which only change with
+	//the PRF estimate as harmonic_extractor quantizes it, whatever quantum it was given
+	double key = frame->table_prf;
+	std::map<double, cal_entry>::iterator it = d_cal_cache.find(key);
+	if(it != d_cal_cache.end()){
+		d_cal_lru.splice(d_cal_lru.begin(), d_cal_lru, it->second.lru_pos);
+		return it->second.calibration;
 	}
+
+	//Miss: recycle the least recently used entry's storage once every tag's PRF has one
+	std::vector<gr_complex> storage;
+	if(d_cal_cache.size() < HARMONIC_TABLE_CACHE)
+		d_stats.increment(COUNTER_ALLOCATIONS);
+	if(d_cal_cache.size() >= HARMONIC_TABLE_CACHE){
+		std::map<double, cal_entry>::iterator victim = d_cal_cache.find(d_cal_lru.back());
+		storage.swap(victim->second.calibration);
+		d_cal_cache.erase(victim);
+		d_cal_lru.pop_back();
+	}
+	d_cal_lru.push_front(key);
+	cal_entry &entry = d_cal_cache[key];
+	entry.calibration.swap(storage);
+	entry.lru_pos = d_cal_lru.begin();
+
+	//Fold the calibration steps into one correction vector for this PRF
+	d_harmonic_freqs.assign(frame->harmonic_freqs.begin(), frame->harmonic_freqs.end());
+	updateCalibration(entry.calibration);
+	return entry.calibration;
+}
+
+void harmonic_localizer_impl::gatherTag(const phasor_frame *frame){
+	uint64_t start_ns = stageStart();
+	int slot = d_num_slots++;
+	d_slot_tags[slot] = frame->tag_id;
+	d_slot_prfs[slot] = (float)frame->prf_est;
+	d_hp_rearranged.resize(d_num_slots*d_num_anchors*FFT_SIZE_POST);
+
+	//Rearrange square phasors so they're in the expected shape/orientation for IFFT processing
+	gr_complex *hp_rearranged = &d_hp_rearranged[slot*d_num_anchors*FFT_SIZE_POST];
+	const gr_complex *phasors = &frame->phasors[0];
+	for(int ii=0; ii < d_num_anchors; ii++){
+		int hp_idx = 0;
+		for(int jj=0; jj < NUM_STEPS; jj++){
+			for(int kk=HARMONIC_NON_OVERLAP_START; kk <= HARMONIC_NON_OVERLAP_END; kk++){
+				int phasor_idx = ii*NUM_STEPS*d_harmonics_per_step+(NUM_STEPS-jj-1)*d_harmonics_per_step+kk-d_harmonic_start;
+				int res_idx = ii*FFT_SIZE_POST + ((hp_idx + FFT_SHIFT_POST) % FFT_SIZE_POST);
+				hp_rearranged[res_idx] = phasors[phasor_idx];
+				hp_idx++;
+			}
+		}
+	}
+
+	//Every calibration step at once
+	const std::vector<gr_complex> &calibration = calibrationFor(frame);
+	volk_32fc_x2_multiply_32fc(hp_rearranged, hp_rearranged, &calibration[0], calibration.size());
+	stageEnd(d_stats, STAGE_COMPENSATE, start_ns);
 }
 
-std::vector<int> harmonic_localizer_impl::extractToAs(std::vector<gr_complex> hp_rearranged, float *imp_thresholds){
+void harmonic_localizer_impl::findToA(int slot_anchor, int worker){
+	//The window and the division by the expected phasors are already folded into the calibration
+	int anchor = slot_anchor % d_num_anchors;
+	cir_zoom *cir = d_cirs[worker];
+	uint64_t start_ns = stageStart();
+
+	/*** Search the super-resolution CIR (the zero-padded FFT) without building all of it ***/
+	cir->set_spectrum(&d_hp_rearranged[slot_anchor*FFT_SIZE_POST]);
+
+	//NOTE: CIR is backwards because of the use of an FFT instead of IFFT
+	//Find maximum peak
+	float max_mag;
+	int max_mag_idx = cir->find_peak(max_mag);
+
+	//Last step: Determine ToA based on this anchor's threshold
+	int cand_toa_idx = cir->find_first_path(max_mag_idx, max_mag, d_anchors.thresholds()[anchor]);
+
+	//Must flip ToAs since not doing an FFT
+	int res_toa = FFT_SIZE_POST*INTERP-cand_toa_idx;
+	res_toa -= d_toa_errors[anchor];
+	res_toa %= FFT_SIZE_POST*INTERP;
+	if(res_toa < 0) res_toa += FFT_SIZE_POST*INTERP;
+	d_toas[slot_anchor] = res_toa;
+	stageEnd(d_stats, STAGE_CIR_FFT, start_ns);
+}
+
+std::vector<int> harmonic_localizer_impl::extractToAs(int slot){
 	//INTERP = 64;
 	//THRESH = 0.2;
 	//
@@ -484,82 +620,12 @@ std::vector<int> harmonic_localizer_impl::extractToAs(std::vector<gr_complex> hp
 	//    %ii
 	//end
 
-	static std::vector<gr_complex> fft_array(FFT_SIZE_POST*INTERP,0);
-	std::vector<int> toas;
-
-	for(int ii=0; ii < NUM_ANCHORS; ii++){
-		int anchor_idx = ii*FFT_SIZE_POST;
-		for(int jj=0; jj < NUM_STEPS; jj++){
-			int step_idx = jj*NUM_HARM_PER_STEP_POST;
-			for(int kk=0; kk < NUM_HARM_PER_STEP_POST; kk++){
-
-				//Multiply phasors by a window for super-resolution purposes
-				int cur_idx = anchor_idx + step_idx + kk;
-				hp_rearranged[cur_idx] *= d_fft_window[step_idx + kk];
-			
-				//Divide by the expected phasors
-				hp_rearranged[cur_idx] /= d_actual_fft[cur_idx];
-			}
-		}
-
-		/*** Perform IFFT on zero-padded array to obtain super-resolution CIR ***/
-
-		//Start by copying the current phasors into the appropriate array
-		memcpy(d_fft->get_inbuf(), &hp_rearranged[anchor_idx], FFT_SIZE_POST/2*sizeof(gr_complex));
-		memcpy(d_fft->get_inbuf() + FFT_SIZE_POST*INTERP - FFT_SIZE_POST/2, &hp_rearranged[anchor_idx + FFT_SIZE_POST/2], FFT_SIZE_POST/2*sizeof(gr_complex));
-
-		//Then perform FFT
-		d_fft->execute();
-
-		//Get magnitude of CIR
-		std::vector<float> cir_mag(fft_array.size(), 0);
-		volk_32fc_magnitude_32f_u(&cir_mag[0], d_fft->get_outbuf(), fft_array.size());
-
-		//if(d_abs_count == 9 || d_abs_count == 800){
-		//	std::cout << "start" << std::endl;
-		//	for(int jj=0; jj < fft_array.size(); jj++){
-		//		std::cout << cir_mag[jj] << std::endl;
-		//	}
-		//}
-		
-		//NOTE: CIR is backwards because of the use of an FFT instead of IFFT
-		//Iteratively find maximum peak
-		float max_mag = 0.0;
-		int max_mag_idx = 0;
-		for(int jj=0; jj < FFT_SIZE_POST*INTERP; jj++){
-			if(cir_mag[jj] > max_mag){
-				max_mag = cir_mag[jj];
-				max_mag_idx = jj;
-			}
-		}
-
-		//Last step: Determine ToA based on passed thresholds
-		int cur_idx = max_mag_idx;
-		int cand_toa_idx = max_mag_idx;
-		int below_threshold_count = 0;
-		for(int jj=0; jj < FFT_SIZE_POST*INTERP; jj++){
-			if(cir_mag[cur_idx]/max_mag < imp_thresholds[ii]){
-				below_threshold_count++;
-				if(below_threshold_count > FFT_SIZE_POST*INTERP/4) break;
-			} else {
-				cand_toa_idx = cur_idx;
-				below_threshold_count = 0;
-			}
-			cur_idx++;
-			if(cur_idx >= FFT_SIZE_POST*INTERP) cur_idx = 0;
-		}
-
-		//Must flip ToAs since not doing an FFT
-		int res_toa = FFT_SIZE_POST*INTERP-cand_toa_idx;
-		res_toa -= d_toa_errors[ii];
-		res_toa %= FFT_SIZE_POST*INTERP;
-		if(res_toa < 0) res_toa += FFT_SIZE_POST*INTERP;
-		toas.push_back(res_toa);
-	}
+	//The CIRs were searched by harmonicLocalization(), every anchor of every tag at once
+	std::vector<int> toas(d_toas.begin() + slot*d_num_anchors, d_toas.begin() + (slot+1)*d_num_anchors);
 
 	//Rotate ToAs so that ToA of the first anchor ends up in the middle in order to avoid issues where ToAs span 
 	int rotate_amount = (FFT_SIZE_POST*INTERP/2)-toas[0];
-	for(int ii=0; ii < NUM_ANCHORS; ii++){
+	for(int ii=0; ii < d_num_anchors; ii++){
 		toas[ii] += rotate_amount;
 		if(toas[ii] < 0)
 			toas[ii] += FFT_SIZE_POST*INTERP;
@@ -576,7 +642,7 @@ std::vector<int> harmonic_localizer_impl::extractToAs(std::vector<gr_complex> hp
 	return toas;
 }
 
-void harmonic_localizer_impl::harmonicLocalization(){
+void harmonic_localizer_impl::harmonicLocalization(const snapshot_header *hdr, uint64_t start_ns){
 	//INTERP = 64;
 	//
 	//%This does localization via analysis of the impulse response at each antenna
@@ -599,67 +665,86 @@ void harmonic_localizer_impl::harmonicLocalization(){
 	//%Convert imp_toas to meters
 	//imp_toas = imp_toas/(2*prf_est*size(square_phasors_reshaped,2))/INTERP*3e8;
 
-	//Rearrange square phasors so they're in the expected shape/orientation for IFFT processing
-	std::vector<gr_complex> hp_rearranged(NUM_ANCHORS*FFT_SIZE_POST,gr_complex(0.0, 0.0));
-	for(int ii=0; ii < NUM_ANCHORS; ii++){
-		int hp_idx = 0;
-		for(int jj=0; jj < NUM_STEPS; jj++){
-			for(int kk=HARMONIC_NON_OVERLAP_START; kk <= HARMONIC_NON_OVERLAP_END; kk++){
-				int phasor_idx = ii*NUM_STEPS*NUM_HARMONICS_PER_STEP+(NUM_STEPS-jj-1)*NUM_HARMONICS_PER_STEP+kk;
-				int res_idx = ii*FFT_SIZE_POST + ((hp_idx + FFT_SHIFT_POST) % FFT_SIZE_POST);
-				hp_rearranged[res_idx] = d_harmonic_phasors[phasor_idx];
-				hp_idx++;
-			}
-		}
-	}
+	//The phasors of every tag in the snapshot were rearranged and calibrated by gatherTag()
 	//if(d_abs_count == 9){
 	//	std::cout << "start" << std::endl;
-	//	for(int ii=0; ii < hp_rearranged.size(); ii++){
-	//		std::cout << hp_rearranged[ii].real() << " " << hp_rearranged[ii].imag() << std::endl;
+	//	for(int ii=0; ii < d_hp_rearranged.size(); ii++){
+	//		std::cout << d_hp_rearranged[ii].real() << " " << d_hp_rearranged[ii].imag() << std::endl;
 	//	}
 	//}
 
-	//Calculate ToAs given phasors and expected phasors
-	float imp_thresholds[4] = {0.2, 0.2, 0.2, 0.2};
-	std::vector<int> imp_toas = extractToAs(hp_rearranged, imp_thresholds);
-	std::vector<double> imp_in_ns;
-	for(int ii=0; ii < imp_toas.size(); ii++){
-		double cur_toa = (double)imp_toas[ii]/(d_prf_est*FFT_SIZE_POST)/INTERP*1e9;
-		imp_in_ns.push_back(cur_toa);
-	}
-	std::vector<double> imp_in_m;
-	for(int ii=0; ii < imp_toas.size(); ii++){
-		double cur_toa = (double)imp_toas[ii]/(d_prf_est*FFT_SIZE_POST)/INTERP*3e8;
-		imp_in_m.push_back(cur_toa);
-	}
-	//for(int ii=0; ii < imp_in_ns.size(); ii++){
-	//	std::cout << imp_in_ns[ii] << " ";
-	//}
-	//std::cout << std::endl;
+	//Every anchor's CIR of every tag is searched at once, so adding anchors or tags does not add latency while there are threads to spare
+	d_pool->run(d_toa_tasks, d_num_slots*d_num_anchors);
+
+	for(int slot=0; slot < d_num_slots; slot++){
+		float prf_est = d_slot_prfs[slot];
+		if(d_tag_states.find(d_slot_tags[slot]) == d_tag_states.end())
+			d_stats.increment(COUNTER_ALLOCATIONS);
+		tag_state &state = d_tag_states[d_slot_tags[slot]];
+
+		//Calculate ToAs given phasors and expected phasors, with each anchor's configured threshold
+		std::vector<int> imp_toas = extractToAs(slot);
+		std::vector<double> imp_in_ns;
+		for(int ii=0; ii < imp_toas.size(); ii++){
+			double cur_toa = (double)imp_toas[ii]/(prf_est*FFT_SIZE_POST)/INTERP*1e9;
+			imp_in_ns.push_back(cur_toa);
+		}
+		std::vector<double> imp_in_m;
+		for(int ii=0; ii < imp_toas.size(); ii++){
+			double cur_toa = (double)imp_toas[ii]/(prf_est*FFT_SIZE_POST)/INTERP*3e8;
+			imp_in_m.push_back(cur_toa);
+		}
+		//for(int ii=0; ii < imp_in_ns.size(); ii++){
+		//	std::cout << imp_in_ns[ii] << " ";
+		//}
+		//std::cout << std::endl;
 	
-	//Finally, determine position based on calculated ToAs...
-	//std::vector<float> positions_fast = tdoa4(imp_in_ns);
-	std::vector<float> positions = tdoa4_slow(imp_in_m);
-	//if(positions[3] > 2.5){
-	//	std::cout << d_abs_count << " ";
-	//	for(int ii=0; ii < positions.size(); ii++){
-	//		std::cout << positions[ii] << " ";
-	//	}
-	//	for(int ii=0; ii < imp_in_ns.size(); ii++){
-	//		std::cout << imp_in_ns[ii] << " ";
-	//	}
-	//	std::cout << std::endl;
-	//}
-	//if(d_abs_count == 1374){
-	for(int ii=0; ii < positions.size(); ii++){
-		std::cout << positions[ii] << " ";
+		//Finally, determine position from the ToAs of every anchor, seeding the solver with the closed-form roots of the first four
+		uint64_t solve_start = stageStart();
+		std::vector<float> positions_fast = tdoa4(imp_in_ns);
+		//The solver is shared, so each tag brings its own previous fix as the warm start
+		std::vector<double> starts;
+		if(state.have_fix)
+			starts.insert(starts.end(), state.fix.position, state.fix.position+3);
+		starts.insert(starts.end(), positions_fast.begin(), positions_fast.end());
+		std::vector<float> positions(3, 0.0);
+		d_tdoa->reset();
+		state.have_fix = d_tdoa->solve(imp_in_m, starts, state.fix);
+		state.last_seen = d_abs_count;
+		stageEnd(d_stats, STAGE_SOLVE, solve_start);
+		if(state.have_fix){
+			for(int ii=0; ii < positions.size(); ii++)
+				positions[ii] = state.fix.position[ii];
+		}
+		//if(positions[3] > 2.5){
+		//	std::cout << d_abs_count << " ";
+		//	for(int ii=0; ii < positions.size(); ii++){
+		//		std::cout << positions[ii] << " ";
+		//	}
+		//	for(int ii=0; ii < imp_in_ns.size(); ii++){
+		//		std::cout << imp_in_ns[ii] << " ";
+		//	}
+		//	std::cout << std::endl;
+		//}
+		//if(d_abs_count == 1374){
+		for(int ii=0; ii < positions.size(); ii++){
+			std::cout << positions[ii] << " ";
+		}
+		//for(int ii=0; ii < positions_fast.size(); ii++){
+		//	std::cout << positions_fast[ii] << " ";
+		//}
+		std::cout << std::endl;
+		//}
+		sendRawSingle(positions, state.have_fix ? &state.fix : NULL, d_slot_tags[slot], hdr, start_ns);
+	}
+
+	//Forget tags that have not been seen for a while, so a returning id starts cold
+	for(std::map<int, tag_state>::iterator it = d_tag_states.begin(); it != d_tag_states.end(); ){
+		if(d_abs_count - it->second.last_seen > TAG_EXPIRY)
+			d_tag_states.erase(it++);
+		else
+			++it;
 	}
-	//for(int ii=0; ii < positions_fast.size(); ii++){
-	//	std::cout << positions_fast[ii] << " ";
-	//}
-	std::cout << std::endl;
-	//}
-	sendRawSingle(positions);
 }
 
 int harmonic_localizer_impl::work(int noutput_items,
@@ -670,38 +755,74 @@ int harmonic_localizer_impl::work(int noutput_items,
 	const gr_complex *in = (const gr_complex *) input_items[0];
 	int count=0;
 	int out_count = 0;
-	std::vector<tag_t> tags;
-	const uint64_t nread = nitems_read(0);
 
 	while(count < noutput_items){
-		//Extract PRF estimate from tag
-		get_tags_in_range(tags, 0, nread+count, nread+count+1);
-		for(unsigned ii=0; ii < tags.size(); ii++){
-			if(tags[ii].key == d_phasor_key)
-				d_harmonic_phasors = pmt::c32vector_elements(tags[ii].value);
-			else if(tags[ii].key == d_hfreq_key)
-				d_harmonic_freqs = pmt::f64vector_elements(tags[ii].value);
-			else if(tags[ii].key == d_prf_key)
-				d_prf_est = (float)pmt::to_double(tags[ii].value);
+		//Gather the phasors, frequencies and PRF estimate of every tag out of the frames and hand them back;
+		//the member vectors keep their capacity, so this does not allocate
+		const snapshot_header *hdr = snapshotHeader(snapshotFrame(input_items[0], count));
+		phasor_frame *frame = hdr->phasors;
+		uint64_t start_ns = monotonicNs();
+		d_stats.increment(COUNTER_SNAPSHOTS);
+		if(frame != NULL && (!phasor_frame_pool::instance().in_flight(frame) || frame->sequence_num != hdr->sequence_num)){
+			//A pointer replayed from a recording, or a frame another reader of output 0 already released
+			d_stats.increment(COUNTER_FRAMES_DROPPED);
+			frame = NULL;
+		}
+		if(frame == NULL){
+			//No tag was found in this snapshot
+			count++;
+			continue;
 		}
 
-		//Translate Hz to rad/sec
-		for(int ii=0; ii < d_harmonic_freqs.size(); ii++)
-			d_harmonic_freqs[ii] *= 2.0*M_PI;
-
-		//Lower-fidelity harmonic freqs for most calculations
-		d_harmonic_freqs_f.clear();
-		for(int ii=0; ii < d_harmonic_freqs.size(); ii++)
-			d_harmonic_freqs_f.push_back((float)d_harmonic_freqs[ii]);
-
-		//Put the phasors through various calibration steps
-		correctCOMBPhase();
-		compensateRCLP();
-		compensateRCHP();
-		compensateStepTime();
-		harmonicLocalization();
+		//The frames only hold the harmonics the extractor was asked for
+		if(hdr->num_harmonics == 0 || hdr->harmonic_start > HARMONIC_NON_OVERLAP_START ||
+				hdr->harmonic_start + hdr->num_harmonics <= HARMONIC_NON_OVERLAP_END){
+			//The range is fixed by the extractor's configuration, so one warning covers every snapshot; the rest are counted
+			if(!d_warned_harmonics)
+				GR_LOG_WARN(d_logger, "snapshot " << hdr->sequence_num << " carries harmonics " << (int)hdr->harmonic_start << ".."
+					<< (int)hdr->harmonic_start + (int)hdr->num_harmonics - 1 << ", which lacks " << HARMONIC_NON_OVERLAP_START << ".."
+					<< HARMONIC_NON_OVERLAP_END << "; skipping such snapshots (see the skipped counter)");
+			d_warned_harmonics = true;
+			while(frame != NULL){
+				phasor_frame *next = frame->next;
+				frame->release();
+				frame = next;
+			}
+			d_stats.increment(COUNTER_SKIPPED);
+			count++;
+			continue;
+		}
+		if(hdr->harmonic_start != d_harmonic_start || hdr->num_harmonics != d_harmonics_per_step){
+			//Every cached calibration was laid out for the old harmonic range
+			d_cal_cache.clear();
+			d_cal_lru.clear();
+			d_harmonic_start = hdr->harmonic_start;
+			d_harmonics_per_step = hdr->num_harmonics;
+		}
+
+		d_num_slots = 0;
+		while(frame != NULL){
+			phasor_frame *next = frame->next;
+			if(frame->phasors.size() != d_num_anchors*NUM_STEPS*d_harmonics_per_step){
+				//A mismatch follows from how the flowgraph is wired, so it repeats on every frame; warn once and count the rest
+				if(!d_warned_anchors)
+					GR_LOG_WARN(d_logger, "snapshot " << hdr->sequence_num << " tag " << frame->tag_id << " does not carry "
+						<< d_num_anchors << " anchors; skipping such frames (see the frames dropped counter)");
+				d_warned_anchors = true;
+				d_stats.increment(COUNTER_FRAMES_DROPPED);
+			} else if(d_num_slots < MAX_TAGS)
+				gatherTag(frame);
+			frame->release();
+			frame = next;
+		}
+		if(d_num_slots == 0){
+			d_stats.increment(COUNTER_SKIPPED);
+			count++;
+			continue;
+		}
+
+		harmonicLocalization(hdr, start_ns);
 		//std::cout << d_abs_count << std::endl;
-		//It is assumed that each dataset coming in has already populated d_harmonic_phasors and d_hfreq_key
 		//if(d_abs_count == 9){
 		//	std::cout << "start" << std::endl;
 		//	for(int ii=0; ii < d_actual_fft.size(); ii++){
@@ -709,12 +830,6 @@ int harmonic_localizer_impl::work(int noutput_items,
 		//	}
 		//}
 
-		if(d_abs_count == 1)
-			d_start_time = clock();
-		else{
-			clock_t cur_time = clock();
-			std::cout << (double)(cur_time-d_start_time)/(d_abs_count-1)/CLOCKS_PER_SEC << std::endl;
-		}
 		d_abs_count++;
 		count++;
 	}   // while
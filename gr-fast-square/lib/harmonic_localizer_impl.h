@@ -4,8 +4,17 @@
 
 #include <fast_square/harmonic_localizer.h>
 #include <fast_square/defines.h>
+#include <fast_square/snapshot_frame.h>
+#include <fast_square/block_stats.h>
+#include <fast_square/phasor_frame.h>
+#include <fast_square/anchor_config.h>
 #include <gnuradio/fft/fft.h>
+#include "cir_zoom.h"
+#include "tdoa_solver.h"
+#include "worker_pool.h"
 #include <boost/asio.hpp>
+#include <list>
+#include <map>
 
 namespace gr {
 namespace fast_square {
@@ -14,46 +23,91 @@ namespace fast_square {
 class harmonic_localizer_impl : public harmonic_localizer
 {
 private:
-	fft::fft_complex *d_fft;
-	pmt::pmt_t d_phasor_key, d_hfreq_key, d_prf_key;
-	std::vector<gr_complex> d_harmonic_phasors;
+	anchor_config d_anchors;
+	int d_num_anchors;
+	std::vector<cir_zoom *> d_cirs;  //One per worker, since each holds the spectrum it is searching
+	worker_pool *d_pool;
+	std::vector<worker_pool::task> d_toa_tasks; //One per tag slot and anchor
+	std::vector<int> d_toas;
+	tdoa_solver *d_tdoa;
+	pmt::pmt_t d_phasor_key, d_hfreq_key, d_prf_key, d_tag_key, d_seq_key, d_ingest_key, d_latency_key, d_trace_key;
+	pmt::pmt_t d_valid_key, d_residual_key, d_cov_key, d_rejected_key;
 	std::vector<double> d_harmonic_freqs;
-	std::vector<std::vector<float> > d_poss_steps;
 	std::vector<std::vector<float> > d_anchor_pos;
 	std::vector<float> d_harmonic_freqs_f;
-	std::vector<float> d_time_delay_in_samples;
+	std::vector<gr_complex> d_harmonic_corr; //Calibration of every harmonic of every step, before rearranging
+	std::vector<gr_complex> d_cal_base;      //Per anchor in CIR order: window and 1/expected phasor, shared by every PRF
+	std::vector<gr_complex> d_hp_rearranged; //Per tag slot, then anchor, in CIR order
 	std::vector<float> d_fft_window;
 	std::vector<int> d_toa_errors;
 	std::vector<gr_complex> d_actual_fft;
-	float d_prf_est;
+
+	//Calibration per quantized PRF, so tags at different PRFs each keep theirs
+	struct cal_entry
+	{
+		std::vector<gr_complex> calibration; //Per anchor in CIR order: calibration, window and 1/expected phasor
+		std::list<double>::iterator lru_pos;
+	};
+	std::map<double, cal_entry> d_cal_cache; //Keyed on phasor_frame::table_prf
+	std::list<double> d_cal_lru;             //Most recently used first
+
+	//Tags of the current snapshot, by slot
+	int d_num_slots;
+	std::vector<int> d_slot_tags;
+	std::vector<float> d_slot_prfs;
+
+	//Warm start of every tag seen lately
+	struct tag_state
+	{
+		tdoa_fix fix; //Latest fix, with its residual and covariance
+		bool have_fix;
+		int last_seen;
+	};
+	std::map<int, tag_state> d_tag_states;
+
+	int d_harmonic_start;     //Subset advertised by harmonic_extractor in the frame headers
+	int d_harmonics_per_step;
+	bool d_warned_harmonics;  //Snapshots lacking the non-overlapping harmonics have been reported
+	bool d_warned_anchors;    //Frames with the wrong number of anchors have been reported
 	int d_abs_count;
 	gr_complex d_i;
 	std::string d_gatd_id;
-	clock_t d_start_time;
+	block_stats d_stats;
 
 	void readToAErrors();
 	void readActualFFT();
 	std::vector<float> tdoa4(std::vector<double> toas);
-	std::vector<float> tdoa4_slow(std::vector<double> &toas);
 	void genFFTWindow();
 	gr_complex polyval(std::vector<float> &p, gr_complex x);
 	std::vector<gr_complex> freqz(std::vector<float> &b, std::vector<float> &a, std::vector<float> &w);
 	std::vector<gr_complex> freqs(std::vector<float> &b, std::vector<float> &a, std::vector<float> &w);
-	std::vector<int> extractToAs(std::vector<gr_complex> hp_rearranged, float *imp_thresholds);
+	void findToA(int slot_anchor, int worker);
+	std::vector<int> extractToAs(int slot);
 	void sendToGATD(std::vector<float> &positions);
-	void sendRawSingle(std::vector<float> &position);
+	void sendRawSingle(std::vector<float> &position, const tdoa_fix *fix, int tag_id, const snapshot_header *hdr, uint64_t start_ns);
 	void correctCOMBPhase();
 	void compensateRCLP();
 	void compensateRCHP();
 	void compensateStepTime();
-	void harmonicLocalization();
+	void updateCalibration(std::vector<gr_complex> &calibration);
+	const std::vector<gr_complex> &calibrationFor(const phasor_frame *frame);
+	void gatherTag(const phasor_frame *frame);
+	void harmonicLocalization(const snapshot_header *hdr, uint64_t start_ns);
 
 protected:
 
 public:
-	harmonic_localizer_impl(const std::string &phasor_tag_name, const std::string &hfreq_tag_name, const std::string &prf_tag_name, const std::string &gatd_id, int nthreads);
+	harmonic_localizer_impl(const std::string &phasor_tag_name, const std::string &hfreq_tag_name, const std::string &prf_tag_name, const std::string &gatd_id, int nthreads,
+			const std::string &anchor_file, int max_outliers);
 	~harmonic_localizer_impl();
 
+	bool check_topology(int ninputs, int noutputs);
+
+	std::vector<int> stage_histogram(int stage) const { return d_stats.histogram(stage); }
+	std::vector<int> stat_counters() const { return d_stats.counters(); }
+	template<int STAGE> std::vector<int> stageHistogram() const { return d_stats.histogram(STAGE); }
+	void setup_rpc();
+
 	int work(int noutput_items,
 			gr_vector_const_void_star &input_items,
 			gr_vector_void_star &output_items);
@@ -0,0 +1,148 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "marker_scan.h"
+#include <fast_square/defines.h>
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#include <immintrin.h>
+#define MARKER_SCAN_X86
+#endif
+
+namespace gr {
+namespace fast_square {
+
+static size_t findMarker_generic(const gr_complex *data, size_t nitems){
+	size_t ii = 0;
+	while(ii < nitems && data[ii].imag() > -1.0)
+		ii++;
+	return ii;
+}
+
+#ifdef MARKER_SCAN_X86
+static size_t findMarker_sse2(const gr_complex *data, size_t nitems){
+	//Each register holds two complex samples; only the imaginary lanes (bits 1 and 3) matter.
+	//NGT rather than LE so that NaNs stop the scan exactly like the scalar loop does.
+	const float *fdata = (const float *)data;
+	const __m128 thresh = _mm_set1_ps(-1.0f);
+	size_t ii = 0;
+	for(; ii + 8 <= nitems; ii += 8){
+		int m0 = _mm_movemask_ps(_mm_cmpngt_ps(_mm_loadu_ps(fdata + 2*ii), thresh)) & 0xA;
+		int m1 = _mm_movemask_ps(_mm_cmpngt_ps(_mm_loadu_ps(fdata + 2*ii + 4), thresh)) & 0xA;
+		int m2 = _mm_movemask_ps(_mm_cmpngt_ps(_mm_loadu_ps(fdata + 2*ii + 8), thresh)) & 0xA;
+		int m3 = _mm_movemask_ps(_mm_cmpngt_ps(_mm_loadu_ps(fdata + 2*ii + 12), thresh)) & 0xA;
+		if(m0 | m1 | m2 | m3)
+			return ii + findMarker_generic(data + ii, 8);
+	}
+	return ii + findMarker_generic(data + ii, nitems - ii);
+}
+
+__attribute__((target("avx")))
+static size_t findMarker_avx(const gr_complex *data, size_t nitems){
+	//Four complex samples per register, imaginary parts live in the odd lanes
+	const float *fdata = (const float *)data;
+	const __m256 thresh = _mm256_set1_ps(-1.0f);
+	size_t ii = 0;
+	for(; ii + 16 <= nitems; ii += 16){
+		int m0 = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(fdata + 2*ii), thresh, _CMP_NGT_UQ)) & 0xAA;
+		int m1 = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(fdata + 2*ii + 8), thresh, _CMP_NGT_UQ)) & 0xAA;
+		int m2 = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(fdata + 2*ii + 16), thresh, _CMP_NGT_UQ)) & 0xAA;
+		int m3 = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(fdata + 2*ii + 24), thresh, _CMP_NGT_UQ)) & 0xAA;
+		if(m0 | m1 | m2 | m3)
+			return ii + findMarker_generic(data + ii, 16);
+	}
+	return ii + findMarker_sse2(data + ii, nitems - ii);
+}
+#endif
+
+static size_t findMarker_sc16_generic(const int16_t *data, size_t nitems){
+	size_t ii = 0;
+	while(ii < nitems && data[2*ii+1] > -32767)
+		ii++;
+	return ii;
+}
+
+#ifdef MARKER_SCAN_X86
+static size_t findMarker_sc16_sse2(const int16_t *data, size_t nitems){
+	//Four complex samples per register; imaginary parts are int16 lanes 1,3,5,7 (movemask bytes 2,3,6,7,...)
+	const __m128i thresh = _mm_set1_epi16(-32767);
+	size_t ii = 0;
+	for(; ii + 16 <= nitems; ii += 16){
+		const __m128i *src = (const __m128i *)(data + 2*ii);
+		int m0 = _mm_movemask_epi8(_mm_cmpgt_epi16(_mm_loadu_si128(src), thresh));
+		int m1 = _mm_movemask_epi8(_mm_cmpgt_epi16(_mm_loadu_si128(src + 1), thresh));
+		int m2 = _mm_movemask_epi8(_mm_cmpgt_epi16(_mm_loadu_si128(src + 2), thresh));
+		int m3 = _mm_movemask_epi8(_mm_cmpgt_epi16(_mm_loadu_si128(src + 3), thresh));
+		if(((m0 & m1 & m2 & m3) & 0xCCCC) != 0xCCCC)
+			return ii + findMarker_sc16_generic(data + 2*ii, 16);
+	}
+	return ii + findMarker_sc16_generic(data + 2*ii, nitems - ii);
+}
+#endif
+
+size_t findMarker_sc16(const int16_t *data, size_t nitems){
+#ifdef MARKER_SCAN_X86
+	return findMarker_sc16_sse2(data, nitems);
+#else
+	return findMarker_sc16_generic(data, nitems);
+#endif
+}
+
+size_t findMarker(const gr_complex *data, size_t nitems){
+#ifdef MARKER_SCAN_X86
+	static const bool have_avx = __builtin_cpu_supports("avx");
+	if(have_avx)
+		return findMarker_avx(data, nitems);
+	return findMarker_sse2(data, nitems);
+#else
+	return findMarker_generic(data, nitems);
+#endif
+}
+
+restart_marker scanRestartMarker(const gr_complex *data, size_t nitems){
+	restart_marker ret;
+	ret.found = false;
+	ret.sequence_num = 0;
+	if(nitems <= SAMPLES_PER_SEQ){
+		ret.skipped = 0;
+		return ret;
+	}
+
+	//The marker sits SAMPLES_PER_SEQ samples after the start of the sequence it closes
+	ret.skipped = findMarker(data + SAMPLES_PER_SEQ, nitems - SAMPLES_PER_SEQ);
+	if(ret.skipped + SAMPLES_PER_SEQ < nitems){
+		ret.found = true;
+		ret.sequence_num = decodeSequenceNum(data[ret.skipped + SAMPLES_PER_SEQ - 1]);
+	}
+	return ret;
+}
+
+restart_marker scanRestartMarker_sc16(const int16_t *data, size_t nitems){
+	restart_marker ret;
+	ret.found = false;
+	ret.sequence_num = 0;
+	if(nitems <= SAMPLES_PER_SEQ){
+		ret.skipped = 0;
+		return ret;
+	}
+
+	ret.skipped = findMarker_sc16(data + 2*SAMPLES_PER_SEQ, nitems - SAMPLES_PER_SEQ);
+	if(ret.skipped + SAMPLES_PER_SEQ < nitems){
+		ret.found = true;
+		ret.sequence_num = decodeSequenceNum_sc16(data + 2*(ret.skipped + SAMPLES_PER_SEQ - 1));
+	}
+	return ret;
+}
+
+uint32_t decodeSequenceNum(gr_complex data){
+	float real_f = data.real()*32767;
+	float imag_f = data.imag()*32767;
+
+	uint32_t real = (real_f < 0.0) ? (uint32_t)(real_f + 65536) : (uint32_t)(real_f);
+	uint32_t imag = (imag_f < 0.0) ? (uint32_t)(imag_f + 65536) : (uint32_t)(imag_f);
+	return real + 65536*imag;
+}
+
+} /* namespace fast_square */
+} /* namespace gr */
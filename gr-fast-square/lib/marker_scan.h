@@ -0,0 +1,47 @@
+#ifndef INCLUDED_FAST_SQUARE_MARKER_SCAN_H
+#define INCLUDED_FAST_SQUARE_MARKER_SCAN_H
+
+#include <gnuradio/gr_complex.h>
+#include <cstddef>
+#include <stdint.h>
+
+namespace gr {
+namespace fast_square {
+
+struct restart_marker
+{
+	size_t skipped;        //Samples to discard before the sequence starts
+	bool found;            //True if a full sequence follows the skipped samples
+	uint32_t sequence_num; //Sequence word embedded just before the marker (valid if found)
+};
+
+/*!
+ * Finds the first index in data[0..nitems) whose imaginary part is not
+ * greater than -1.0 (the FPGA's restart marker).  Returns nitems if no
+ * marker is present.  Uses SSE2/AVX where available.
+ */
+size_t findMarker(const gr_complex *data, size_t nitems);
+
+//Same as findMarker() for interleaved sc16 samples, where the marker is an imaginary part <= -32767
+size_t findMarker_sc16(const int16_t *data, size_t nitems);
+
+/*!
+ * Locates the next aligned sequence in a block of history, i.e. the
+ * smallest skip for which data[skip+SAMPLES_PER_SEQ] is a restart marker,
+ * and decodes the sequence number that precedes it.
+ */
+restart_marker scanRestartMarker(const gr_complex *data, size_t nitems);
+restart_marker scanRestartMarker_sc16(const int16_t *data, size_t nitems);
+
+//Recovers the 32-bit sequence word the FPGA packs into one I/Q sample
+uint32_t decodeSequenceNum(gr_complex data);
+
+//Exact version for sc16 input, where the words arrive as raw 16-bit halves
+inline uint32_t decodeSequenceNum_sc16(const int16_t *data){
+	return (uint32_t)(uint16_t)data[0] + 65536*(uint32_t)(uint16_t)data[1];
+}
+
+} /* namespace fast_square */
+} /* namespace gr */
+
+#endif /* INCLUDED_FAST_SQUARE_MARKER_SCAN_H */
@@ -0,0 +1,20 @@
+#ifndef INCLUDED_FAST_SQUARE_MONOTONIC_CLOCK_H
+#define INCLUDED_FAST_SQUARE_MONOTONIC_CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+namespace gr {
+namespace fast_square {
+
+//Monotonic clock in ns (served from the vDSO, so no syscall on the hot path)
+inline uint64_t monotonicNs(){
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+} /* namespace fast_square */
+} /* namespace gr */
+
+#endif /* INCLUDED_FAST_SQUARE_MONOTONIC_CLOCK_H */
@@ -0,0 +1,99 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <fast_square/phasor_frame.h>
+#include <fast_square/defines.h>
+#include <algorithm>
+#include <stdexcept>
+
+namespace gr {
+namespace fast_square {
+
+void phasor_frame::release(){
+	d_pool->release(this);
+}
+
+phasor_frame_pool::phasor_frame_pool()
+	: d_allocated(0), d_limit(PHASOR_FRAME_LIMIT)
+{
+}
+
+phasor_frame_pool::~phasor_frame_pool(){
+	//Frames still in flight at exit are left to the OS
+	for(size_t ii=0; ii < d_free.size(); ii++)
+		delete d_free[ii];
+}
+
+phasor_frame_pool &phasor_frame_pool::instance(){
+	static phasor_frame_pool pool;
+	return pool;
+}
+
+phasor_frame *phasor_frame_pool::create(size_t num_phasors){
+	phasor_frame *frame = new phasor_frame;
+	frame->d_pool = this;
+	frame->d_pooled = false;
+	frame->phasors.reserve(num_phasors);
+	frame->harmonic_freqs.reserve(num_phasors);
+	d_frames.insert(frame);
+	d_allocated++;
+	return frame;
+}
+
+void phasor_frame_pool::reserve(size_t nframes, size_t num_phasors){
+	boost::mutex::scoped_lock lock(d_mutex);
+	for(size_t ii=0; ii < d_free.size(); ii++){
+		d_free[ii]->phasors.reserve(num_phasors);
+		d_free[ii]->harmonic_freqs.reserve(num_phasors);
+	}
+	d_limit = std::max(d_limit, nframes);
+	while(d_allocated < nframes){
+		phasor_frame *frame = create(num_phasors);
+		frame->d_pooled = true;
+		d_free.push_back(frame);
+	}
+}
+
+phasor_frame *phasor_frame_pool::acquire(){
+	boost::mutex::scoped_lock lock(d_mutex);
+	phasor_frame *frame;
+	if(!d_free.empty()){
+		frame = d_free.back();
+		d_free.pop_back();
+	} else if(d_allocated < d_limit){
+		frame = create(0);
+	} else {
+		return NULL;
+	}
+	frame->d_pooled = false;
+	frame->next = NULL;
+	return frame;
+}
+
+void phasor_frame_pool::release(phasor_frame *frame){
+	boost::mutex::scoped_lock lock(d_mutex);
+	//A second release would hand the same frame to two snapshots
+	if(frame->d_pooled)
+		throw std::runtime_error("phasor_frame_pool: frame released twice");
+	frame->d_pooled = true;
+	d_free.push_back(frame);
+}
+
+bool phasor_frame_pool::in_flight(const phasor_frame *frame){
+	boost::mutex::scoped_lock lock(d_mutex);
+	return d_frames.count(frame) && !frame->d_pooled;
+}
+
+size_t phasor_frame_pool::allocated(){
+	boost::mutex::scoped_lock lock(d_mutex);
+	return d_allocated;
+}
+
+size_t phasor_frame_pool::available(){
+	boost::mutex::scoped_lock lock(d_mutex);
+	return d_free.size();
+}
+
+} /* namespace fast_square */
+} /* namespace gr */
@@ -4,48 +4,134 @@
 #endif
 
 #include "prf_estimator_impl.h"
+#include "stage_timer.h"
+#include "stats_rpc.h"
 #include <gnuradio/io_signature.h>
 #include <volk/volk.h>
 #include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <iterator>
 #include <string>
 #include <fstream>
 
 namespace gr {
 namespace fast_square {
 
-prf_estimator::sptr prf_estimator::make(int prf_fft_size, bool forward, const std::vector<float> &window, bool shift, int nthreads, const std::string &tag_name){
+prf_estimator::sptr prf_estimator::make(int prf_fft_size, bool forward, const std::vector<float> &window, bool shift, int nthreads, const std::string &tag_name,
+		double coarse_precision, double fine_precision, int refine_depth, bool tracking, prf_backend backend, int anchor_mask, int max_tags){
 	return gnuradio::get_initial_sptr
-		(new prf_estimator_impl(prf_fft_size, forward, window, shift, nthreads, tag_name));
+		(new prf_estimator_impl(prf_fft_size, forward, window, shift, nthreads, tag_name, coarse_precision, fine_precision, refine_depth, tracking, backend, anchor_mask, max_tags));
 }
 
-prf_estimator_impl::prf_estimator_impl(int prf_fft_size, bool forward, const std::vector<float> &window, bool shift, int nthreads, const std::string &tag_name)
+prf_estimator_impl::prf_estimator_impl(int prf_fft_size, bool forward, const std::vector<float> &window, bool shift, int nthreads, const std::string &tag_name,
+		double coarse_precision, double fine_precision, int refine_depth, bool tracking, prf_backend backend, int anchor_mask, int max_tags)
 	: sync_block("prf_estimator",
-			io_signature::make(4, 4, POW2_CEIL(NUM_STEPS * FFT_SIZE) * sizeof(gr_complex)),
-			io_signature::make(4, 4, POW2_CEIL(NUM_STEPS * FFT_SIZE) * sizeof(gr_complex))),
-	d_fft_size(prf_fft_size), d_forward(forward), d_shift(shift)
+			io_signature::make(1, MAX_ANCHORS, SNAPSHOT_FRAME_SIZE),
+			io_signature::make(0, 0, 0)),
+	d_fft_size(prf_fft_size), d_forward(forward), d_shift(shift), d_tracking(tracking), d_max_tags(max_tags), d_next_tag_id(0),
+	d_backend(backend), d_anchor_mask(anchor_mask)
 {
-	d_fft = new fft::fft_complex(d_fft_size, forward, nthreads);
+	if(max_tags < 1 || max_tags > MAX_TAGS)
+		throw std::out_of_range("prf_estimator: max_tags must lie in 1..MAX_TAGS");
+	if(anchor_mask <= 0 || anchor_mask >= (1 << MAX_ANCHORS))
+		throw std::out_of_range("prf_estimator: anchor_mask must select between 1 and MAX_ANCHORS anchors");
+	for(int ii=0; ii < MAX_ANCHORS; ii++)
+		if(anchor_mask & (1 << ii))
+			d_anchors.push_back(ii);
+	d_anchor_floor.resize(d_anchors.size(), 0.0);
+	d_confidence.resize(d_anchors.back()+1, 0.0);
+	d_have_weights = false;
+
+	//All steps of every fused anchor are transformed by one batched plan
+	d_fft = new batched_fft(d_fft_size, NUM_STEPS*d_anchors.size(), forward, nthreads);
 	if(!set_window(window))
 		throw std::runtime_error("fft_vcc: window not the same length as fft_size\n");
 
-	d_abs_array = new float[d_fft_size*NUM_STEPS];
-	prfSearch_init();
+	d_abs_array = (float *)volk_malloc(sizeof(float)*spectrumSize(), volk_get_alignment());
+	d_anchor_abs = (float *)volk_malloc(sizeof(float)*spectrumSize()*d_anchors.size(), volk_get_alignment());
+	//Every tag that is still to be found needs a coarse peak to come from
+	d_search = new prf_search(d_fft_size, coarse_precision, fine_precision, refine_depth, std::max(PRF_TOP_K, 2*max_tags));
+	d_search_cost = 0;
+
+	//The Goertzel backend reads the same windowed, packed steps the FFT would transform
+	d_sparse = new sparse_dft(d_fft_size, forward);
+	if(!(!d_forward && d_shift))
+		d_sparse->set_length(std::min(FFT_SIZE, d_fft_size));
+	d_have_spectrum = false;
+	d_fft_cost_ns = 0;
+	d_bin_cost_ns = 0.0;
+	if(d_backend == PRF_BACKEND_AUTO)
+		calibrateBackends();
+
+	//A single tag is always reported, so it exists from the start
+	d_tags.reserve(max_tags);
+	d_lost_tags.reserve(max_tags);
+	d_floor_bins.reserve(2*NUM_STEPS*max_tags);
+	d_peak_bins.reserve(NUM_HARMONICS_PER_STEP*NUM_STEPS*max_tags);
+	d_tag_bins.reserve(NUM_HARMONICS_PER_STEP*NUM_STEPS*max_tags);
+	if(max_tags == 1){
+		prf_tag tag;
+		tag.id = d_next_tag_id++;
+		tag.state = PRF_ACQUIRE;
+		tag.prf = PRF;
+		tag.var = 0.0;
+		tag.misses = 0;
+		tag.lost = 0;
+		d_tags.push_back(tag);
+	}
 
 	d_counter = 0;
+	d_spectrum_ns = 0;
 
 	std::stringstream str;
 	str << name() << unique_id();
 	d_me = pmt::string_to_symbol(str.str());
 	d_key = pmt::string_to_symbol(tag_name);
+	d_state_key = pmt::string_to_symbol(tag_name + "_state");
+	d_var_key = pmt::string_to_symbol(tag_name + "_var");
+	d_top_key = pmt::string_to_symbol(tag_name + "_top");
+	d_conf_key = pmt::string_to_symbol(tag_name + "_conf");
+	d_tags_key = pmt::string_to_symbol(tag_name + "_tags");
+	d_prfs_key = pmt::string_to_symbol(tag_name + "_prfs");
+	d_offset_key = pmt::mp("offset");
+	d_seq_key = pmt::mp("seq");
+	d_start_key = pmt::mp("prf_start_ns");
+	d_done_key = pmt::mp("prf_done_ns");
+
+	//Estimates leave as messages so the snapshots themselves are never copied
+	message_port_register_out(pmt::mp("prf_out"));
 
 	const int alignment_multiple =
 		volk_get_alignment() / sizeof(float);
 	set_alignment(std::max(1,alignment_multiple));
 }
 
+void prf_estimator_impl::setup_rpc(){
+#ifdef GR_CTRLPORT
+	add_rpc_variable(statsRpcVariable(this, "stat_counters", &prf_estimator_impl::stat_counters,
+			"Hot-path counters, indexed by stat_counter"));
+	add_rpc_variable(statsRpcVariable(this, "latency_prf_fft", &prf_estimator_impl::stageHistogram<STAGE_PRF_FFT>,
+			"Windowing, FFT and magnitudes of one snapshot, log2 ns buckets"));
+	add_rpc_variable(statsRpcVariable(this, "latency_prf_search", &prf_estimator_impl::stageHistogram<STAGE_PRF_SEARCH>,
+			"PRF search and tracking of one snapshot, log2 ns buckets"));
+#endif
+}
+
 prf_estimator_impl::~prf_estimator_impl(){
 	delete d_fft;
-	delete d_abs_array;
+	delete d_search;
+	delete d_sparse;
+	volk_free(d_abs_array);
+	volk_free(d_anchor_abs);
+}
+
+bool prf_estimator_impl::check_topology(int ninputs, int noutputs){
+	//Input ii carries anchor ii, so every selected anchor needs its input connected
+	if(d_anchors.back() >= ninputs)
+		return false;
+	d_confidence.resize(ninputs, 0.0);
+	return true;
 }
 
 void prf_estimator_impl::set_nthreads(int n){
@@ -64,69 +150,322 @@ bool prf_estimator_impl::set_window(const std::vector<float> &window){
 	else return false;
 }
 
-void prf_estimator_impl::prfSearch_init(){
-
-	//Reset estimated freq and indexing arrays
-	cand_peaks.clear();
-	cand_freqs.clear();
-
-	//Initialize freq array
-	double cur_cand_freq = 1.0l*PRF*(1-PRF_ACCURACY);
-	while(cur_cand_freq <= 1.0l*PRF*(1+PRF_ACCURACY)){
-		cand_freqs.push_back(cur_cand_freq);
-		cur_cand_freq += 1.0l*PRF*COARSE_PRECISION;
-	}
-
-	//Initialize cand_peaks with appropriate indices based on each frequency
-	std::vector<int> cur_peak_array;
-	for(int ii=0; ii < cand_freqs.size(); ii++){
-		cur_peak_array.clear();
-		for(int jj=0; jj < NUM_STEPS; jj++){
-			float center_freq_harmonic_num = calculateCenterFreqHarmonicNum(jj);
-			for(float harmonic_num = -NUM_HARMONICS_PER_STEP/4+.5; harmonic_num <= NUM_HARMONICS_PER_STEP/4-.5; harmonic_num++){
-				double cur_peak_idx = 1.0l*d_fft_size*(
-						cand_freqs[ii]*harmonic_num+
-						(cand_freqs[ii]-PRF)*center_freq_harmonic_num-
-						TUNE_OFFSET
-					)/(SAMPLE_RATE/DECIM_FACTOR);
-				int cur_peak_idx_int = ((int)(round(cur_peak_idx)) % d_fft_size);
-				if(cur_peak_idx_int < 0) cur_peak_idx_int += d_fft_size;
-				cur_peak_idx_int += (jj*d_fft_size);
-				cur_peak_array.push_back(cur_peak_idx_int);
+void prf_estimator_impl::calibrateBackends(){
+	//The crossover depends on fft_size and on this host's FFTW and SIMD, so time both
+	//on the (still zeroed) batch buffer; best of a few runs keeps page faults and preemption out
+	std::vector<int> bins;
+	for(int jj=0; jj < NUM_STEPS; jj++)
+		for(int ii=0; ii < SPARSE_DFT_LANES; ii++)
+			bins.push_back(jj*d_fft_size + ii);
+	uint64_t sparse_ns = 0;
+	for(int trial=0; trial < 3; trial++){
+		uint64_t start = monotonicNs();
+		d_fft->execute();
+		volk_32fc_magnitude_32f(d_anchor_abs, d_fft->get_outbuf(), spectrumSize()*d_anchors.size());
+		uint64_t fft_ns = monotonicNs() - start;
+
+		start = monotonicNs();
+		d_sparse->magnitudes(d_fft->get_inbuf(), bins, d_abs_array);
+		uint64_t bins_ns = monotonicNs() - start;
+
+		if(trial == 0 || fft_ns < d_fft_cost_ns)
+			d_fft_cost_ns = fft_ns;
+		if(trial == 0 || bins_ns < sparse_ns)
+			sparse_ns = bins_ns;
+	}
+	d_bin_cost_ns = (double)sparse_ns/bins.size();
+}
+
+bool prf_estimator_impl::sparseCheaper(int nbins) const{
+	switch(d_backend){
+	case PRF_BACKEND_GOERTZEL:
+		return true;
+	case PRF_BACKEND_AUTO:
+		//Floor bins are computed alongside unless this snapshot already has its weights
+		if(!d_have_weights && floorLocked())
+			nbins += 2*NUM_STEPS;
+		return nbins*d_anchors.size()*d_bin_cost_ns < d_fft_cost_ns;
+	default:
+		return false;
+	}
+}
+
+bool prf_estimator_impl::floorLocked() const{
+	return !d_tags.empty() && d_tags[0].state == PRF_TRACK;
+}
+
+void prf_estimator_impl::computeWeights(const std::vector<int> &band){
+	//Each anchor is weighted by its own noise floor.  Once locked, the floor is read halfway between
+	//harmonics of the estimate.  Until then no PRF is trustworthy enough to place those bins off the
+	//tag's harmonics, so take the median of the searched band instead: the harmonics only fill a few
+	//bins of it.  band's magnitudes must already be in place for every anchor.
+	bool locked = floorLocked();
+	if(locked){
+		d_search->floorBins(d_tags[0].prf, d_floor_bins);
+		if(d_tags.size() > 1){
+			//Another tag's harmonics can land halfway between the first tag's, so read the floor
+			//between every tracked tag's harmonics and away from all of their peaks
+			d_peak_bins.clear();
+			for(int tt=0; tt < d_tags.size(); tt++){
+				if(tt > 0){
+					d_search->floorBins(d_tags[tt].prf, d_tag_bins);
+					d_floor_bins.insert(d_floor_bins.end(), d_tag_bins.begin(), d_tag_bins.end());
+				}
+				d_search->peakBins(d_tags[tt].prf, d_tag_bins);
+				d_peak_bins.insert(d_peak_bins.end(), d_tag_bins.begin(), d_tag_bins.end());
 			}
+			std::sort(d_floor_bins.begin(), d_floor_bins.end());
+			d_floor_bins.erase(std::unique(d_floor_bins.begin(), d_floor_bins.end()), d_floor_bins.end());
+			std::sort(d_peak_bins.begin(), d_peak_bins.end());
+			d_tag_bins.clear();
+			std::set_difference(d_floor_bins.begin(), d_floor_bins.end(), d_peak_bins.begin(), d_peak_bins.end(), std::back_inserter(d_tag_bins));
+			d_floor_bins.swap(d_tag_bins);
+		}
+	} else {
+		int stride = std::max(1, (int)band.size()/FLOOR_MEDIAN_BINS);
+		d_floor_bins.clear();
+		for(int ii=0; ii < band.size(); ii += stride)
+			d_floor_bins.push_back(band[ii]);
+	}
+	for(int ss=0; ss < d_anchors.size(); ss++){
+		float *spectrum = anchorSpectrum(ss);
+		d_floor_mags.clear();
+		if(locked && !d_have_spectrum)
+			d_sparse->magnitudes(d_fft->get_inbuf() + ss*spectrumSize(), d_floor_bins, spectrum);
+		for(int ii=0; ii < d_floor_bins.size(); ii++)
+			d_floor_mags.push_back(spectrum[d_floor_bins[ii]]);
+		if(d_floor_mags.empty()){
+			d_anchor_floor[ss] = 0.0;
+		} else if(locked){
+			float floor_sum = 0.0;
+			for(int ii=0; ii < d_floor_mags.size(); ii++)
+				floor_sum += d_floor_mags[ii];
+			d_anchor_floor[ss] = floor_sum/d_floor_mags.size();
+		} else {
+			std::nth_element(d_floor_mags.begin(), d_floor_mags.begin() + d_floor_mags.size()/2, d_floor_mags.end());
+			d_anchor_floor[ss] = d_floor_mags[d_floor_mags.size()/2];
 		}
-		cand_peaks.push_back(cur_peak_array);
 	}
+	d_have_weights = true;
+}
 
-	//Set anything past FFT_SIZE to zero
-	memset(d_fft->get_inbuf()+FFT_SIZE, 0, d_fft_size-FFT_SIZE);
+void prf_estimator_impl::fuseBins(const std::vector<int> &bins){
+	//Goertzel only: compute the requested bins of every anchor, then sum them floor-normalized
+	for(int ss=0; ss < d_anchors.size(); ss++)
+		d_sparse->magnitudes(d_fft->get_inbuf() + ss*spectrumSize(), bins, anchorSpectrum(ss));
+	if(!d_have_weights)
+		computeWeights(bins);
+	if(d_anchors.size() == 1)
+		return;
+	for(int ii=0; ii < bins.size(); ii++){
+		float sum = 0.0;
+		for(int ss=0; ss < d_anchors.size(); ss++)
+			if(d_anchor_floor[ss] > 0.0)
+				sum += d_anchor_abs[ss*spectrumSize() + bins[ii]]/d_anchor_floor[ss];
+		d_abs_array[bins[ii]] = sum;
+	}
+}
 
+void prf_estimator_impl::computeMagnitudes(double min_prf, double max_prf){
+	if(d_have_spectrum)
+		return;
+	uint64_t start_ns = stageStart();
+	if(d_backend != PRF_BACKEND_FFT || !floorLocked())
+		d_search->binsFor(min_prf, max_prf, d_bins);
+	if(d_backend != PRF_BACKEND_FFT && sparseCheaper(d_bins.size())){
+		//Only the bins a search over [min_prf, max_prf] can read
+		fuseBins(d_bins);
+	} else {
+		//Transform every step of every anchor at once, then take magnitudes in one pass
+		d_fft->execute();
+		volk_32fc_magnitude_32f(anchorSpectrum(0), d_fft->get_outbuf(), spectrumSize()*d_anchors.size());
+		d_have_spectrum = true;
+		computeWeights(d_bins);
+		if(d_anchors.size() > 1){
+			memset(d_abs_array, 0, sizeof(float)*spectrumSize());
+			for(int ss=0; ss < d_anchors.size(); ss++){
+				if(d_anchor_floor[ss] <= 0.0)
+					continue;
+				float *spectrum = anchorSpectrum(ss);
+				volk_32f_s32f_multiply_32f(spectrum, spectrum, 1.0/d_anchor_floor[ss], spectrumSize());
+				volk_32f_x2_add_32f(d_abs_array, d_abs_array, spectrum, spectrumSize());
+			}
+			//Anchor spectra are now floor-normalized, so their floors are 1
+			for(int ss=0; ss < d_anchors.size(); ss++)
+				if(d_anchor_floor[ss] > 0.0)
+					d_anchor_floor[ss] = 1.0;
+		}
+	}
+	d_spectrum_ns += stageElapsed(start_ns);
 }
 
-float prf_estimator_impl::calculateCenterFreqHarmonicNum(int step_num){
-	float ret;
-	if(USE_IMAGE)
-		ret = ((START_LO_FREQ-IF_FREQ+STEP_FREQ*step_num)/PRF);
-	else
-		ret = ((START_LO_FREQ+IF_FREQ+STEP_FREQ*step_num)/PRF);
-	return ret;
+float prf_estimator_impl::lockMetric(const prf_search_result &res){
+	//Peak sum of the winning candidate relative to the noise floor halfway between harmonics
+	d_search->floorBins(res.prf, d_bins);
+	if(!d_have_spectrum)
+		fuseBins(d_bins);
+	float floor_sum = 0.0;
+	for(int ii=0; ii < d_bins.size(); ii++)
+		floor_sum += d_abs_array[d_bins[ii]];
+	float avg_sum = floor_sum/d_bins.size()*d_search->harmonicsPerCandidate();
+	return (avg_sum > 0.0) ? res.score/avg_sum : 0.0;
 }
 
-double prf_estimator_impl::prfSearch_fast(float *data_fft_abs){
+void prf_estimator_impl::anchorConfidence(const prf_search_result &res){
+	//Same ratio as the lock metric, on each anchor's own spectrum; every bin it reads was covered by the search
+	for(int ss=0; ss < d_anchors.size(); ss++){
+		float avg_sum = d_anchor_floor[ss]*d_search->harmonicsPerCandidate();
+		d_confidence[d_anchors[ss]] = (avg_sum > 0.0) ? d_search->scoreAt(anchorSpectrum(ss), res.prf)/avg_sum : 0.0;
+	}
+}
 
-	float max_prf_sum = 0.0;
-	int max_prf_sum_idx = 0;
-	for(int ii=0; ii < cand_peaks.size(); ii++){
-		float cur_prf_sum = 0.0;
-		for(int jj=0; jj < cand_peaks[ii].size(); jj++)
-			cur_prf_sum += data_fft_abs[cand_peaks[ii][jj]];
-		if(cur_prf_sum > max_prf_sum){
-			max_prf_sum = cur_prf_sum;
-			max_prf_sum_idx = ii;
+bool prf_estimator_impl::trackTag(prf_tag &tag, bool primary){
+	//Predict, then search only the window the prediction leaves open
+	double meas_var = pow(TRACK_MEAS_NOISE*PRF, 2);
+	double pred_var = tag.var + pow(TRACK_PROCESS_NOISE*PRF, 2);
+	double half_width = TRACK_WINDOW_SIGMAS*sqrt(pred_var);
+	computeMagnitudes(tag.prf - half_width, tag.prf + half_width);
+	prf_search_result res = d_search->track(d_abs_array, tag.prf, half_width);
+	d_search_cost += res.cost;
+	if(primary)
+		anchorConfidence(res);
+
+	if(res.at_edge || lockMetric(res) < TRACK_LOCK_RATIO){
+		//Coast on the prediction and let the window widen
+		tag.var = pred_var;
+		tag.misses++;
+	} else {
+		double gain = pred_var/(pred_var + meas_var);
+		tag.prf += gain*(res.prf - tag.prf);
+		tag.var = (1.0 - gain)*pred_var;
+		tag.misses = 0;
+	}
+
+	if(tag.misses < TRACK_LOSS_COUNT)
+		return true;
+	tag.state = PRF_ACQUIRE;
+	d_stats.increment(COUNTER_PRF_LOSSES);
+	return false;
+}
+
+double prf_estimator_impl::estimatePrf(){
+	double meas_var = pow(TRACK_MEAS_NOISE*PRF, 2);
+	d_search_cost = 0;
+	d_top.clear();
+
+	prf_tag &tag = d_tags[0];
+	if(tag.state == PRF_TRACK && trackTag(tag, true))
+		return tag.prf;
+
+	//Acquisition: full search over the PRF accuracy window
+	computeMagnitudes(1.0l*PRF*(1-PRF_ACCURACY), 1.0l*PRF*(1+PRF_ACCURACY));
+	prf_search_result res = d_search->search(d_abs_array, 1.0l*PRF*(1-PRF_ACCURACY), 1.0l*PRF*(1+PRF_ACCURACY));
+	d_search_cost += res.cost;
+	d_top = res.top;
+	anchorConfidence(res);
+	if(d_tracking && lockMetric(res) >= TRACK_LOCK_RATIO){
+		d_stats.increment(COUNTER_PRF_LOCKS);
+		tag.state = PRF_TRACK;
+		tag.prf = res.prf;
+		tag.var = meas_var;
+		tag.misses = 0;
+	}
+	return res.prf;
+}
+
+void prf_estimator_impl::estimateTags(){
+	double meas_var = pow(TRACK_MEAS_NOISE*PRF, 2);
+	d_search_cost = 0;
+	d_top.clear();
+
+	//A lost tag keeps its id for TAG_EXPIRY snapshots, as long as the localizer remembers it
+	for(int ii=0; ii < d_lost_tags.size();){
+		if(++d_lost_tags[ii].lost > TAG_EXPIRY)
+			d_lost_tags.erase(d_lost_tags.begin()+ii);
+		else
+			ii++;
+	}
+
+	//Locked tags only need their own narrow windows of the shared spectrum
+	for(int ii=0; ii < d_tags.size();){
+		if(d_tags[ii].state == PRF_TRACK && trackTag(d_tags[ii], ii == 0)){
+			ii++;
+			continue;
 		}
+		if(d_lost_tags.size() == d_max_tags)
+			d_lost_tags.erase(d_lost_tags.begin());
+		d_lost_tags.push_back(d_tags[ii]);
+		d_lost_tags.back().lost = 0;
+		d_tags.erase(d_tags.begin()+ii);
 	}
+	if(d_tags.size() == d_max_tags)
+		return;
+
+	//One full search finds the remaining tags among its strongest coarse peaks
+	computeMagnitudes(1.0l*PRF*(1-PRF_ACCURACY), 1.0l*PRF*(1+PRF_ACCURACY));
+	prf_search_result res = d_search->search(d_abs_array, 1.0l*PRF*(1-PRF_ACCURACY), 1.0l*PRF*(1+PRF_ACCURACY));
+	d_search_cost += res.cost;
+	d_top = res.top;
+
+	double min_sep = TAG_MIN_SEPARATION*PRF;
+	for(int ii=-1; ii < (int)d_top.size() && d_tags.size() < d_max_tags; ii++){
+		//The best peak comes refined from the search; the others are refined around their coarse PRF
+		prf_search_result cand = res;
+		if(ii >= 0){
+			cand = d_search->track(d_abs_array, d_top[ii].prf, d_search->coarse_precision()*PRF);
+			d_search_cost += cand.cost;
+		}
+		if(lockMetric(cand) < TRACK_LOCK_RATIO)
+			continue;
+		bool taken = false;
+		for(int jj=0; jj < d_tags.size() && !taken; jj++)
+			taken = fabs(d_tags[jj].prf - cand.prf) < min_sep;
+		if(taken)
+			continue;
+
+		prf_tag tag;
+		tag.id = -1;
+		for(int jj=0; jj < d_lost_tags.size() && tag.id < 0; jj++){
+			if(fabs(d_lost_tags[jj].prf - cand.prf) < min_sep){
+				tag.id = d_lost_tags[jj].id;
+				d_lost_tags.erase(d_lost_tags.begin()+jj);
+			}
+		}
+		if(tag.id < 0)
+			tag.id = d_next_tag_id++;
+		tag.state = d_tracking ? PRF_TRACK : PRF_ACQUIRE;
+		tag.prf = cand.prf;
+		tag.var = meas_var;
+		tag.misses = 0;
+		tag.lost = 0;
+		d_tags.push_back(tag);
+		if(tag.state == PRF_TRACK)
+			d_stats.increment(COUNTER_PRF_LOCKS);
+		if(d_tags.size() == 1)
+			anchorConfidence(cand);
+	}
+}
 
-	return cand_freqs[max_prf_sum_idx];
+void prf_estimator_impl::packSteps(const gr_complex *snapshot, gr_complex *batch){
+	//Only the first FFT_SIZE samples of each transform carry data; the rest stays zero from construction
+	int nvalid = std::min(FFT_SIZE, d_fft_size);
+	int offset = (!d_forward && d_shift) ? (d_fft_size/2) : 0;
+	for(int ii=0; ii < NUM_STEPS; ii++){
+		const gr_complex *in = snapshot + ii*FFT_SIZE;
+		gr_complex *dst = batch + ii*d_fft_size;
+		if(offset == 0){
+			if(d_window.size())
+				volk_32fc_32f_multiply_32fc(dst, in, &d_window[0], nvalid);
+			else
+				memcpy(dst, in, nvalid*sizeof(gr_complex));
+		} else {
+			//Apply an ifft shift on the way in: sample jj lands at (jj-offset) mod fft_size
+			for(int jj=0; jj < nvalid; jj++){
+				int dst_idx = (jj < offset) ? (jj + d_fft_size - offset) : (jj - offset);
+				dst[dst_idx] = d_window.size() ? in[jj]*d_window[jj] : in[jj];
+			}
+		}
+	}
 }
 
 int prf_estimator_impl::work(int noutput_items,
@@ -134,87 +473,85 @@ int prf_estimator_impl::work(int noutput_items,
 		gr_vector_void_star &output_items){
 
 
-	signed int input_data_size = FFT_SIZE*sizeof(gr_complex);
-	signed int input_data_size_padded = input_signature()->sizeof_stream_item(0)/sizeof(gr_complex);
-	signed int output_data_size = output_signature()->sizeof_stream_item(0);
-
 	int count = 0;
-	uint64_t abs_out_sample_cnt = nitems_written(0);
+	uint64_t abs_in_sample_cnt = nitems_read(0);
 
 	//PRF estimation logic
 	while(count < noutput_items) {
-		for(int ii = 0; ii < NUM_STEPS; ii++){
-			gr_complex *in = ((gr_complex *) input_items[PRF_EST_ANCHOR]) + ii*FFT_SIZE + count*input_data_size_padded;
-			// copy input into optimally aligned buffer
-			if(d_window.size()) {
-				gr_complex *dst = d_fft->get_inbuf();
-				if(!d_forward && d_shift) {
-					unsigned int offset = (!d_forward && d_shift)?(d_fft_size/2):0;
-					int fft_m_offset = d_fft_size - offset;
-					for(unsigned int i = 0; i < offset; i++)		// apply window
-						dst[i+fft_m_offset] = in[i] * d_window[i];
-					for(unsigned int i = offset; i < d_fft_size; i++)	// apply window
-						dst[i-offset] = in[i] * d_window[i];
-				} 
-				else {
-					for(unsigned int i = 0; i < d_fft_size; i++)		// apply window
-						dst[i] = in[i] * d_window[i];
-				}
-			}
-			else {
-				if(!d_forward && d_shift) {  // apply an ifft shift on the data
-					gr_complex *dst = d_fft->get_inbuf();
-					unsigned int len = (unsigned int)(floor(d_fft_size/2.0)); // half length of complex array
-					memcpy(&dst[0], &in[len], sizeof(gr_complex)*(d_fft_size - len));
-					memcpy(&dst[d_fft_size - len], &in[0], sizeof(gr_complex)*len);
-				}
-				else {
-					memcpy(d_fft->get_inbuf(), in, input_data_size);
-				}
-			}
-
-			// compute the fft
-			d_fft->execute();
+		const void *frame = snapshotFrame(input_items[d_anchors[0]], count);
+		uint64_t start_ns = monotonicNs();
+
+		//Window every step of every fused anchor into the batch buffer; magnitudes are computed on demand by the search
+		uint64_t pack_start = stageStart();
+		for(int ss=0; ss < d_anchors.size(); ss++)
+			packSteps(snapshotData(snapshotFrame(input_items[d_anchors[ss]], count)), d_fft->get_inbuf() + ss*spectrumSize());
+		d_have_spectrum = false;
+		d_have_weights = false;
+		uint64_t pack_ns = stageElapsed(pack_start);
+		d_spectrum_ns = 0;
+		uint64_t search_start = stageStart();
 
-			//if(d_counter == 9){
-			//std::cout << "start" << std::endl;
-			//for(int jj=0; jj < d_fft_size; jj++)
-			//	std::cout << d_fft->get_inbuf()[jj].real() << " " << in[jj] << " " << d_fft->get_outbuf()[jj].real() << " " << d_fft->get_outbuf()[jj].imag() << std::endl;
-			//}
-			// turned out to be faster than aligned/unaligned switching
-			volk_32fc_magnitude_32f_u(&d_abs_array[ii*d_fft_size], d_fft->get_outbuf(), d_fft_size);
+		//Perform PRF estimation
+		double prf_est;
+		if(d_max_tags == 1){
+			prf_est = estimatePrf();
+		} else {
+			estimateTags();
+			prf_est = d_tags.empty() ? PRF : d_tags[0].prf;
+		}
+		bool locked = !d_tags.empty() && d_tags[0].state == PRF_TRACK;
 
+		//Spectra are computed lazily inside the search, so their time is taken back out of it
+		if(search_start){
+			d_stats.record(STAGE_PRF_FFT, pack_ns + d_spectrum_ns);
+			d_stats.record(STAGE_PRF_SEARCH, stageElapsed(search_start) - d_spectrum_ns);
+		}
+		int num_locked = 0;
+		for(int ii=0; ii < d_tags.size(); ii++)
+			num_locked += (d_tags[ii].state == PRF_TRACK);
+		d_stats.set(COUNTER_PRF_LOCKED, num_locked);
+		d_stats.increment(COUNTER_SNAPSHOTS);
+
+		//Every stream_parser output advances in lockstep, so the item offset names the same
+		//snapshot on the streams harmonic_extractor reads
+		pmt::pmt_t msg = pmt::make_dict();
+		msg = pmt::dict_add(msg, d_offset_key, pmt::from_uint64(abs_in_sample_cnt + count));
+		msg = pmt::dict_add(msg, d_seq_key, pmt::from_long(snapshotHeader(frame)->sequence_num));
+		msg = pmt::dict_add(msg, d_key, pmt::from_double(prf_est));
+		msg = pmt::dict_add(msg, d_state_key, pmt::intern(locked ? "track" : "acquire"));
+		msg = pmt::dict_add(msg, d_var_key,
+			pmt::from_double(locked ? d_tags[0].var : pow(d_search->coarse_precision()*PRF, 2)));
+
+		//Every tag of the snapshot; a single tag reports the same PRF as tag_name
+		std::vector<int> tag_ids;
+		std::vector<double> tag_prfs;
+		for(int ii=0; ii < d_tags.size(); ii++){
+			tag_ids.push_back(d_tags[ii].id);
+			tag_prfs.push_back((d_max_tags == 1) ? prf_est : d_tags[ii].prf);
+		}
+		msg = pmt::dict_add(msg, d_tags_key, pmt::init_s32vector(tag_ids.size(), tag_ids));
+		msg = pmt::dict_add(msg, d_prfs_key, pmt::init_f64vector(tag_prfs.size(), tag_prfs));
+		if(!d_top.empty()){
+			//Runner-up peaks make ambiguous acquisitions visible downstream
+			std::vector<double> top;
+			for(int ii=0; ii < d_top.size(); ii++){
+				top.push_back(d_top[ii].prf);
+				top.push_back(d_top[ii].score);
+			}
+			msg = pmt::dict_add(msg, d_top_key, pmt::init_f64vector(top.size(), &top[0]));
 		}
-		////DEBUG
-		//std::cout << "abs start" << std::endl;
-		//for(int jj=0; jj < d_fft_size*NUM_STEPS; jj++){
-		//	std::cout << d_abs_array[jj] << std::endl;
-		//}
+		std::vector<double> conf(d_confidence.begin(), d_confidence.end());
+		msg = pmt::dict_add(msg, d_conf_key, pmt::init_f64vector(conf.size(), &conf[0]));
 
-		//Perform PRF estimation
-		double prf_est = prfSearch_fast(d_abs_array);
-
-		//std::cout << "lowest freq = " << cand_freqs[0] << " highest freq = " << cand_freqs[cand_freqs.size()-1] << " prf_est = " << prf_est << std::endl;
-	
-		//Attach tag to the data stream with the derived PRF estimate
-		add_item_tag(0, //stream ID
-			abs_out_sample_cnt + count, //sample
-			d_key,      //frame info
-			pmt::from_double(prf_est), //data (unused)
-			d_me        //block src id
-			);
+		//harmonic_extractor copies these into the snapshot's trace
+		msg = pmt::dict_add(msg, d_start_key, pmt::from_uint64(start_ns));
+		msg = pmt::dict_add(msg, d_done_key, pmt::from_uint64(monotonicNs()));
+		message_port_pub(pmt::mp("prf_out"), msg);
 
 		d_counter++;
 		count++;
 	}
 
-	//Copy in to out since that's how you have to do things in GNU Radio...
-	for(int ii=0; ii < output_items.size(); ii++){
-		gr_complex *in = (gr_complex *) input_items[ii];
-		gr_complex *out = (gr_complex *) output_items[ii];
-
-		memcpy(out, in, output_data_size*noutput_items);
-	}
 
 	return noutput_items;
 }
@@ -4,8 +4,11 @@
 
 #include <fast_square/prf_estimator.h>
 #include <fast_square/defines.h>
-#include <gnuradio/fft/fft.h>
-#include <queue>
+#include <fast_square/snapshot_frame.h>
+#include <fast_square/block_stats.h>
+#include "batched_fft.h"
+#include "prf_search.h"
+#include "sparse_dft.h"
 
 namespace gr {
 namespace fast_square {
@@ -14,33 +17,93 @@ class prf_estimator_impl : public prf_estimator
 {
 private:
 	int d_fft_size;
-	fft::fft_complex *d_fft;
+	batched_fft *d_fft;
 	bool d_forward;
 	bool d_shift;
 	int d_counter;
 	std::vector<float> d_window;
-	void inSequenceMsg(pmt::pmt_t msg);
-	std::queue<std::vector<std::vector<gr_complex> > > d_message_queue;
 	float *d_abs_array;
 
-	pmt::pmt_t d_key, d_me;
+	pmt::pmt_t d_key, d_state_key, d_var_key, d_top_key, d_conf_key, d_tags_key, d_prfs_key, d_offset_key, d_seq_key, d_start_key, d_done_key, d_me;
 
-	std::vector<double> cand_freqs;
-	std::vector<std::vector<int> > cand_peaks;
+	//Anchors whose spectra are fused into the search; slot ii of the batch holds input d_anchors[ii]
+	int d_anchor_mask;
+	std::vector<int> d_anchors;
+	float *d_anchor_abs;
+	std::vector<float> d_anchor_floor;  //Mean floor-bin magnitude of each fused anchor
+	std::vector<float> d_confidence;    //Per input anchor, 0 for anchors left out of the fusion
+	std::vector<int> d_floor_bins;
+	std::vector<int> d_peak_bins, d_tag_bins; //Scratch for keeping other tags' harmonics out of the floor
+	std::vector<float> d_floor_mags;
+	bool d_have_weights;
 
-	void prfSearch_init();
-	double prfSearch_fast(float *data_fft_abs);
-	float calculateCenterFreqHarmonicNum(int step_num);
+	prf_search *d_search;
+	int d_search_cost;
+
+	prf_backend d_backend;
+	sparse_dft *d_sparse;
+	bool d_have_spectrum;  //The full FFT spectrum of this snapshot is in place; before that, bins come from Goertzel
+	std::vector<int> d_bins;
+	uint64_t d_fft_cost_ns; //PRF_BACKEND_AUTO: measured batched FFT + magnitudes of one snapshot
+	double d_bin_cost_ns;   //PRF_BACKEND_AUTO: measured Goertzel cost of one bin of one anchor
+
+	enum track_state {PRF_ACQUIRE, PRF_TRACK};
+	struct prf_tag
+	{
+		int id;
+		track_state state;
+		double prf;   //Filtered estimate
+		double var;   //Its variance (Hz^2)
+		int misses;   //Consecutive snapshots without a usable peak
+		int lost;     //Snapshots since it was lost, while in d_lost_tags
+	};
+	bool d_tracking;
+	int d_max_tags;
+	int d_next_tag_id;
+	std::vector<prf_tag> d_tags;      //Tags reported for this snapshot; the single tag always stays when d_max_tags is 1
+	std::vector<prf_tag> d_lost_tags; //Lost within TAG_EXPIRY snapshots, oldest first; a tag found near one takes its id back
+	std::vector<prf_candidate> d_top; //Peaks of this snapshot's full search, empty while tracking
+
+	block_stats d_stats;
+	uint64_t d_spectrum_ns; //Time the current snapshot spent on spectra, split out of the search time
+
+	int spectrumSize() const { return d_fft_size*NUM_STEPS; }
+	float *anchorSpectrum(int slot) { return (d_anchors.size() == 1) ? d_abs_array : d_anchor_abs + slot*spectrumSize(); }
+	void calibrateBackends();
+	bool sparseCheaper(int nbins) const;
+	bool floorLocked() const;
+	void computeWeights(const std::vector<int> &band);
+	void fuseBins(const std::vector<int> &bins);
+	void computeMagnitudes(double min_prf, double max_prf);
+	float lockMetric(const prf_search_result &res);
+	void anchorConfidence(const prf_search_result &res);
+	bool trackTag(prf_tag &tag, bool primary);
+	double estimatePrf();
+	void estimateTags();
+
+	void packSteps(const gr_complex *snapshot, gr_complex *dst);
 	
 protected:
 
 public:
-	prf_estimator_impl(int fft_size, bool forward, const std::vector<float> &window, bool shift, int nthreads, const std::string &tag_name);
+	prf_estimator_impl(int fft_size, bool forward, const std::vector<float> &window, bool shift, int nthreads, const std::string &tag_name,
+			double coarse_precision, double fine_precision, int refine_depth, bool tracking, prf_backend backend, int anchor_mask, int max_tags);
 	~prf_estimator_impl();
 
 	void set_nthreads(int n);
 	int nthreads() const;
 	bool set_window(const std::vector<float> &window);
+	int search_cost() const { return d_search_cost; }
+	bool is_tracking() const { return !d_tags.empty() && d_tags[0].state == PRF_TRACK; }
+	int num_tags() const { return d_tags.size(); }
+	std::vector<float> anchor_confidence() const { return d_confidence; }
+
+	std::vector<int> stage_histogram(int stage) const { return d_stats.histogram(stage); }
+	std::vector<int> stat_counters() const { return d_stats.counters(); }
+	template<int STAGE> std::vector<int> stageHistogram() const { return d_stats.histogram(STAGE); }
+	void setup_rpc();
+
+	bool check_topology(int ninputs, int noutputs);
   
 	int work(int noutput_items,
 			gr_vector_const_void_star &input_items,
@@ -0,0 +1,342 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "prf_search.h"
+#include "gather_sum.h"
+#include <volk/volk.h>
+#include <gnuradio/gr_complex.h>
+#include <fast_square/defines.h>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+namespace gr {
+namespace fast_square {
+
+float calculateCenterFreqHarmonicNum(int step_num){
+	float ret;
+	if(USE_IMAGE)
+		ret = ((START_LO_FREQ-IF_FREQ+STEP_FREQ*step_num)/PRF);
+	else
+		ret = ((START_LO_FREQ+IF_FREQ+STEP_FREQ*step_num)/PRF);
+	return ret;
+}
+
+prf_search::prf_search(int fft_size, double coarse_precision, double fine_precision, int refine_depth, int top_k)
+	: d_fft_size(fft_size), d_coarse_precision(coarse_precision), d_refine_factor(1), d_refine_depth(refine_depth), d_top_k(top_k)
+{
+	if(coarse_precision <= 0.0 || refine_depth < 0)
+		throw std::out_of_range("prf_search: invalid search granularity");
+
+	//Pick the integer shrink factor that reaches fine_precision after refine_depth levels
+	if(d_refine_depth > 0){
+		if(fine_precision <= 0.0 || fine_precision >= coarse_precision)
+			throw std::out_of_range("prf_search: fine precision must be positive and below the coarse precision");
+		d_refine_factor = std::max(2, (int)round(pow(coarse_precision/fine_precision, 1.0/d_refine_depth)));
+	}
+
+	for(int ii=0; ii < NUM_STEPS; ii++)
+		d_center_harmonic_nums.push_back(calculateCenterFreqHarmonicNum(ii));
+	d_tables.resize(d_refine_depth+1);
+
+	//Build the coarse grid over the full accuracy window up front, rows padded to 64 bytes
+	d_coarse_k0 = (int)ceil(-PRF_ACCURACY/d_coarse_precision - 1e-6);
+	d_coarse_rows = (int)floor(PRF_ACCURACY/d_coarse_precision + 1e-6) - d_coarse_k0 + 1;
+	d_coarse_stride = (harmonicsPerCandidate() + 15) & ~15;
+	d_coarse_table = (int32_t *)volk_malloc(sizeof(int32_t)*d_coarse_stride*d_coarse_rows, 64);
+	for(int rr=0; rr < d_coarse_rows; rr++){
+		int32_t *row = d_coarse_table + rr*d_coarse_stride;
+		coarseBins(d_coarse_k0 + rr, row);
+		for(int ii=harmonicsPerCandidate(); ii < d_coarse_stride; ii++)
+			row[ii] = 0;
+	}
+}
+
+prf_search::~prf_search(){
+	volk_free(d_coarse_table);
+}
+
+double prf_search::levelStep(int level) const{
+	return d_coarse_precision/pow((double)d_refine_factor, level);
+}
+
+double prf_search::candidateFreq(int level, int k) const{
+	return 1.0l*PRF*(1.0l + k*levelStep(level));
+}
+
+double prf_search::peakIdx(double cand_freq, int step_num, float harmonic_num) const{
+	return 1.0l*d_fft_size*(
+			cand_freq*harmonic_num+
+			(cand_freq-PRF)*d_center_harmonic_nums[step_num]-
+			TUNE_OFFSET
+		)/(SAMPLE_RATE/DECIM_FACTOR);
+}
+
+int prf_search::wrapBin(int bin) const{
+	bin %= d_fft_size;
+	return (bin < 0) ? bin + d_fft_size : bin;
+}
+
+void prf_search::coarseBins(int k, int32_t *bins) const{
+	//Level 0 scores on the nearest bin of every harmonic
+	double cand_freq = candidateFreq(0, k);
+	for(int jj=0; jj < NUM_STEPS; jj++)
+		for(float harmonic_num = -NUM_HARMONICS_PER_STEP/4+.5; harmonic_num <= NUM_HARMONICS_PER_STEP/4-.5; harmonic_num++)
+			*bins++ = wrapBin((int)round(peakIdx(cand_freq, jj, harmonic_num))) + jj*d_fft_size;
+}
+
+const prf_search::peak_table &prf_search::peakTable(int level, int k){
+	std::map<int, peak_table> &tables = d_tables[level];
+	std::map<int, peak_table>::iterator it = tables.find(k);
+	if(it != tables.end())
+		return it->second;
+
+	//Keep the lazily built tables bounded if the search wanders around a lot
+	if(tables.size() >= PRF_TABLE_CACHE_MAX)
+		tables.clear();
+
+	peak_table &table = tables[k];
+	if(level == 0){
+		std::vector<int32_t> bins(harmonicsPerCandidate());
+		coarseBins(k, &bins[0]);
+		table.idxs.assign(bins.begin(), bins.end());
+		return table;
+	}
+
+	//Refinement levels interpolate between the two surrounding bins
+	double cand_freq = candidateFreq(level, k);
+	for(int jj=0; jj < NUM_STEPS; jj++){
+		for(float harmonic_num = -NUM_HARMONICS_PER_STEP/4+.5; harmonic_num <= NUM_HARMONICS_PER_STEP/4-.5; harmonic_num++){
+			double cur_peak_idx = peakIdx(cand_freq, jj, harmonic_num);
+			double lower = floor(cur_peak_idx);
+			int lower_int = wrapBin((int)lower);
+			int upper_int = wrapBin(lower_int + 1);
+			table.idxs.push_back(lower_int + jj*d_fft_size);
+			table.idxs.push_back(upper_int + jj*d_fft_size);
+			table.fracs.push_back((float)(cur_peak_idx - lower));
+		}
+	}
+	return table;
+}
+
+void prf_search::binsFor(double min_prf, double max_prf, std::vector<int> &bins) const{
+	//Peak positions are linear in the candidate PRF, so each harmonic sweeps one contiguous run of bins
+	std::vector<bool> used(d_fft_size*NUM_STEPS, false);
+	for(int jj=0; jj < NUM_STEPS; jj++){
+		for(float harmonic_num = -NUM_HARMONICS_PER_STEP/4+.5; harmonic_num <= NUM_HARMONICS_PER_STEP/4-.5; harmonic_num++){
+			double idx_a = peakIdx(min_prf, jj, harmonic_num);
+			double idx_b = peakIdx(max_prf, jj, harmonic_num);
+			int lo = (int)floor(std::min(idx_a, idx_b));
+			int hi = (int)ceil(std::max(idx_a, idx_b));
+			if(hi - lo >= d_fft_size) hi = lo + d_fft_size - 1;
+			for(int bin=lo; bin <= hi; bin++)
+				used[wrapBin(bin) + jj*d_fft_size] = true;
+		}
+	}
+
+	bins.clear();
+	for(int ii=0; ii < used.size(); ii++)
+		if(used[ii]) bins.push_back(ii);
+}
+
+void prf_search::floorBins(double prf, std::vector<int> &bins) const{
+	bins.clear();
+	for(int jj=0; jj < NUM_STEPS; jj++){
+		bins.push_back(wrapBin((int)round(peakIdx(prf, jj, -1.0))) + jj*d_fft_size);
+		bins.push_back(wrapBin((int)round(peakIdx(prf, jj, 1.0))) + jj*d_fft_size);
+	}
+}
+
+void prf_search::peakBins(double prf, std::vector<int> &bins) const{
+	bins.clear();
+	for(int jj=0; jj < NUM_STEPS; jj++){
+		for(float harmonic_num = -NUM_HARMONICS_PER_STEP/4+.5; harmonic_num <= NUM_HARMONICS_PER_STEP/4-.5; harmonic_num++){
+			double idx = peakIdx(prf, jj, harmonic_num);
+			bins.push_back(wrapBin((int)floor(idx)) + jj*d_fft_size);
+			bins.push_back(wrapBin((int)ceil(idx)) + jj*d_fft_size);
+		}
+	}
+}
+
+float prf_search::score(const float *data_fft_abs, int level, int k, int &cost){
+	if(level == 0 && k >= d_coarse_k0 && k < d_coarse_k0 + d_coarse_rows){
+		float sum;
+		gatherSum(data_fft_abs, d_coarse_table + (k - d_coarse_k0)*d_coarse_stride, d_coarse_stride, harmonicsPerCandidate(), 1, &sum);
+		cost += harmonicsPerCandidate();
+		return sum;
+	}
+
+	const peak_table &table = peakTable(level, k);
+	float cur_prf_sum = 0.0;
+	if(table.fracs.empty()){
+		for(int jj=0; jj < table.idxs.size(); jj++)
+			cur_prf_sum += data_fft_abs[table.idxs[jj]];
+	} else {
+		for(int jj=0; jj < table.fracs.size(); jj++){
+			float lower = data_fft_abs[table.idxs[2*jj]];
+			float upper = data_fft_abs[table.idxs[2*jj+1]];
+			cur_prf_sum += lower + table.fracs[jj]*(upper - lower);
+		}
+	}
+	cost += table.idxs.size();
+	return cur_prf_sum;
+}
+
+float prf_search::scoreAt(const float *data_fft_abs, double prf) const{
+	float sum = 0.0;
+	for(int jj=0; jj < NUM_STEPS; jj++){
+		for(float harmonic_num = -NUM_HARMONICS_PER_STEP/4+.5; harmonic_num <= NUM_HARMONICS_PER_STEP/4-.5; harmonic_num++){
+			double cur_peak_idx = peakIdx(prf, jj, harmonic_num);
+			double lower = floor(cur_peak_idx);
+			int lower_int = wrapBin((int)lower);
+			float lo = data_fft_abs[lower_int + jj*d_fft_size];
+			float up = data_fft_abs[wrapBin(lower_int + 1) + jj*d_fft_size];
+			sum += lo + (float)(cur_peak_idx - lower)*(up - lo);
+		}
+	}
+	return sum;
+}
+
+prf_search_result prf_search::search(const float *data_fft_abs, double min_prf, double max_prf){
+	prf_search_result res;
+	res.cost = 0;
+	res.at_edge = false;
+
+	//Coarse pass over the whole requested range
+	int k_min = (int)ceil((min_prf/PRF - 1.0)/levelStep(0) - 1e-6);
+	int k_max = (int)floor((max_prf/PRF - 1.0)/levelStep(0) + 1e-6);
+	if(k_max < k_min)
+		k_max = k_min = (int)round((0.5*(min_prf+max_prf)/PRF - 1.0)/levelStep(0));
+
+	//Candidates inside the flat table go through the gather kernel in one pass
+	d_scores.resize(k_max - k_min + 1);
+	int flat_lo = std::max(k_min, d_coarse_k0);
+	int flat_hi = std::min(k_max, d_coarse_k0 + d_coarse_rows - 1);
+	if(flat_lo <= flat_hi){
+		gatherSum(data_fft_abs, d_coarse_table + (flat_lo - d_coarse_k0)*d_coarse_stride, d_coarse_stride,
+			harmonicsPerCandidate(), flat_hi - flat_lo + 1, &d_scores[flat_lo - k_min]);
+		res.cost += (flat_hi - flat_lo + 1)*harmonicsPerCandidate();
+	}
+	for(int kk=k_min; kk <= k_max; kk++)
+		if(kk < flat_lo || kk > flat_hi)
+			d_scores[kk - k_min] = score(data_fft_abs, 0, kk, res.cost);
+
+	float max_prf_sum = 0.0;
+	int best_k = k_min;
+	for(int kk=k_min; kk <= k_max; kk++){
+		if(d_scores[kk - k_min] > max_prf_sum){
+			max_prf_sum = d_scores[kk - k_min];
+			best_k = kk;
+		}
+	}
+	topPeaks(k_min, res.top);
+
+	//Refine +/- one parent step around the best candidate at each finer level
+	for(int level=1; level <= d_refine_depth; level++){
+		int center_k = best_k*d_refine_factor;
+		int lo_k = std::max(center_k - d_refine_factor, k_min*(int)pow((double)d_refine_factor, level));
+		int hi_k = std::min(center_k + d_refine_factor, k_max*(int)pow((double)d_refine_factor, level));
+		max_prf_sum = 0.0;
+		best_k = center_k;
+		for(int kk=lo_k; kk <= hi_k; kk++){
+			float cur_prf_sum = score(data_fft_abs, level, kk, res.cost);
+			if(cur_prf_sum > max_prf_sum){
+				max_prf_sum = cur_prf_sum;
+				best_k = kk;
+			}
+		}
+	}
+
+	res.prf = candidateFreq(d_refine_depth, best_k);
+	res.score = max_prf_sum;
+	return res;
+}
+
+static bool candidateGreater(const prf_candidate &a, const prf_candidate &b){
+	return a.score > b.score;
+}
+
+void prf_search::topPeaks(int k_min, std::vector<prf_candidate> &top) const{
+	//Local maxima of the coarse scan, so that one broad peak does not fill every slot
+	top.clear();
+	int num = d_scores.size();
+	for(int ii=0; ii < num; ii++){
+		if((ii > 0 && d_scores[ii-1] > d_scores[ii]) || (ii < num-1 && d_scores[ii+1] >= d_scores[ii]))
+			continue;
+		prf_candidate cand;
+		cand.prf = candidateFreq(0, k_min + ii);
+		cand.score = d_scores[ii];
+		top.push_back(cand);
+	}
+	int keep = std::min((int)top.size(), d_top_k);
+	std::partial_sort(top.begin(), top.begin() + keep, top.end(), candidateGreater);
+	top.resize(keep);
+}
+
+int prf_search::climb(const float *data_fft_abs, int level, int start_k, int k_lo, int k_hi, float &best_score, int &cost, bool &at_edge){
+	int best_k = std::min(std::max(start_k, k_lo), k_hi);
+	best_score = score(data_fft_abs, level, best_k, cost);
+
+	//Pick the uphill direction, then keep walking while the score improves
+	int dir = 0;
+	float next_score = 0.0;
+	if(best_k < k_hi && (next_score = score(data_fft_abs, level, best_k+1, cost)) > best_score)
+		dir = 1;
+	else if(best_k > k_lo && (next_score = score(data_fft_abs, level, best_k-1, cost)) > best_score)
+		dir = -1;
+	while(dir != 0){
+		best_k += dir;
+		best_score = next_score;
+		if(best_k + dir < k_lo || best_k + dir > k_hi){
+			at_edge = true;
+			break;
+		}
+		next_score = score(data_fft_abs, level, best_k + dir, cost);
+		if(next_score <= best_score)
+			break;
+	}
+	return best_k;
+}
+
+prf_search_result prf_search::track(const float *data_fft_abs, double center_prf, double half_width){
+	prf_search_result res;
+	res.cost = 0;
+	res.at_edge = false;
+
+	//Coarsest level that still covers the window in a handful of steps
+	int start_level = d_refine_depth;
+	while(start_level > 0 && levelStep(start_level)*PRF*4 < half_width)
+		start_level--;
+
+	double center_rel = center_prf/PRF - 1.0;
+	double width_rel = half_width/PRF;
+	int best_k = 0;
+	float best_score = 0.0;
+	for(int level=start_level; level <= d_refine_depth; level++){
+		double step = levelStep(level);
+		int win_lo = (int)ceil((center_rel - width_rel)/step);
+		int win_hi = (int)floor((center_rel + width_rel)/step);
+		int k_lo = win_lo, k_hi = win_hi;
+		int start_k = (int)round(center_rel/step);
+		if(level > start_level){
+			//Child peak lies within one parent step of the parent peak
+			start_k = best_k*d_refine_factor;
+			k_lo = std::max(k_lo, start_k - d_refine_factor);
+			k_hi = std::min(k_hi, start_k + d_refine_factor);
+		}
+		if(k_hi < k_lo)
+			k_hi = k_lo = start_k;
+		bool hit_bound = false;
+		best_k = climb(data_fft_abs, level, start_k, k_lo, k_hi, best_score, res.cost, hit_bound);
+		if(hit_bound && (best_k <= win_lo || best_k >= win_hi))
+			res.at_edge = true;
+	}
+
+	res.prf = candidateFreq(d_refine_depth, best_k);
+	res.score = best_score;
+	return res;
+}
+
+} /* namespace fast_square */
+} /* namespace gr */
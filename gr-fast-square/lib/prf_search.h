@@ -0,0 +1,124 @@
+#ifndef INCLUDED_FAST_SQUARE_PRF_SEARCH_H
+#define INCLUDED_FAST_SQUARE_PRF_SEARCH_H
+
+#include <vector>
+#include <map>
+#include <stdint.h>
+#include <gnuradio/gr_complex.h>
+#include <fast_square/defines.h>
+
+namespace gr {
+namespace fast_square {
+
+#define PRF_TABLE_CACHE_MAX 4096
+
+struct prf_candidate
+{
+	double prf;
+	float score;
+};
+
+struct prf_search_result
+{
+	double prf;   //Best candidate PRF
+	float score;  //Peak sum of the best candidate at the finest level searched
+	int cost;     //Number of magnitude bins gathered to get there
+	bool at_edge; //Tracking only: the peak kept rising up to the edge of the window
+	std::vector<prf_candidate> top; //Full searches only: strongest coarse-grid peaks, best first
+};
+
+/*!
+ * Multi-resolution PRF search over the concatenated magnitude spectra of
+ * all steps.  Level 0 is a grid with spacing coarse_precision*PRF scored on
+ * the nearest FFT bins.  Each following level shrinks the spacing by
+ * refine_factor and searches +/- one parent step around the previous best,
+ * scoring on linearly interpolated bins so that sub-bin PRF offsets still
+ * change the score.  Candidate peak tables are built the first time a
+ * candidate is evaluated and cached per level, except for the level 0
+ * candidates covering the full PRF_ACCURACY window: those live in one flat
+ * aligned int32 matrix so the coarse scan is a single gather-reduce pass.
+ *
+ * track() is the cheap variant used once a PRF estimate is available: it
+ * starts at the coarsest level that resolves the requested window in a few
+ * steps and hill-climbs the (smooth) interpolated score from the predicted
+ * PRF instead of scanning every candidate.
+ */
+class prf_search
+{
+private:
+	struct peak_table
+	{
+		std::vector<int> idxs;    //One bin per harmonic at level 0, bin pairs at refinement levels
+		std::vector<float> fracs; //Interpolation weight of the upper bin (refinement levels only)
+	};
+
+	int d_fft_size;
+	double d_coarse_precision;
+	int d_refine_factor;
+	int d_refine_depth;
+	std::vector<float> d_center_harmonic_nums;
+	std::vector<std::map<int, peak_table> > d_tables;
+
+	int32_t *d_coarse_table; //Row r holds the level 0 bins of candidate k = d_coarse_k0 + r
+	int d_coarse_stride;
+	int d_coarse_k0;
+	int d_coarse_rows;
+	int d_top_k;
+	std::vector<float> d_scores;
+
+	void coarseBins(int k, int32_t *bins) const;
+	const peak_table &peakTable(int level, int k);
+	float score(const float *data_fft_abs, int level, int k, int &cost);
+	double levelStep(int level) const;
+	double peakIdx(double cand_freq, int step_num, float harmonic_num) const;
+	int wrapBin(int bin) const;
+	void topPeaks(int k_min, std::vector<prf_candidate> &top) const;
+	int climb(const float *data_fft_abs, int level, int start_k, int k_lo, int k_hi, float &best_score, int &cost, bool &at_edge);
+
+	//Owns d_coarse_table
+	prf_search(const prf_search &);
+	prf_search &operator=(const prf_search &);
+
+public:
+	prf_search(int fft_size, double coarse_precision, double fine_precision, int refine_depth, int top_k=1);
+	~prf_search();
+
+	//Search PRFs in [min_prf, max_prf] given NUM_STEPS magnitude spectra of fft_size bins each
+	prf_search_result search(const float *data_fft_abs, double min_prf, double max_prf);
+
+	//Local search for the peak nearest center_prf, restricted to center_prf +/- half_width
+	prf_search_result track(const float *data_fft_abs, double center_prf, double half_width);
+
+	//Sorted global bin indices any candidate in [min_prf, max_prf] may read, at any level
+	void binsFor(double min_prf, double max_prf, std::vector<int> &bins) const;
+
+	//Bins halfway between harmonics (noise floor reference) for a given PRF
+	void floorBins(double prf, std::vector<int> &bins) const;
+
+	//Bins on either side of each searched harmonic's peak for a given PRF
+	void peakBins(double prf, std::vector<int> &bins) const;
+
+	//Interpolated peak sum at an arbitrary PRF, as the refinement levels score it
+	float scoreAt(const float *data_fft_abs, double prf) const;
+
+	//Number of harmonics summed into one candidate's score
+	int harmonicsPerCandidate() const { return NUM_STEPS*NUM_HARMONICS_PER_STEP/2; }
+
+	double candidateFreq(int level, int k) const;
+	int refine_factor() const { return d_refine_factor; }
+	int refine_depth() const { return d_refine_depth; }
+	double coarse_precision() const { return d_coarse_precision; }
+
+	//Flat level 0 table, exposed for benchmarking the gather kernel
+	const int32_t *coarse_table() const { return d_coarse_table; }
+	int coarse_stride() const { return d_coarse_stride; }
+	int coarse_rows() const { return d_coarse_rows; }
+};
+
+//Harmonic number of the LO center frequency during a given step
+float calculateCenterFreqHarmonicNum(int step_num);
+
+} /* namespace fast_square */
+} /* namespace gr */
+
+#endif /* INCLUDED_FAST_SQUARE_PRF_SEARCH_H */
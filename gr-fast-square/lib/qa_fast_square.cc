@@ -0,0 +1,17 @@
+/*
+ * This class gathers together all the test cases for the gr-fast_square
+ * directory into a single test suite.  As you create new test cases,
+ * add them here.
+ */
+
+#include "qa_fast_square.h"
+#include "qa_tdoa_solver.h"
+
+CppUnit::TestSuite *
+qa_fast_square::suite()
+{
+	CppUnit::TestSuite *s = new CppUnit::TestSuite("fast_square");
+	s->addTest(gr::fast_square::qa_tdoa_solver::suite());
+
+	return s;
+}
@@ -0,0 +1,16 @@
+#ifndef _QA_FAST_SQUARE_H_
+#define _QA_FAST_SQUARE_H_
+
+#include <gnuradio/attributes.h>
+#include <cppunit/TestSuite.h>
+
+//! collect all the tests for the gr-fast_square directory
+
+class __GR_ATTR_EXPORT qa_fast_square
+{
+public:
+	//! return suite of tests for all of gr-fast_square directory
+	static CppUnit::TestSuite *suite();
+};
+
+#endif /* _QA_FAST_SQUARE_H_ */
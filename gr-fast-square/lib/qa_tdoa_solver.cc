@@ -0,0 +1,131 @@
+#include "qa_tdoa_solver.h"
+#include "tdoa_solver.h"
+#include <cppunit/TestAssert.h>
+#include <cmath>
+
+namespace gr {
+namespace fast_square {
+
+static const float anchors[6][3] = {{0, 0, 0}, {6, 0, 0.5}, {0, 6, 1}, {6, 6, 2.5}, {3, -2, 2}, {-2, 3, 1.5}};
+static const double tag_pos[3] = {2.0, 3.5, 1.2};
+static const int bad_anchor = 3;
+
+//Ranges to tag_pos from the first num_anchors anchors with a common offset, one of them 1 m long
+static void makeFix(int num_anchors, tdoa_solver *&solver, std::vector<double> &ranges){
+	std::vector<std::vector<float> > anchor_pos;
+	ranges.clear();
+	for(int aa=0; aa < num_anchors; aa++){
+		anchor_pos.push_back(std::vector<float>(anchors[aa], anchors[aa]+3));
+		double dist2 = 0.0;
+		for(int kk=0; kk < 3; kk++)
+			dist2 += (tag_pos[kk]-anchors[aa][kk])*(tag_pos[kk]-anchors[aa][kk]);
+		ranges.push_back(sqrt(dist2) + 4.0 + ((aa == bad_anchor) ? 1.0 : 0.0));
+	}
+	solver = new tdoa_solver(anchor_pos, 0.05, TDOA_MAX_ITERATIONS, TDOA_STEP_TOLERANCE, 1);
+}
+
+static double fixError(const tdoa_fix &fix){
+	double err2 = 0.0;
+	for(int kk=0; kk < 3; kk++)
+		err2 += (fix.position[kk]-tag_pos[kk])*(fix.position[kk]-tag_pos[kk]);
+	return sqrt(err2);
+}
+
+void qa_tdoa_solver::t1_five_anchors_keep_outlier(){
+	//Any four of five anchors fit exactly, so there is nothing to single out the bad one
+	tdoa_solver *solver;
+	std::vector<double> ranges;
+	makeFix(5, solver, ranges);
+	tdoa_fix fix;
+	solver->solve(ranges, std::vector<double>(tag_pos, tag_pos+3), fix);
+	delete solver;
+
+	CPPUNIT_ASSERT_EQUAL(0u, fix.rejected);
+	CPPUNIT_ASSERT(fix.residual > TDOA_OUTLIER_RESIDUAL);
+}
+
+void qa_tdoa_solver::t2_six_anchors_drop_outlier(){
+	tdoa_solver *solver;
+	std::vector<double> ranges;
+	makeFix(6, solver, ranges);
+	tdoa_fix fix;
+	bool valid = solver->solve(ranges, std::vector<double>(tag_pos, tag_pos+3), fix);
+	delete solver;
+
+	CPPUNIT_ASSERT(valid);
+	CPPUNIT_ASSERT_EQUAL(1u << bad_anchor, fix.rejected);
+	CPPUNIT_ASSERT(fix.residual < TDOA_OUTLIER_RESIDUAL);
+	CPPUNIT_ASSERT(fixError(fix) < 1e-3);
+}
+
+//Ranges from the first num_anchors anchors to pos, with a common offset plus per-anchor errors
+static std::vector<double> rangesTo(const double *pos, int num_anchors, const double *errors){
+	std::vector<double> ranges;
+	for(int aa=0; aa < num_anchors; aa++){
+		double dist2 = 0.0;
+		for(int kk=0; kk < 3; kk++)
+			dist2 += (pos[kk]-anchors[aa][kk])*(pos[kk]-anchors[aa][kk]);
+		ranges.push_back(sqrt(dist2) + 4.0 + errors[aa]);
+	}
+	return ranges;
+}
+
+static const double range_errors[6] = {0.012, -0.008, 0.005, -0.015, 0.009, -0.003};
+
+void qa_tdoa_solver::t3_noisy_ranges_converge(){
+	//Centimeter range errors from a start a meter and a half off still converge close to the tag
+	std::vector<std::vector<float> > anchor_pos;
+	for(int aa=0; aa < 6; aa++)
+		anchor_pos.push_back(std::vector<float>(anchors[aa], anchors[aa]+3));
+	tdoa_solver solver(anchor_pos, 0.05);
+	std::vector<double> ranges = rangesTo(tag_pos, 6, range_errors);
+	double start[3] = {tag_pos[0]+1.0, tag_pos[1]-0.8, tag_pos[2]+0.8};
+	tdoa_fix fix;
+	bool valid = solver.solve(ranges, std::vector<double>(start, start+3), fix);
+
+	CPPUNIT_ASSERT(valid);
+	CPPUNIT_ASSERT(fix.converged);
+	CPPUNIT_ASSERT(fix.iterations <= TDOA_MAX_ITERATIONS);
+	CPPUNIT_ASSERT(fixError(fix) < 0.1);
+	CPPUNIT_ASSERT(fix.residual < 0.05);
+	for(int kk=0; kk < 3; kk++)
+		CPPUNIT_ASSERT(fix.covariance[kk*4] > 0.0 && fix.covariance[kk*4] < 0.01);
+}
+
+void qa_tdoa_solver::t4_warm_start_is_faster(){
+	//After a fix, the tag a few centimeters on starts from the previous fix rather than the far start
+	std::vector<std::vector<float> > anchor_pos;
+	for(int aa=0; aa < 6; aa++)
+		anchor_pos.push_back(std::vector<float>(anchors[aa], anchors[aa]+3));
+	tdoa_solver solver(anchor_pos, 0.05);
+	double far[3] = {tag_pos[0]+2.0, tag_pos[1]+1.5, tag_pos[2]-1.0};
+	std::vector<double> starts(far, far+3);
+	tdoa_fix cold, warm;
+	CPPUNIT_ASSERT(solver.solve(rangesTo(tag_pos, 6, range_errors), starts, cold));
+
+	double moved[3] = {tag_pos[0]+0.03, tag_pos[1]-0.02, tag_pos[2]};
+	CPPUNIT_ASSERT(solver.solve(rangesTo(moved, 6, range_errors), starts, warm));
+	CPPUNIT_ASSERT(warm.converged);
+	CPPUNIT_ASSERT(warm.iterations < cold.iterations);
+}
+
+void qa_tdoa_solver::t5_collinear_anchors_fail(){
+	//Anchors on one line leave the rotation about it undetermined, so there is no fix to report
+	std::vector<std::vector<float> > anchor_pos;
+	for(int aa=0; aa < 5; aa++){
+		float pos[3] = {(float)(2*aa), 0.0, 1.0};
+		anchor_pos.push_back(std::vector<float>(pos, pos+3));
+	}
+	tdoa_solver solver(anchor_pos, 0.05);
+	std::vector<double> ranges;
+	for(int aa=0; aa < 5; aa++){
+		double dx = tag_pos[0]-anchor_pos[aa][0], dy = tag_pos[1], dz = tag_pos[2]-1.0;
+		ranges.push_back(sqrt(dx*dx + dy*dy + dz*dz) + 4.0);
+	}
+	double start[3] = {2.3, 3.0, 1.6};
+	tdoa_fix fix;
+	CPPUNIT_ASSERT(!solver.solve(ranges, std::vector<double>(start, start+3), fix));
+}
+
+} /* namespace fast_square */
+} /* namespace gr */
@@ -0,0 +1,32 @@
+#ifndef _QA_FAST_SQUARE_TDOA_SOLVER_H_
+#define _QA_FAST_SQUARE_TDOA_SOLVER_H_
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/TestCase.h>
+
+namespace gr {
+namespace fast_square {
+
+class qa_tdoa_solver : public CppUnit::TestCase
+{
+public:
+	CPPUNIT_TEST_SUITE(qa_tdoa_solver);
+	CPPUNIT_TEST(t3_noisy_ranges_converge);
+	CPPUNIT_TEST(t4_warm_start_is_faster);
+	CPPUNIT_TEST(t5_collinear_anchors_fail);
+	CPPUNIT_TEST(t1_five_anchors_keep_outlier);
+	CPPUNIT_TEST(t2_six_anchors_drop_outlier);
+	CPPUNIT_TEST_SUITE_END();
+
+private:
+	void t1_five_anchors_keep_outlier();
+	void t2_six_anchors_drop_outlier();
+	void t3_noisy_ranges_converge();
+	void t4_warm_start_is_faster();
+	void t5_collinear_anchors_fail();
+};
+
+} /* namespace fast_square */
+} /* namespace gr */
+
+#endif /* _QA_FAST_SQUARE_TDOA_SOLVER_H_ */
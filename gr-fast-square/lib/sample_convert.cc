@@ -0,0 +1,37 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "sample_convert.h"
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#include <emmintrin.h>
+#define SAMPLE_CONVERT_X86
+#endif
+
+namespace gr {
+namespace fast_square {
+
+void convertSc16(gr_complex *out, const int16_t *in, size_t nitems, bool conjugate){
+	const float imag_scale = conjugate ? -SC16_SCALE : SC16_SCALE;
+	size_t ii = 0;
+
+#ifdef SAMPLE_CONVERT_X86
+	//Sign-extend four complex samples to int32, convert, and scale I and Q separately
+	const __m128 scale = _mm_setr_ps(SC16_SCALE, imag_scale, SC16_SCALE, imag_scale);
+	float *fout = (float *)out;
+	for(; ii + 4 <= nitems; ii += 4){
+		__m128i raw = _mm_loadu_si128((const __m128i *)(in + 2*ii));
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(raw, raw), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(raw, raw), 16);
+		_mm_storeu_ps(fout + 2*ii, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(fout + 2*ii + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+#endif
+
+	for(; ii < nitems; ii++)
+		out[ii] = gr_complex(in[2*ii]*SC16_SCALE, in[2*ii+1]*imag_scale);
+}
+
+} /* namespace fast_square */
+} /* namespace gr */
@@ -0,0 +1,23 @@
+#ifndef INCLUDED_FAST_SQUARE_SAMPLE_CONVERT_H
+#define INCLUDED_FAST_SQUARE_SAMPLE_CONVERT_H
+
+#include <gnuradio/gr_complex.h>
+#include <cstddef>
+#include <stdint.h>
+
+namespace gr {
+namespace fast_square {
+
+//Same scaling UHD applies when it converts sc16 to fc32
+#define SC16_SCALE (1.0f/32767.0f)
+
+/*!
+ * Converts nitems interleaved sc16 samples to fc32 in a single pass,
+ * optionally taking the complex conjugate on the way.
+ */
+void convertSc16(gr_complex *out, const int16_t *in, size_t nitems, bool conjugate);
+
+} /* namespace fast_square */
+} /* namespace gr */
+
+#endif /* INCLUDED_FAST_SQUARE_SAMPLE_CONVERT_H */
@@ -0,0 +1,77 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "sample_ring.h"
+#include <stdexcept>
+#include <string>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace gr {
+namespace fast_square {
+
+sample_ring::sample_ring(size_t min_items, size_t item_size)
+	: d_base(NULL), d_item_size(item_size), d_read(0), d_count(0)
+{
+	//Capacity has to be a whole number of pages so the mirror lines up, and
+	//a whole number of items so that no item straddles the end of the ring
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	d_bytes = ((min_items*item_size + page_size - 1)/page_size)*page_size;
+	while(d_bytes % item_size != 0)
+		d_bytes += page_size;
+
+	//Back the ring with an unlinked temporary file so it can be mapped twice
+	const char *tmp_dir = getenv("TMPDIR");
+	std::string filename = std::string(tmp_dir ? tmp_dir : "/tmp") + "/fast_square_ring_XXXXXX";
+	int fd = mkstemp(&filename[0]);
+	if(fd < 0)
+		throw std::runtime_error("sample_ring: unable to create backing file");
+	unlink(filename.c_str());
+	if(ftruncate(fd, d_bytes) != 0){
+		close(fd);
+		throw std::runtime_error("sample_ring: unable to size backing file");
+	}
+
+	//Reserve address space for both copies, then map the file into each half
+	void *base = mmap(NULL, 2*d_bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(base == MAP_FAILED){
+		close(fd);
+		throw std::runtime_error("sample_ring: unable to reserve address space");
+	}
+	d_base = (char *)base;
+	if(mmap(d_base, d_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+	   mmap(d_base + d_bytes, d_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED){
+		close(fd);
+		munmap(d_base, 2*d_bytes);
+		throw std::runtime_error("sample_ring: unable to create mirrored mapping");
+	}
+	close(fd);
+}
+
+sample_ring::~sample_ring(){
+	munmap(d_base, 2*d_bytes);
+}
+
+void sample_ring::produce(size_t nitems){
+	d_count += nitems*d_item_size;
+	if(d_count > d_bytes)
+		throw std::runtime_error("sample_ring: overflow");
+}
+
+void sample_ring::consume(size_t nitems){
+	size_t nbytes = nitems*d_item_size;
+	if(nbytes > d_count)
+		nbytes = d_count;
+	d_read = (d_read + nbytes) % d_bytes;
+	d_count -= nbytes;
+}
+
+void sample_ring::clear(){
+	d_read = 0;
+	d_count = 0;
+}
+
+} /* namespace fast_square */
+} /* namespace gr */
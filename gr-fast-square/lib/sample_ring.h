@@ -0,0 +1,43 @@
+#ifndef INCLUDED_FAST_SQUARE_SAMPLE_RING_H
+#define INCLUDED_FAST_SQUARE_SAMPLE_RING_H
+
+#include <cstddef>
+
+namespace gr {
+namespace fast_square {
+
+/*!
+ * Fixed-capacity FIFO of raw samples backed by a mirrored (double-mapped)
+ * memory region.  The second half of the mapping aliases the first, so any
+ * run of up to capacity() items starting at read_ptr() or write_ptr() is
+ * contiguous in memory and can be indexed directly without wrap handling.
+ */
+class sample_ring
+{
+private:
+	char *d_base;
+	size_t d_item_size;
+	size_t d_bytes;
+	size_t d_read;
+	size_t d_count;
+
+public:
+	sample_ring(size_t min_items, size_t item_size);
+	~sample_ring();
+
+	size_t capacity() const { return d_bytes/d_item_size; }
+	size_t size() const { return d_count/d_item_size; }
+	size_t space() const { return (d_bytes-d_count)/d_item_size; }
+
+	const void *read_ptr() const { return d_base + d_read; }
+	void *write_ptr() { return d_base + (d_read + d_count) % d_bytes; }
+
+	void produce(size_t nitems);
+	void consume(size_t nitems);
+	void clear();
+};
+
+} /* namespace fast_square */
+} /* namespace gr */
+
+#endif /* INCLUDED_FAST_SQUARE_SAMPLE_RING_H */
@@ -0,0 +1,78 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "sparse_dft.h"
+#include <stdexcept>
+#include <cmath>
+
+namespace gr {
+namespace fast_square {
+
+sparse_dft::sparse_dft(int fft_size, bool forward)
+	: d_fft_size(fft_size), d_length(fft_size), d_forward(forward)
+{
+	if(fft_size <= 0)
+		throw std::out_of_range("sparse_dft: fft_size must be positive");
+
+	for(int ii=0; ii < d_fft_size; ii++){
+		d_cos.push_back(cos(2*M_PI*ii/d_fft_size));
+		d_sin.push_back(sin(2*M_PI*ii/d_fft_size));
+	}
+}
+
+void sparse_dft::set_length(int n){
+	if(n <= 0 || n > d_fft_size)
+		throw std::out_of_range("sparse_dft: length must be in 1..fft_size");
+	d_length = n;
+}
+
+void sparse_dft::magnitudes(const gr_complex *in, const std::vector<int> &bins, float *abs_out) const{
+	int ii = 0;
+	while(ii < bins.size()){
+		//Run up to SPARSE_DFT_LANES bins of the same transform side by side: they share
+		//every input sample and their recursions are independent, which hides the latency
+		int transform = bins[ii]/d_fft_size;
+		int nlanes = 0;
+		double coeff[SPARSE_DFT_LANES], c[SPARSE_DFT_LANES], s[SPARSE_DFT_LANES];
+		while(nlanes < SPARSE_DFT_LANES && ii + nlanes < bins.size() && bins[ii+nlanes]/d_fft_size == transform){
+			int bin = bins[ii+nlanes]%d_fft_size;
+			//An inverse transform's bin k has the magnitude of the forward transform's bin -k
+			if(!d_forward && bin != 0)
+				bin = d_fft_size - bin;
+			c[nlanes] = d_cos[bin];
+			s[nlanes] = d_sin[bin];
+			coeff[nlanes] = 2.0*d_cos[bin];
+			nlanes++;
+		}
+		for(int ll=nlanes; ll < SPARSE_DFT_LANES; ll++){
+			c[ll] = 1.0; s[ll] = 0.0; coeff[ll] = 2.0;
+		}
+
+		//Goertzel recursion on I and Q separately, in double to keep the error flat over long transforms
+		const gr_complex *x = in + transform*d_fft_size;
+		double s1_re[SPARSE_DFT_LANES], s1_im[SPARSE_DFT_LANES], s2_re[SPARSE_DFT_LANES], s2_im[SPARSE_DFT_LANES];
+		for(int ll=0; ll < SPARSE_DFT_LANES; ll++)
+			s1_re[ll] = s1_im[ll] = s2_re[ll] = s2_im[ll] = 0.0;
+		for(int nn=0; nn < d_length; nn++){
+			double x_re = x[nn].real(), x_im = x[nn].imag();
+			for(int ll=0; ll < SPARSE_DFT_LANES; ll++){
+				double s0_re = x_re + coeff[ll]*s1_re[ll] - s2_re[ll];
+				double s0_im = x_im + coeff[ll]*s1_im[ll] - s2_im[ll];
+				s2_re[ll] = s1_re[ll]; s2_im[ll] = s1_im[ll];
+				s1_re[ll] = s0_re; s1_im[ll] = s0_im;
+			}
+		}
+
+		//|X| = |s1 - exp(-jw)*s2|
+		for(int ll=0; ll < nlanes; ll++){
+			double y_re = s1_re[ll] - c[ll]*s2_re[ll] - s[ll]*s2_im[ll];
+			double y_im = s1_im[ll] - c[ll]*s2_im[ll] + s[ll]*s2_re[ll];
+			abs_out[bins[ii+ll]] = sqrt(y_re*y_re + y_im*y_im);
+		}
+		ii += nlanes;
+	}
+}
+
+} /* namespace fast_square */
+} /* namespace gr */
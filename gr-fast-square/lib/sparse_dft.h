@@ -0,0 +1,46 @@
+#ifndef INCLUDED_FAST_SQUARE_SPARSE_DFT_H
+#define INCLUDED_FAST_SQUARE_SPARSE_DFT_H
+
+#include <gnuradio/gr_complex.h>
+#include <vector>
+
+namespace gr {
+namespace fast_square {
+
+#define SPARSE_DFT_LANES 8
+
+/*!
+ * Computes DFT magnitudes for an arbitrary subset of bins of a batch of
+ * equally sized transforms with the Goertzel recursion.  Cost is
+ * O(bins*length) instead of O(batch*fft_size*log(fft_size)), which wins
+ * whenever only a few bins per transform are read.
+ */
+class sparse_dft
+{
+private:
+	int d_fft_size;
+	int d_length;
+	bool d_forward;
+	std::vector<double> d_cos; //cos(2*pi*k/fft_size)
+	std::vector<double> d_sin; //sin(2*pi*k/fft_size)
+
+public:
+	sparse_dft(int fft_size, bool forward);
+
+	//Only the first n samples of each transform are non-zero
+	void set_length(int n);
+	int length() const { return d_length; }
+
+	/*!
+	 * For each global bin index b in bins (transform b/fft_size, bin
+	 * b%fft_size) writes |X| to abs_out[b].  Other entries of abs_out are
+	 * left untouched.  in holds the transforms back to back, fft_size
+	 * samples apart.
+	 */
+	void magnitudes(const gr_complex *in, const std::vector<int> &bins, float *abs_out) const;
+};
+
+} /* namespace fast_square */
+} /* namespace gr */
+
+#endif /* INCLUDED_FAST_SQUARE_SPARSE_DFT_H */
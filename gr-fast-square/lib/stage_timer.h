@@ -0,0 +1,29 @@
+#ifndef INCLUDED_FAST_SQUARE_STAGE_TIMER_H
+#define INCLUDED_FAST_SQUARE_STAGE_TIMER_H
+
+#include <fast_square/block_stats.h>
+#include "monotonic_clock.h"
+
+namespace gr {
+namespace fast_square {
+
+//Start of a timed stage, or 0 while timing is off
+inline uint64_t stageStart(){
+	return block_stats::enabled() ? monotonicNs() : 0;
+}
+
+//Time since start_ns, or 0 if the stage was not timed
+inline uint64_t stageElapsed(uint64_t start_ns){
+	return start_ns ? monotonicNs() - start_ns : 0;
+}
+
+//Record the time since start_ns under stage, if the stage was timed
+inline void stageEnd(block_stats &stats, int stage, uint64_t start_ns){
+	if(start_ns)
+		stats.record(stage, monotonicNs() - start_ns);
+}
+
+} /* namespace fast_square */
+} /* namespace gr */
+
+#endif /* INCLUDED_FAST_SQUARE_STAGE_TIMER_H */
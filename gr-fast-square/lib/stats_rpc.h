@@ -0,0 +1,25 @@
+#ifndef INCLUDED_FAST_SQUARE_STATS_RPC_H
+#define INCLUDED_FAST_SQUARE_STATS_RPC_H
+
+#include <fast_square/block_stats.h>
+
+#ifdef GR_CTRLPORT
+#include <gnuradio/rpcregisterhelpers.h>
+#include <climits>
+
+namespace gr {
+namespace fast_square {
+
+//ControlPort variable reading one of block's block_stats vectors through getter
+template<class T>
+rpcbasic_sptr statsRpcVariable(T *block, const char *name, std::vector<int> (T::*getter)() const, const char *desc){
+	return rpcbasic_sptr(new rpcbasic_register_get<T, std::vector<int> >(
+			block->alias(), name, getter, pmt::mp(0), pmt::mp(INT_MAX), pmt::mp(0),
+			"", desc, RPC_PRIVLVL_MIN, DISPNULL));
+}
+
+} /* namespace fast_square */
+} /* namespace gr */
+#endif
+
+#endif /* INCLUDED_FAST_SQUARE_STATS_RPC_H */
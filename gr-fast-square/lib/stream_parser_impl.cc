@@ -4,51 +4,66 @@
 #endif
 
 #include "stream_parser_impl.h"
+#include "marker_scan.h"
+#include "sample_convert.h"
+#include "stage_timer.h"
+#include "stats_rpc.h"
 #include <gnuradio/io_signature.h>
 #include <volk/volk.h>
 #include <cstdio>
 #include <string>
-#include <sys/time.h>
 
 namespace gr {
 namespace fast_square {
 
-stream_parser::sptr stream_parser::make(){
+stream_parser::sptr stream_parser::make(bool journal, const std::string &journal_file, bool sc16){
 	return gnuradio::get_initial_sptr
-		(new stream_parser_impl());
+		(new stream_parser_impl(journal, journal_file, sc16));
 }
 
-stream_parser_impl::stream_parser_impl()
+stream_parser_impl::stream_parser_impl(bool journal, const std::string &journal_file, bool sc16)
 	: block("stream_parser",
-			io_signature::make(4, 4, sizeof(gr_complex)),
-			io_signature::make(0, 4, POW2_CEIL(NUM_STEPS*FFT_SIZE)*sizeof(gr_complex))),
-	d_hsn(0), d_hsn_idx(0)
+			io_signature::make(1, MAX_ANCHORS, sc16 ? 2*sizeof(int16_t) : sizeof(gr_complex)),
+			io_signature::make(0, MAX_ANCHORS, SNAPSHOT_FRAME_SIZE)),
+	d_hsn(0), d_hsn_idx(0), d_sc16(sc16), d_journal(NULL), d_last_seq(0), d_have_last_seq(false)
 {
-	d_output_per_seq = POW2_CEIL(NUM_STEPS*FFT_SIZE);
-
-	for(int ii=0; ii < 4; ii++)
-		d_restarted[ii] = false;
+	d_item_size = input_signature()->sizeof_stream_item(0);
 	d_wait_for_restart = false;
 
-	data_history.resize(4);
-
 	const int alignment_multiple =
 		volk_get_alignment() / sizeof(float);
 	set_alignment(std::max(1,alignment_multiple));
 
-	//Open files to put timestamps in...
-	char filename[40];
-	for(int ii=0; ii < 4; ii++){
-		std::ofstream *temp_ofstream = new std::ofstream();
-		timestamp_files.push_back(temp_ofstream);
-		sprintf(filename,"timestamps_anchor%d.txt",ii);
-		timestamp_files[ii]->open(filename);
-	}
+	//Timestamps are handed off to a background writer so general_work never touches the filesystem
+	if(journal)
+		d_journal = new timestamp_journal(journal_file);
 }
 
 stream_parser_impl::~stream_parser_impl(){
-	for(int ii=0; ii < 4; ii++)
-		timestamp_files[ii]->close();
+	delete d_journal;
+	for(int ii=0; ii < data_history.size(); ii++)
+		delete data_history[ii];
+}
+
+void stream_parser_impl::setup_rpc(){
+#ifdef GR_CTRLPORT
+	add_rpc_variable(statsRpcVariable(this, "stat_counters", &stream_parser_impl::stat_counters,
+			"Hot-path counters, indexed by stat_counter"));
+	add_rpc_variable(statsRpcVariable(this, "latency_parse", &stream_parser_impl::stageHistogram<STAGE_PARSE>,
+			"Aligning and copying out one snapshot, log2 ns buckets"));
+#endif
+}
+
+bool stream_parser_impl::check_topology(int ninputs, int noutputs){
+	//Output ii carries anchor ii, so there cannot be more outputs than anchors
+	if(noutputs > ninputs)
+		return false;
+
+	//Each anchor gets a preallocated ring large enough for a few full sequences
+	while(data_history.size() < ninputs)
+		data_history.push_back(new sample_ring(SAMPLES_PER_SEQ*PARSER_HISTORY_SEQS, d_item_size));
+	d_restarted.assign(ninputs, false);
+	return true;
 }
 
 void stream_parser_impl::forecast(int noutput_items, gr_vector_int &ninput_items_required){
@@ -63,63 +78,59 @@ int stream_parser_impl::general_work(int noutput_items,
 		gr_vector_void_star &output_items){
 
 	int out_count = 0;
-	int output_offset = 0;
 
 	//Loop over all anchors
 	for(int ii=0; ii < input_items.size(); ii++){
-		const gr_complex *in = (const gr_complex *) input_items[ii];
+		//Copy as much new data as the ring has room for
+		int nitems = std::min((size_t)ninput_items[ii], data_history[ii]->space());
+		memcpy(data_history[ii]->write_ptr(), input_items[ii], nitems*d_item_size);
+		data_history[ii]->produce(nitems);
 
-		//Loop over all new data
-		if(data_history[ii].size() < SAMPLES_PER_SEQ * 100){
-			for(int jj=0; jj < ninput_items[ii]; jj++){
-				data_history[ii].push_back(in[jj]);
-			}
-	
-			//Consume items from each input
-			consume(ii, ninput_items[ii]);
-		}
+		//Consume items from each input
+		consume(ii, nitems);
 	}
 
-	//Pop elements off each deque until a subsequent restart is detected
+	//Skip ahead in each ring until a subsequent restart is detected
 	bool snapshot_flag = true;
-	while(snapshot_flag){
+	while(snapshot_flag && out_count < noutput_items){
+		uint64_t parse_start = stageStart();
+		uint32_t snapshot_seq = 0;
 		for(int ii=0; ii < input_items.size();){
-			while(data_history[ii].size() > SAMPLES_PER_SEQ && data_history[ii][SAMPLES_PER_SEQ].imag() > -1.0){
-				data_history[ii].pop_front();
-			}
+			restart_marker marker;
+			if(d_sc16)
+				marker = scanRestartMarker_sc16((const int16_t *)data_history[ii]->read_ptr(), data_history[ii]->size());
+			else
+				marker = scanRestartMarker((const gr_complex *)data_history[ii]->read_ptr(), data_history[ii]->size());
+			data_history[ii]->consume(marker.skipped);
+
 			//Check to see if there is enough data for a full snapshot.
-			if(data_history[ii].size() <= SAMPLES_PER_SEQ){
+			if(!marker.found){
 				snapshot_flag = false;
 				break;
 			} else {
-				uint32_t sequence_num = getSequenceNum(data_history[ii][SAMPLES_PER_SEQ-1]);
-				timeval cur_time;
-				char micro_cstr[7];
-				gettimeofday(&cur_time, NULL);
-				sprintf(micro_cstr,"%06d",(int)cur_time.tv_usec);
-				char *ct_out = ctime(&(cur_time.tv_sec));
-				ct_out[19] = 0;
-
-				*timestamp_files[ii] << sequence_num << " " << ct_out << "." << micro_cstr << std::endl;
+				uint32_t sequence_num = marker.sequence_num;
+				snapshot_seq = sequence_num;
+				if(d_journal)
+					d_journal->log(sequence_num, ii);
 	
 				//TODO: Temporary code to allow for repeating log files
 				if(d_wait_for_restart){
 					if(sequence_num < (d_hsn - 100) && d_hsn > 100){
 						d_restarted[ii] = true;
 						bool all_restarted = true;
-						for(int jj=0; jj < 4; jj++)
+						for(int jj=0; jj < d_restarted.size(); jj++)
 							all_restarted &= d_restarted[jj];
 						if(all_restarted){
 							std::cout << "ALL RESTARTED" << std::endl;
+							d_stats.increment(COUNTER_SEQ_RESYNC);
 							d_hsn = sequence_num;
 							d_wait_for_restart = false;
-							for(int jj=0; jj < 4; jj++)
-								d_restarted[jj] = false;
+							d_restarted.assign(d_restarted.size(), false);
 							ii = 0;
 							continue;
 						}
 					} else {
-						data_history[ii].erase(data_history[ii].begin(), data_history[ii].begin()+SAMPLES_PER_SEQ-1);
+						data_history[ii]->consume(SAMPLES_PER_SEQ-1);
 						ii = 0;
 						continue;
 					}
@@ -127,17 +138,19 @@ int stream_parser_impl::general_work(int noutput_items,
 				} else {
 					//In case a sequence number has been skipped, delete any stale data
 					if(sequence_num > d_hsn && ii > 0){
+						d_stats.increment(COUNTER_SEQ_RESYNC);
 						d_hsn = sequence_num;
 						d_hsn_idx = ii;
 						ii = 0;
 						continue;
 					} else if(sequence_num < d_hsn){
+						d_stats.increment(COUNTER_SEQ_RESYNC);
 						//TODO: Temporary code to allow for repeating log files
 						if(sequence_num < (d_hsn - 100) && d_hsn > 100){
 							d_restarted[ii] = true;
 							d_wait_for_restart = true;
 						}else
-							data_history[ii].erase(data_history[ii].begin(), data_history[ii].begin()+SAMPLES_PER_SEQ-1);
+							data_history[ii]->consume(SAMPLES_PER_SEQ-1);
 						ii = 0;
 						continue;
 					}
@@ -148,26 +161,42 @@ int stream_parser_impl::general_work(int noutput_items,
 	
 		//If snapshot_flag is set, it means we have a full snapshot and all data is aligned in data_history
 		if(snapshot_flag){
-			if(out_count < noutput_items){
+			//Every later stage times itself against this
+			uint64_t ingest_ns = monotonicNs();
 			for(int ii=0; ii < output_items.size(); ii++){
+				void *frame = snapshotFrame(output_items[ii], out_count);
+				snapshot_header *hdr = snapshotHeader(frame);
+				memset(hdr, 0, sizeof(snapshot_header));
+				hdr->sequence_num = snapshot_seq;
+				hdr->anchor_mask = (1u << input_items.size()) - 1;
+				hdr->ingest_ns = ingest_ns;
+
+				const void *hist = data_history[ii]->read_ptr();
 				for(int jj=0; jj < NUM_STEPS; jj++){
 					int cur_data_idx = SKIP_SAMPLES + SAMPLES_PER_FREQ*jj;
-					gr_complex *optr = ((gr_complex *)(output_items[ii])) + jj*FFT_SIZE + output_offset;
-
-					//Have to use std::copy since deque isn't contiguous
-					std::copy(data_history[ii].begin() + cur_data_idx, data_history[ii].begin() + (cur_data_idx + FFT_SIZE), optr);
-					//If we're using image frequencies, make sure to take the complex conjugate...
-					if(USE_IMAGE)
-						volk_32fc_conjugate_32fc(optr, optr, FFT_SIZE);
-
+					gr_complex *optr = snapshotData(frame) + jj*FFT_SIZE;
+
+					//Ring is contiguous, so the step is copied straight out (conjugating if we're using image frequencies)
+					if(d_sc16)
+						convertSc16(optr, ((const int16_t *)hist) + 2*cur_data_idx, FFT_SIZE, USE_IMAGE);
+					else if(USE_IMAGE)
+						volk_32fc_conjugate_32fc(optr, ((const gr_complex *)hist) + cur_data_idx, FFT_SIZE);
+					else
+						memcpy(optr, ((const gr_complex *)hist) + cur_data_idx, FFT_SIZE*sizeof(gr_complex));
 				}
 			}
 			for(int ii=0; ii < input_items.size(); ii++){
-				data_history[ii].erase(data_history[ii].begin(), data_history[ii].begin()+SAMPLES_PER_SEQ-1);
+				data_history[ii]->consume(SAMPLES_PER_SEQ-1);
 			}
-			output_offset += d_output_per_seq;
 			out_count++;
-			}
+			stageEnd(d_stats, STAGE_PARSE, parse_start);
+
+			//Sequence numbers that never made it into a snapshot; a restart going backwards is not a drop
+			d_stats.increment(COUNTER_SNAPSHOTS);
+			if(d_have_last_seq && snapshot_seq > d_last_seq + 1)
+				d_stats.increment(COUNTER_SEQ_DROPPED, snapshot_seq - d_last_seq - 1);
+			d_last_seq = snapshot_seq;
+			d_have_last_seq = true;
 	
 			////Prepare an outgoing message containing all data
 			//pmt::pmt_t new_message_dict = pmt::make_dict();
@@ -181,16 +210,11 @@ int stream_parser_impl::general_work(int noutput_items,
 		}
 	}
 
-	return out_count;
-}
+	//The journal is fed from this thread, so its drop count can be read here
+	if(d_journal)
+		d_stats.set(COUNTER_JOURNAL_DROPPED, d_journal->dropped());
 
-uint32_t stream_parser_impl::getSequenceNum(gr_complex data){
-	float real_f = data.real()*32767;
-	float imag_f = data.imag()*32767;
-
-	uint32_t real = (real_f < 0.0) ? (uint32_t)(real_f + 65536) : (uint32_t)(real_f);
-	uint32_t imag = (imag_f < 0.0) ? (uint32_t)(imag_f + 65536) : (uint32_t)(imag_f);
-	return real + 65536*imag;
+	return out_count;
 }
 
 } /* namespace fast_square */
@@ -4,7 +4,10 @@
 
 #include <fast_square/stream_parser.h>
 #include <fast_square/defines.h>
-#include <fstream>
+#include <fast_square/snapshot_frame.h>
+#include <fast_square/block_stats.h>
+#include "sample_ring.h"
+#include "timestamp_journal.h"
 
 namespace gr {
 namespace fast_square {
@@ -13,21 +16,31 @@ class stream_parser_impl : public stream_parser
 {
 private:
 	int d_packet_id;
-	int d_output_per_seq;
 	uint32_t d_hsn; //hsn = highest sequence num
 	int d_hsn_idx;
-	std::vector<std::deque<gr_complex> > data_history;
-	uint32_t getSequenceNum(gr_complex data);
-	bool d_restarted[4];
+	std::vector<sample_ring*> data_history;
+	std::vector<bool> d_restarted;
 	bool d_wait_for_restart;
-	std::vector<std::ofstream*> timestamp_files;
+	bool d_sc16;
+	size_t d_item_size;
+	timestamp_journal *d_journal;
+	uint32_t d_last_seq;  //Sequence number of the last snapshot emitted
+	bool d_have_last_seq;
+	block_stats d_stats;
 
 protected:
 
 public:
-	stream_parser_impl();
+	stream_parser_impl(bool journal, const std::string &journal_file, bool sc16);
 	~stream_parser_impl();
 
+	bool check_topology(int ninputs, int noutputs);
+
+	std::vector<int> stage_histogram(int stage) const { return d_stats.histogram(stage); }
+	std::vector<int> stat_counters() const { return d_stats.counters(); }
+	template<int STAGE> std::vector<int> stageHistogram() const { return d_stats.histogram(STAGE); }
+	void setup_rpc();
+
 	void forecast(int noutput_items, gr_vector_int &ninput_items_required);
 	int general_work(int noutput_items,
 			gr_vector_int &ninput_items,
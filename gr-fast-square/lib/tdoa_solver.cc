@@ -0,0 +1,253 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "tdoa_solver.h"
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+namespace gr {
+namespace fast_square {
+
+//Inverse of a 3x3 matrix by cofactors; false if it is (numerically) singular
+static bool invert3(const double *a, double *inv){
+	double c00 = a[4]*a[8] - a[5]*a[7];
+	double c01 = a[5]*a[6] - a[3]*a[8];
+	double c02 = a[3]*a[7] - a[4]*a[6];
+	double det = a[0]*c00 + a[1]*c01 + a[2]*c02;
+	double scale = fabs(a[0]) + fabs(a[4]) + fabs(a[8]);
+	if(!(fabs(det) > 1e-12*scale*scale*scale))
+		return false;
+	inv[0] = c00/det;
+	inv[1] = (a[2]*a[7] - a[1]*a[8])/det;
+	inv[2] = (a[1]*a[5] - a[2]*a[4])/det;
+	inv[3] = c01/det;
+	inv[4] = (a[0]*a[8] - a[2]*a[6])/det;
+	inv[5] = (a[2]*a[3] - a[0]*a[5])/det;
+	inv[6] = c02/det;
+	inv[7] = (a[1]*a[6] - a[0]*a[7])/det;
+	inv[8] = (a[0]*a[4] - a[1]*a[3])/det;
+	return true;
+}
+
+tdoa_solver::tdoa_solver(const std::vector<std::vector<float> > &anchor_pos, double range_sigma,
+		int max_iterations, double step_tolerance, int max_outliers, double outlier_residual)
+	: d_range_sigma(range_sigma), d_max_iterations(max_iterations), d_step_tolerance(step_tolerance),
+	d_max_outliers(max_outliers), d_outlier_residual(outlier_residual), d_have_last(false)
+{
+	if(anchor_pos.size() < 4 || anchor_pos.size() > 32)
+		throw std::out_of_range("tdoa_solver: need between four and 32 anchors for a 3D fix");
+	if(max_iterations <= 0 || step_tolerance <= 0.0)
+		throw std::out_of_range("tdoa_solver: iteration cap and step tolerance must be positive");
+	if(max_outliers < 0 || outlier_residual < 0.0)
+		throw std::out_of_range("tdoa_solver: outlier count and residual must not be negative");
+
+	for(int ii=0; ii < anchor_pos.size(); ii++){
+		if(anchor_pos[ii].size() != 3)
+			throw std::invalid_argument("tdoa_solver: anchor positions must be x, y, z");
+		for(int kk=0; kk < 3; kk++)
+			d_anchors.push_back(anchor_pos[ii][kk]);
+	}
+}
+
+double tdoa_solver::evaluate(const double *pos, const std::vector<double> &ranges, double *res, double *jac) const{
+	//Residual a-1 is the modelled minus the measured range difference between active anchors a and 0
+	int ref = d_active[0];
+	double dist0 = 0.0, unit0[3];
+	double cost = 0.0;
+	for(int aa=0; aa < d_active.size(); aa++){
+		int anchor = d_active[aa];
+		double diff[3], norm = 0.0;
+		for(int kk=0; kk < 3; kk++){
+			diff[kk] = pos[kk] - d_anchors[anchor*3+kk];
+			norm += diff[kk]*diff[kk];
+		}
+		norm = std::max(sqrt(norm), 1e-9);
+		if(aa == 0){
+			dist0 = norm;
+			for(int kk=0; kk < 3; kk++)
+				unit0[kk] = diff[kk]/norm;
+			continue;
+		}
+		double cur_res = norm - dist0 - (ranges[anchor] - ranges[ref]);
+		res[aa-1] = cur_res;
+		if(jac)
+			for(int kk=0; kk < 3; kk++)
+				jac[(aa-1)*3+kk] = diff[kk]/norm - unit0[kk];
+		cost += cur_res*cur_res;
+	}
+	return cost;
+}
+
+bool tdoa_solver::solve(const std::vector<double> &ranges, const std::vector<double> &starts, tdoa_fix &fix){
+	int num_anchors = d_anchors.size()/3;
+	if(ranges.size() != num_anchors)
+		throw std::invalid_argument("tdoa_solver: one range per anchor required");
+
+	d_active.clear();
+	for(int aa=0; aa < num_anchors; aa++)
+		d_active.push_back(aa);
+	solveActive(ranges, starts, fix);
+	fix.rejected = 0;
+
+	//Drop the anchor whose removal fits best, for as long as the fit stays poor and improves.
+	//With five anchors every leave-one-out fit has no redundancy left and fits perfectly,
+	//so the outlier cannot be told apart; it takes six to drop one.
+	int num_rejected = 0;
+	while(num_rejected < d_max_outliers && d_active.size() > 5 && fix.residual > d_outlier_residual){
+		std::vector<int> kept(d_active);
+		std::vector<double> seed(fix.position, fix.position+3);
+		tdoa_fix trial, best;
+		int best_drop = -1;
+		for(int ii=0; ii < kept.size(); ii++){
+			d_active = kept;
+			d_active.erase(d_active.begin()+ii);
+			solveActive(ranges, seed, trial);
+			if(trial.converged && trial.residual < ((best_drop < 0) ? fix.residual : best.residual)){
+				best = trial;
+				best_drop = ii;
+			}
+		}
+		d_active = kept;
+		if(best_drop < 0)
+			break;
+
+		best.rejected = fix.rejected | (1u << kept[best_drop]);
+		fix = best;
+		d_active.erase(d_active.begin()+best_drop);
+		num_rejected++;
+	}
+
+	//Only a sane fix warm-starts the next one
+	const double *pos = fix.position;
+	double mag = pos[0]*pos[0] + pos[1]*pos[1] + pos[2]*pos[2];
+	bool valid = fix.converged && std::isfinite(mag) && mag <= TDOA_MAX_RANGE*TDOA_MAX_RANGE;
+	d_have_last = valid;
+	if(valid)
+		memcpy(d_last, pos, sizeof(d_last));
+	return valid;
+}
+
+void tdoa_solver::solveActive(const std::vector<double> &ranges, const std::vector<double> &starts, tdoa_fix &fix){
+	int num_anchors = d_anchors.size()/3;
+	int num_res = d_active.size() - 1;
+	d_res.resize(num_res);
+	d_jac.resize(num_res*3);
+	double *res = &d_res[0], *jac = &d_jac[0];
+
+	//Start from whichever candidate fits best.  Four anchors leave two exact solutions,
+	//so near-ties go to the earlier candidate: the previous fix, then the caller's, then
+	//the anchor centroid.
+	std::vector<double> cands;
+	if(d_have_last)
+		cands.insert(cands.end(), d_last, d_last+3);
+	cands.insert(cands.end(), starts.begin(), starts.end() - starts.size() % 3);
+	for(int kk=0; kk < 3; kk++){
+		double centroid = 0.0;
+		for(int aa=0; aa < num_anchors; aa++)
+			centroid += d_anchors[aa*3+kk]/num_anchors;
+		cands.push_back(centroid);
+	}
+	double pos[3];
+	double cost = INFINITY;
+	for(int ii=0; ii < cands.size(); ii += 3){
+		if(!std::isfinite(cands[ii]) || !std::isfinite(cands[ii+1]) || !std::isfinite(cands[ii+2]))
+			continue;
+		double cand_cost = evaluate(&cands[ii], ranges, res, NULL);
+		if(cand_cost < cost - d_step_tolerance*d_step_tolerance){
+			cost = cand_cost;
+			memcpy(pos, &cands[ii], sizeof(pos));
+		}
+	}
+
+	//Levenberg-Marquardt: damp the Gauss-Newton step while it fails to reduce the cost
+	double lambda = 1e-3;
+	fix.converged = false;
+	fix.iterations = 0;
+	while(fix.iterations < d_max_iterations){
+		fix.iterations++;
+		cost = evaluate(pos, ranges, res, jac);
+
+		double jtj[9] = {0}, jtr[3] = {0};
+		for(int rr=0; rr < num_res; rr++){
+			for(int ii=0; ii < 3; ii++){
+				jtr[ii] += jac[rr*3+ii]*res[rr];
+				for(int jj=0; jj < 3; jj++)
+					jtj[ii*3+jj] += jac[rr*3+ii]*jac[rr*3+jj];
+			}
+		}
+
+		//The first step tried is the least damped one, so it measures how far the minimum still is
+		bool improved = false;
+		double step_len = 0.0, first_step_len = -1.0;
+		while(lambda < 1e10){
+			double damped[9], inv[9];
+			memcpy(damped, jtj, sizeof(damped));
+			for(int ii=0; ii < 3; ii++)
+				damped[ii*4] += lambda*std::max(jtj[ii*4], 1e-12);
+			if(!invert3(damped, inv)){
+				lambda *= 10.0;
+				continue;
+			}
+
+			double cand[3];
+			step_len = 0.0;
+			for(int ii=0; ii < 3; ii++){
+				double step = -(inv[ii*3]*jtr[0] + inv[ii*3+1]*jtr[1] + inv[ii*3+2]*jtr[2]);
+				cand[ii] = pos[ii] + step;
+				step_len += step*step;
+			}
+			step_len = sqrt(step_len);
+			if(first_step_len < 0.0)
+				first_step_len = step_len;
+
+			double cand_cost = evaluate(cand, ranges, res, NULL);
+			if(cand_cost <= cost){
+				memcpy(pos, cand, sizeof(pos));
+				cost = cand_cost;
+				lambda = std::max(lambda*0.1, 1e-12);
+				improved = true;
+				break;
+			}
+			lambda *= 10.0;
+		}
+
+		//Converged once the undamped step gets small.  A heavily damped step is always small, so
+		//when no damping reduces the cost while the minimum is still further away the solver has
+		//stalled, and the fix is reported as not converged.
+		if(first_step_len >= 0.0 && first_step_len < d_step_tolerance){
+			fix.converged = true;
+			break;
+		}
+		if(!improved)
+			break;
+	}
+
+	//Covariance of the fix from the Jacobian at the solution
+	cost = evaluate(pos, ranges, res, jac);
+	double jtj[9] = {0}, inv[9];
+	for(int rr=0; rr < num_res; rr++)
+		for(int ii=0; ii < 3; ii++)
+			for(int jj=0; jj < 3; jj++)
+				jtj[ii*3+jj] += jac[rr*3+ii]*jac[rr*3+jj];
+	int dof = num_res - 3;
+	double sigma2 = (dof > 0) ? cost/dof : d_range_sigma*d_range_sigma;
+	if(invert3(jtj, inv)){
+		for(int ii=0; ii < 9; ii++)
+			fix.covariance[ii] = sigma2*inv[ii];
+	} else {
+		//The anchors leave the position undetermined along some direction (e.g. all on one line),
+		//so wherever the solver stopped is one of many equally good answers
+		for(int ii=0; ii < 9; ii++)
+			fix.covariance[ii] = (ii % 4 == 0) ? INFINITY : 0.0;
+		fix.converged = false;
+	}
+
+	memcpy(fix.position, pos, sizeof(pos));
+	fix.residual = sqrt(cost/num_res);
+}
+
+} /* namespace fast_square */
+} /* namespace gr */
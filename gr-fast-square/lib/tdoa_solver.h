@@ -0,0 +1,82 @@
+#ifndef INCLUDED_FAST_SQUARE_TDOA_SOLVER_H
+#define INCLUDED_FAST_SQUARE_TDOA_SOLVER_H
+
+#include <gnuradio/gr_complex.h>
+#include <fast_square/defines.h>
+#include <vector>
+#include <stdint.h>
+
+namespace gr {
+namespace fast_square {
+
+struct tdoa_fix
+{
+	double position[3];
+	double residual;      //RMS range-difference residual (m)
+	double covariance[9]; //Row-major position covariance (m^2)
+	int iterations;
+	bool converged;
+	uint32_t rejected;    //Bit a is set if anchor a was dropped as an outlier
+};
+
+/*!
+ * Levenberg-Marquardt least-squares position from times of arrival,
+ * given as ranges in meters.  Only range differences to the first
+ * anchor are used, so a common offset in the ranges drops out.  Every
+ * anchor after the first adds one residual, so five or more anchors
+ * overdetermine the fix.
+ *
+ * Each solve starts from the best of the previous fix and the caller's
+ * starting points (e.g. the closed-form solution), whichever fits the
+ * ranges better.  It converges once the least damped step of an
+ * iteration is shorter than step_tolerance.  It gives up, unconverged,
+ * after max_iterations or when no damping reduces the cost any further
+ * while that step is still longer (a stall).  The covariance is
+ * sigma^2*(J'J)^-1 at the solution.  sigma comes from the residuals
+ * when the fix is overdetermined and is range_sigma otherwise.  When
+ * J'J is singular there (degenerate anchor geometry) the fix is not
+ * converged either, and its covariance is infinite.
+ *
+ * With max_outliers > 0, a fix whose residual exceeds outlier_residual
+ * is solved again without each anchor in turn, and the anchor whose
+ * removal fits best (among the solves that converge) is dropped, as long
+ * as that improves the fit.  This repeats for up to max_outliers anchors
+ * while more than five remain: four anchors determine the fix exactly,
+ * so with five every leave-one-out solve fits perfectly and a single
+ * bad anchor cannot be identified.
+ */
+class tdoa_solver
+{
+private:
+	std::vector<double> d_anchors; //x, y, z of every anchor
+	double d_range_sigma;
+	int d_max_iterations;
+	double d_step_tolerance;
+	int d_max_outliers;
+	double d_outlier_residual;
+	bool d_have_last;
+	double d_last[3];
+	std::vector<int> d_active;     //Anchors in the current solve; the first is the reference
+	std::vector<double> d_res, d_jac;
+
+	double evaluate(const double *pos, const std::vector<double> &ranges, double *res, double *jac) const;
+	void solveActive(const std::vector<double> &ranges, const std::vector<double> &starts, tdoa_fix &fix);
+
+public:
+	tdoa_solver(const std::vector<std::vector<float> > &anchor_pos, double range_sigma,
+			int max_iterations=TDOA_MAX_ITERATIONS, double step_tolerance=TDOA_STEP_TOLERANCE,
+			int max_outliers=0, double outlier_residual=TDOA_OUTLIER_RESIDUAL);
+
+	//ranges[a] is the range (m) of anchor a up to a common offset; starts holds x, y, z triples
+	bool solve(const std::vector<double> &ranges, const std::vector<double> &starts, tdoa_fix &fix);
+
+	//Forget the previous fix, e.g. after the tag is lost
+	void reset() { d_have_last = false; }
+
+	int num_anchors() const { return d_anchors.size()/3; }
+};
+
+} /* namespace fast_square */
+} /* namespace gr */
+
+#endif /* INCLUDED_FAST_SQUARE_TDOA_SOLVER_H */
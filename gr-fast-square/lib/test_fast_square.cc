@@ -0,0 +1,26 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cppunit/TextTestRunner.h>
+#include <cppunit/XmlOutputter.h>
+
+#include <gnuradio/unittests.h>
+#include "qa_fast_square.h"
+#include <iostream>
+#include <fstream>
+
+int
+main (int argc, char **argv)
+{
+	CppUnit::TextTestRunner runner;
+	std::ofstream xmlfile(get_unittest_path("fast_square.xml").c_str());
+	CppUnit::XmlOutputter *xmlout = new CppUnit::XmlOutputter(&runner.result(), xmlfile);
+
+	runner.addTest(qa_fast_square::suite());
+	runner.setOutputter(xmlout);
+
+	bool was_successful = runner.run("", false);
+
+	return was_successful ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "timestamp_journal.h"
+#include <stdexcept>
+#include <cstring>
+#include <iostream>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <boost/bind.hpp>
+
+namespace gr {
+namespace fast_square {
+
+timestamp_journal::timestamp_journal(const std::string &filename)
+	: d_running(true), d_map(NULL), d_map_records(0), d_num_records(0), d_dropped(0)
+{
+	d_fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(d_fd < 0)
+		throw std::runtime_error("timestamp_journal: unable to open " + filename);
+
+	//The destructor does not run if the constructor throws, so give the map and file back here
+	try {
+		growMap(JOURNAL_GROW_RECORDS);
+
+		//Stamp the header with matching wall/monotonic clocks
+		journal_header *hdr = (journal_header *)d_map;
+		memset(hdr, 0, sizeof(journal_header));
+		memcpy(hdr->magic, JOURNAL_MAGIC, sizeof(hdr->magic));
+		hdr->record_size = sizeof(timestamp_record);
+		timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		hdr->realtime_ns_at_open = (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+		hdr->mono_ns_at_open = monotonicNs();
+
+		d_thread = boost::thread(boost::bind(&timestamp_journal::writerLoop, this));
+	} catch(...) {
+		if(d_map)
+			munmap(d_map, sizeof(journal_header) + d_map_records*sizeof(timestamp_record));
+		close(d_fd);
+		throw;
+	}
+}
+
+timestamp_journal::~timestamp_journal(){
+	d_running.store(false, boost::memory_order_release);
+	d_thread.join();
+
+	//Trim the preallocated tail so the file holds exactly the committed records
+	size_t used = sizeof(journal_header) + d_num_records*sizeof(timestamp_record);
+	munmap(d_map, sizeof(journal_header) + d_map_records*sizeof(timestamp_record));
+	if(ftruncate(d_fd, used) != 0)
+		std::cerr << "timestamp_journal: unable to trim journal" << std::endl;
+	close(d_fd);
+}
+
+void timestamp_journal::growMap(uint64_t min_records){
+	size_t old_size = sizeof(journal_header) + d_map_records*sizeof(timestamp_record);
+	uint64_t new_records = d_map_records;
+	while(new_records < min_records)
+		new_records += JOURNAL_GROW_RECORDS;
+	size_t new_size = sizeof(journal_header) + new_records*sizeof(timestamp_record);
+
+	if(ftruncate(d_fd, new_size) != 0)
+		throw std::runtime_error("timestamp_journal: unable to extend journal");
+	if(d_map)
+		munmap(d_map, old_size);
+	void *map = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, d_fd, 0);
+	if(map == MAP_FAILED)
+		throw std::runtime_error("timestamp_journal: unable to map journal");
+	d_map = (uint8_t *)map;
+	d_map_records = new_records;
+}
+
+void timestamp_journal::commit(const timestamp_record *records, size_t count){
+	if(d_num_records + count > d_map_records)
+		growMap(d_num_records + count);
+	memcpy(d_map + sizeof(journal_header) + d_num_records*sizeof(timestamp_record), records, count*sizeof(timestamp_record));
+	d_num_records += count;
+	((journal_header *)d_map)->num_records = d_num_records;
+}
+
+void timestamp_journal::writerLoop(){
+	timestamp_record batch[JOURNAL_QUEUE_DEPTH];
+	while(true){
+		//Read the flag before draining so nothing pushed ahead of shutdown is lost
+		bool running = d_running.load(boost::memory_order_acquire);
+		size_t count = d_queue.pop(batch, JOURNAL_QUEUE_DEPTH);
+		if(count > 0)
+			commit(batch, count);
+		else if(!running)
+			break;
+		else
+			boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+	}
+}
+
+} /* namespace fast_square */
+} /* namespace gr */
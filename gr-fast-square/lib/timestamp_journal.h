@@ -0,0 +1,80 @@
+#ifndef INCLUDED_FAST_SQUARE_TIMESTAMP_JOURNAL_H
+#define INCLUDED_FAST_SQUARE_TIMESTAMP_JOURNAL_H
+
+#include <string>
+#include <stdint.h>
+#include <boost/thread/thread.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/atomic.hpp>
+#include "monotonic_clock.h"
+
+namespace gr {
+namespace fast_square {
+
+#define JOURNAL_MAGIC "FSQJRNL1"
+#define JOURNAL_QUEUE_DEPTH 4096
+#define JOURNAL_GROW_RECORDS 65536
+
+//One entry per aligned snapshot per anchor
+struct timestamp_record
+{
+	uint32_t sequence_num;
+	uint32_t anchor;
+	uint64_t mono_ns;
+};
+
+//Fixed 64-byte header at the start of every journal file
+struct journal_header
+{
+	char magic[8];
+	uint32_t record_size;
+	uint32_t reserved;
+	uint64_t realtime_ns_at_open; //Wall clock and monotonic clock sampled together,
+	uint64_t mono_ns_at_open;     //so readers can convert mono_ns to absolute time
+	uint64_t num_records;         //Records committed so far
+	uint8_t pad[24];
+};
+
+/*!
+ * Append-only binary journal of snapshot timestamps.  log() only pushes a
+ * record onto a lock-free single-producer queue; a background thread drains
+ * the queue in batches into a memory-mapped file.
+ */
+class timestamp_journal
+{
+private:
+	boost::lockfree::spsc_queue<timestamp_record, boost::lockfree::capacity<JOURNAL_QUEUE_DEPTH> > d_queue;
+	boost::thread d_thread;
+	boost::atomic<bool> d_running; //Cleared by the destructor to stop the writer
+	int d_fd;
+	uint8_t *d_map;
+	uint64_t d_map_records;
+	uint64_t d_num_records;
+	uint64_t d_dropped;
+
+	void writerLoop();
+	void growMap(uint64_t min_records);
+	void commit(const timestamp_record *records, size_t count);
+
+public:
+	timestamp_journal(const std::string &filename);
+	~timestamp_journal();
+
+	//Hot path: no formatting, no locks, no syscalls.  Drops the record if the writer has fallen behind.
+	void log(uint32_t sequence_num, uint32_t anchor){
+		timestamp_record rec;
+		rec.sequence_num = sequence_num;
+		rec.anchor = anchor;
+		rec.mono_ns = monotonicNs();
+		if(!d_queue.push(rec))
+			d_dropped++;
+	}
+
+	//Records dropped so far; only the thread calling log() may read it
+	uint64_t dropped() const { return d_dropped; }
+};
+
+} /* namespace fast_square */
+} /* namespace gr */
+
+#endif /* INCLUDED_FAST_SQUARE_TIMESTAMP_JOURNAL_H */
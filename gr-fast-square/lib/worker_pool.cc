@@ -0,0 +1,83 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "worker_pool.h"
+#include <stdexcept>
+#include <algorithm>
+#include <boost/bind.hpp>
+
+namespace gr {
+namespace fast_square {
+
+worker_pool::worker_pool(int nthreads)
+	: d_tasks(NULL), d_count(0), d_next(0), d_pending(0), d_generation(0), d_running(true), d_size(nthreads)
+{
+	if(nthreads < 1)
+		throw std::out_of_range("worker_pool: nthreads must be > 0");
+
+	//The caller of run() is worker 0, so only nthreads-1 threads are started
+	for(int ii=1; ii < nthreads; ii++)
+		d_threads.create_thread(boost::bind(&worker_pool::workerLoop, this, ii));
+}
+
+worker_pool::~worker_pool(){
+	{
+		boost::lock_guard<boost::mutex> lock(d_mutex);
+		d_running = false;
+	}
+	d_work_cond.notify_all();
+	d_threads.join_all();
+}
+
+void worker_pool::drain(int worker, boost::unique_lock<boost::mutex> &lock){
+	//Claim tasks under the lock, run them without it
+	while(d_tasks && d_next < d_count){
+		const task &cur = (*d_tasks)[d_next++];
+		lock.unlock();
+		cur(worker);
+		lock.lock();
+		if(--d_pending == 0)
+			d_done_cond.notify_all();
+	}
+}
+
+void worker_pool::workerLoop(int worker){
+	boost::unique_lock<boost::mutex> lock(d_mutex);
+	unsigned seen = d_generation;
+	while(true){
+		while(d_running && d_generation == seen)
+			d_work_cond.wait(lock);
+		if(!d_running)
+			return;
+		seen = d_generation;
+		drain(worker, lock);
+	}
+}
+
+void worker_pool::run(const std::vector<task> &tasks, size_t count){
+	count = std::min(count, tasks.size());
+	if(count == 0)
+		return;
+	if(d_size == 1){
+		for(size_t ii=0; ii < count; ii++)
+			tasks[ii](0);
+		return;
+	}
+
+	boost::unique_lock<boost::mutex> lock(d_mutex);
+	d_tasks = &tasks;
+	d_count = count;
+	d_next = 0;
+	d_pending = count;
+	d_generation++;
+	d_work_cond.notify_all();
+
+	drain(0, lock);
+	while(d_pending > 0)
+		d_done_cond.wait(lock);
+	d_tasks = NULL;
+}
+
+} /* namespace fast_square */
+} /* namespace gr */
@@ -0,0 +1,56 @@
+#ifndef INCLUDED_FAST_SQUARE_WORKER_POOL_H
+#define INCLUDED_FAST_SQUARE_WORKER_POOL_H
+
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace gr {
+namespace fast_square {
+
+/*!
+ * Fixed set of threads that run batches of independent tasks.  run()
+ * hands out tasks in order to whichever thread is free, the calling
+ * thread included, and returns once every task has finished.  Each task
+ * is told which worker (0 = caller, 1..size()-1 = pool threads) runs it,
+ * so it can use per-worker scratch state without locking.
+ */
+class worker_pool
+{
+public:
+	typedef boost::function<void (int worker)> task;
+
+private:
+	boost::thread_group d_threads;
+	boost::mutex d_mutex;
+	boost::condition_variable d_work_cond;
+	boost::condition_variable d_done_cond;
+	const std::vector<task> *d_tasks;
+	size_t d_count;
+	size_t d_next;
+	size_t d_pending;
+	unsigned d_generation;
+	bool d_running;
+	int d_size;
+
+	void workerLoop(int worker);
+	void drain(int worker, boost::unique_lock<boost::mutex> &lock);
+
+public:
+	worker_pool(int nthreads);
+	~worker_pool();
+
+	int size() const { return d_size; }
+
+	void run(const std::vector<task> &tasks) { run(tasks, tasks.size()); }
+
+	//Runs only the first count tasks, so a prebuilt list can serve batches of any size
+	void run(const std::vector<task> &tasks, size_t count);
+};
+
+} /* namespace fast_square */
+} /* namespace gr */
+
+#endif /* INCLUDED_FAST_SQUARE_WORKER_POOL_H */
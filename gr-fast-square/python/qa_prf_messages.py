@@ -0,0 +1,93 @@
+#!/usr/bin/env python
+#
+# Runs prf_estimator and harmonic_extractor in a flowgraph and checks the
+# "prf_out" -> "prf_in" message contract: every snapshot leaves the
+# extractor, in order, with its own estimate tagged on it and written to
+# its header.
+#
+
+from gnuradio import gr, gr_unittest, blocks
+import pmt
+import numpy
+import struct
+import fast_square
+
+#Mirrors defines.h and snapshot_frame.h
+PRF = 4e6
+SAMPLE_RATE = 64e6
+DECIM_FACTOR = 33
+START_LO_FREQ = 5.312e9
+IF_FREQ = 990e6
+STEP_FREQ = -32e6
+TUNE_OFFSET = -42e3
+NUM_STEPS = 32
+FFT_SIZE = 782
+NUM_HARMONICS_PER_STEP = 16
+HEADER_FORMAT = '<IIdQBB6xQ4I8x'
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+#Padded to whole pages
+FRAME_SIZE = (HEADER_SIZE + NUM_STEPS*FFT_SIZE*8 + 4095)//4096*4096
+
+def snapshot(seq, prf, rng):
+    #Harmonic comb of a tag at prf as the parser hands it on, plus a little noise
+    fs = SAMPLE_RATE/DECIM_FACTOR
+    n = numpy.arange(FFT_SIZE)
+    data = numpy.zeros((NUM_STEPS, FFT_SIZE), numpy.complex64)
+    for jj in range(NUM_STEPS):
+        center = (START_LO_FREQ - IF_FREQ + STEP_FREQ*jj)/PRF
+        for hh in numpy.arange(-NUM_HARMONICS_PER_STEP/2 + .5, NUM_HARMONICS_PER_STEP/2):
+            freq = prf*hh + (prf - PRF)*center - TUNE_OFFSET
+            data[jj] += numpy.exp(1j*(2*numpy.pi*freq*n/fs + rng.uniform(0, 2*numpy.pi)))
+        data[jj] += 0.5*(rng.randn(FFT_SIZE) + 1j*rng.randn(FFT_SIZE))
+    header = struct.pack(HEADER_FORMAT, seq, 1, 0.0, 0, 0, 0, 0, 0, 0, 0, 0)
+    frame = header + data.astype(numpy.complex64).tobytes()
+    return numpy.frombuffer(frame + b'\0'*(FRAME_SIZE - len(frame)), numpy.uint8)
+
+class qa_prf_messages(gr_unittest.TestCase):
+
+    def setUp(self):
+        self.tb = gr.top_block()
+
+    def tearDown(self):
+        self.tb = None
+
+    def test_001_estimates_follow_snapshots(self):
+        rng = numpy.random.RandomState(1)
+        true_prf = PRF*(1 + 3.3e-6)
+        seqs = [7, 8, 9, 10, 12, 13]
+        frames = numpy.concatenate([snapshot(seq, true_prf, rng) for seq in seqs])
+
+        src = blocks.vector_source_b(frames.tolist(), False, FRAME_SIZE)
+        prf_est = fast_square.prf_estimator(1024, True, [], False, 1, "prf_est")
+        extract = fast_square.harmonic_extractor(1024, 1, "prf_est", "phasor_calc", "harmonic_freqs")
+        dst = blocks.vector_sink_b(FRAME_SIZE)
+        self.tb.connect(src, prf_est)
+        self.tb.connect(src, extract, dst)
+        self.tb.msg_connect(prf_est, "prf_out", extract, "prf_in")
+        self.tb.run()
+
+        #Every snapshot comes out, in order, with its own header
+        out = numpy.array(dst.data(), numpy.uint8).reshape(-1, FRAME_SIZE)
+        self.assertEqual(len(out), len(seqs))
+        headers = [struct.unpack(HEADER_FORMAT, out[ii, :HEADER_SIZE].tobytes()) for ii in range(len(out))]
+        self.assertEqual([hdr[0] for hdr in headers], seqs)
+
+        tags = {}
+        for tag in dst.tags():
+            tags.setdefault(tag.offset, {})[pmt.symbol_to_string(tag.key)] = pmt.to_python(tag.value)
+        for ii in range(len(seqs)):
+            item_tags = tags[ii]
+            #The estimate is tagged on the snapshot it was computed from and matches the header
+            self.assertEqual(item_tags["seq"], seqs[ii])
+            self.assertEqual(item_tags["prf_est"], headers[ii][2])
+            self.assertIn(item_tags["prf_est_state"], ("acquire", "track"))
+            self.assertLess(abs(item_tags["prf_est"] - true_prf)/PRF, 1e-7)
+            #The item offset only matches messages to snapshots; the stage times go into the header
+            self.assertNotIn("offset", item_tags)
+            self.assertNotIn("prf_start_ns", item_tags)
+            #Harmonics were extracted into a frame on output 0
+            self.assertNotEqual(headers[ii][3], 0)
+            self.assertEqual(headers[ii][5], NUM_HARMONICS_PER_STEP)
+
+if __name__ == '__main__':
+    gr_unittest.run(qa_prf_messages, "qa_prf_messages.xml")
@@ -70,67 +70,54 @@ class uhd_fft(gr.top_block):
         self.ant = ant = "J1"
 	self.fromfile = options.fromfile
 	self.tofile = options.tofile
+	self.sc16 = options.sc16
+
+	#Raw 16-bit I/Q halves host bandwidth and recording size
+	if self.sc16:
+		self.cpu_format = "sc16"
+		self.item_size = gr.sizeof_short*2
+	else:
+		self.cpu_format = "fc32"
+		self.item_size = gr.sizeof_gr_complex
 
         ##################################################
         # Blocks
         ##################################################
+	#Anchor count and geometry; every block below is sized from it
+	self.anchor_file = options.anchors
+	self.num_anchors = fast_square.anchor_config(self.anchor_file).num_anchors()
+
+	#Each USRP carries two anchors, on channels 0 and 1
+	self.addresses = [address, address2] + [a for a in options.more_addresses.split(";") if a]
+	if self.fromfile == False and 2*len(self.addresses) < self.num_anchors:
+		raise ValueError("%d anchors need %d USRPs, only %d given" % (self.num_anchors, (self.num_anchors+1)/2, len(self.addresses)))
+
 	if self.fromfile == False:
-	        self.source = uhd.usrp_source(
-	        	device_addr=address,
-	        	stream_args=uhd.stream_args(
-	        		cpu_format="fc32",
-	        		channels=range(2),
-	        	),
-	        )
-
-		#Channel 0
-		g = self.source.get_gain_range(0)
-		print "rx gain range is (%f,%f)" % (g.start(),g.stop())
-	        self.source.set_subdev_spec("A:0 B:0")
-	        self.source.set_center_freq(self.tune_freq, 0)
-	        self.source.set_gain(gain, 0)
-		#self.source.set_antenna("RX2", 0)
-		#self.source.set_gain(self.bbg, "BBG", 0)
-		#self.source.set_gain(self.gc1, "GC1", 0)
-	        self.source.set_bandwidth(self.bw, 0)
-
-		#Channel 1
-		g = self.source.get_gain_range(1)
-	        self.source.set_center_freq(self.tune_freq, 1) #Mixer @ 4992 MHz
-	        self.source.set_gain(gain, 1)
-		#self.source.set_antenna("RX2", 1)
-		#self.source.set_gain(self.bbg, "BBG", 1)
-		#self.source.set_gain(self.gc1, "GC1", 1)
-	        self.source.set_bandwidth(self.bw, 1)
-
-
-	        self.source2 = uhd.usrp_source(
-	        	device_addr=address2,
-	        	stream_args=uhd.stream_args(
-	        		cpu_format="fc32",
-	        		channels=range(2),
-	        	),
-	        )
-
-		#Channel 0
-		g = self.source2.get_gain_range(0)
-		print "rx gain range is (%f,%f)" % (g.start(),g.stop())
-	        self.source2.set_subdev_spec("A:0 B:0")
-	        self.source2.set_center_freq(self.tune_freq, 0)
-	        self.source2.set_gain(gain, 0)
-		#self.source2.set_antenna("RX2", 0)
-		#self.source2.set_gain(self.bbg, "BBG", 0)
-		#self.source2.set_gain(self.gc1, "GC1", 0)
-	        self.source2.set_bandwidth(self.bw, 0)
-
-		#Channel 1
-		g = self.source2.get_gain_range(1)
-	        self.source2.set_center_freq(self.tune_freq, 1) #Mixer @ 4992 MHz
-	        self.source2.set_gain(gain, 1)
-		#self.source2.set_antenna("RX2", 1)
-		#self.source2.set_gain(self.bbg, "BBG", 1)
-		#self.source2.set_gain(self.gc1, "GC1", 1)
-	        self.source2.set_bandwidth(self.bw, 1)
+		self.sources = []
+		for usrp in range((self.num_anchors+1)/2):
+			num_chans = min(2, self.num_anchors-2*usrp)
+			source = uhd.usrp_source(
+				device_addr=self.addresses[usrp],
+				stream_args=uhd.stream_args(
+					cpu_format=self.cpu_format,
+					channels=range(num_chans),
+				),
+			)
+			g = source.get_gain_range(0)
+			print "rx gain range is (%f,%f)" % (g.start(),g.stop())
+			if num_chans == 2:
+				source.set_subdev_spec("A:0 B:0")
+			for chan in range(num_chans):
+				source.set_center_freq(self.tune_freq, chan) #Mixer @ 4992 MHz
+				source.set_gain(gain, chan)
+				#source.set_antenna("RX2", chan)
+				#source.set_gain(self.bbg, "BBG", chan)
+				#source.set_gain(self.gc1, "GC1", chan)
+				source.set_bandwidth(self.bw, chan)
+			self.sources.append(source)
+
+		#Anchor ii is channel ii%2 of USRP ii/2
+		self.anchor_ports = [(self.sources[ii/2], ii%2) for ii in range(self.num_anchors)]
 
         ##################################################
         # Connections
@@ -140,54 +127,40 @@ class uhd_fft(gr.top_block):
 	#self.stitcher = fast_square.freq_stitcher("cal.dat",14*4)
 
 	if self.tofile == True:
-		self.logfile0 = blocks.file_sink(gr.sizeof_gr_complex, "usrp_chan0.dat")
-		self.connect((self.source, 0), self.logfile0)
-		self.logfile1 = blocks.file_sink(gr.sizeof_gr_complex, "usrp_chan1.dat")
-		self.connect((self.source, 1), self.logfile1)
-		self.logfile2 = blocks.file_sink(gr.sizeof_gr_complex, "usrp_chan2.dat")
-		self.connect((self.source2, 0), self.logfile2)
-		self.logfile3 = blocks.file_sink(gr.sizeof_gr_complex, "usrp_chan3.dat")
-		self.connect((self.source2, 1), self.logfile3)
+		self.logfiles = []
+		for ii in range(self.num_anchors):
+			logfile = blocks.file_sink(self.item_size, "usrp_chan%d.dat" % ii)
+			self.connect(self.anchor_ports[ii], logfile)
+			self.logfiles.append(logfile)
 
 		#Also connect to the stream parser so we get timestamps as well!
-		self.parser = fast_square.stream_parser()
-		self.connect((self.source, 0), (self.parser, 0))
-		self.connect((self.source, 1), (self.parser, 1))
-		self.connect((self.source2, 0), (self.parser, 2))
-		self.connect((self.source2, 1), (self.parser, 3))
+		self.parser = fast_square.stream_parser(True, "timestamps.journal", self.sc16)
+		for ii in range(self.num_anchors):
+			self.connect(self.anchor_ports[ii], (self.parser, ii))
 	else:
-		self.parser = fast_square.stream_parser()
+		self.parser = fast_square.stream_parser(True, "timestamps.journal", self.sc16)
 		if self.fromfile == True:
-			self.logfile0 = blocks.file_source(gr.sizeof_gr_complex, "usrp_chan0.dat", True)
-			self.logfile1 = blocks.file_source(gr.sizeof_gr_complex, "usrp_chan1.dat", True)
-			self.logfile2 = blocks.file_source(gr.sizeof_gr_complex, "usrp_chan2.dat", True)
-			self.logfile3 = blocks.file_source(gr.sizeof_gr_complex, "usrp_chan3.dat", True)
-			self.connect(self.logfile0, (self.parser, 0))
-			self.connect(self.logfile1, (self.parser, 1))
-			self.connect(self.logfile2, (self.parser, 2))
-			self.connect(self.logfile3, (self.parser, 3))
+			self.logfiles = []
+			for ii in range(self.num_anchors):
+				logfile = blocks.file_source(self.item_size, "usrp_chan%d.dat" % ii, True)
+				self.connect(logfile, (self.parser, ii))
+				self.logfiles.append(logfile)
 		else:
-			self.connect((self.source, 0), (self.parser, 0))
-			self.connect((self.source, 1), (self.parser, 1))
-			self.connect((self.source2, 0), (self.parser, 2))
-			self.connect((self.source2, 1), (self.parser, 3))
+			for ii in range(self.num_anchors):
+				self.connect(self.anchor_ports[ii], (self.parser, ii))
 
 		##The rest of the harmonia flowgraph
-		self.prf_est = fast_square.prf_estimator(1024, True, [], False, 1, "prf_est")
+		self.prf_est = fast_square.prf_estimator(1024, True, [], False, 1, "prf_est",
+				5e-7, 1e-9, 3, True, fast_square.PRF_BACKEND_FFT, 1, options.max_tags)
 		self.connect((self.parser, 0), (self.prf_est, 0))
-		self.connect((self.parser, 1), (self.prf_est, 1))
-		self.connect((self.parser, 2), (self.prf_est, 2))
-		self.connect((self.parser, 3), (self.prf_est, 3))
-		self.h_extract = fast_square.harmonic_extractor(1024, 1, "prf_est", "phasor_calc", "harmonic_freqs")
-		self.connect((self.prf_est, 0), (self.h_extract, 0))
-		self.connect((self.prf_est, 1), (self.h_extract, 1))
-		self.connect((self.prf_est, 2), (self.h_extract, 2))
-		self.connect((self.prf_est, 3), (self.h_extract, 3))
-		self.h_locate = fast_square.harmonic_localizer("phasor_calc", "harmonic_freqs", "prf_est", "Sek5SXpFPa", 1)
-		self.connect((self.h_extract, 0), (self.h_locate, 0))
-		self.connect((self.h_extract, 1), (self.h_locate, 1))
-		self.connect((self.h_extract, 2), (self.h_locate, 2))
-		self.connect((self.h_extract, 3), (self.h_locate, 3))
+		self.h_extract = fast_square.harmonic_extractor(1024, 1, "prf_est", "phasor_calc", "harmonic_freqs", 4, 8)
+		for ii in range(self.num_anchors):
+			self.connect((self.parser, ii), (self.h_extract, ii))
+		self.msg_connect(self.prf_est, "prf_out", self.h_extract, "prf_in")
+		self.h_locate = fast_square.harmonic_localizer("phasor_calc", "harmonic_freqs", "prf_est", "Sek5SXpFPa", options.loc_threads,
+				self.anchor_file, options.max_outliers)
+		for ii in range(self.num_anchors):
+			self.connect((self.h_extract, ii), (self.h_locate, ii))
 
 		#TODO: Put this back in once we want to push to gatd
 #		self.socket_pdu = blocks.socket_pdu("UDP_CLIENT", "inductor.eecs.umich.edu", "4001", 10000)
@@ -197,15 +170,6 @@ class uhd_fft(gr.top_block):
 		self.ws_port = sdrp.ws_sink_c(True, 18000, "FLOAT", "")
 		self.msg_connect(self.h_locate, "frame_out", self.ws_port, "ws_pdu_in")
 
-		#self.ns0 = blocks.null_sink(1024*32*gr.sizeof_gr_complex)
-		#self.ns1 = blocks.null_sink(1024*32*gr.sizeof_gr_complex)
-		#self.ns2 = blocks.null_sink(1024*32*gr.sizeof_gr_complex)
-		#self.ns3 = blocks.null_sink(1024*32*gr.sizeof_gr_complex)
-		#self.connect((self.h_extract, 0), self.ns0)
-		#self.connect((self.h_extract, 1), self.ns1)
-		#self.connect((self.h_extract, 2), self.ns2)
-		#self.connect((self.h_extract, 3), self.ns3)
-
 if __name__ == '__main__':
     parser = OptionParser(option_class=eng_option, usage="%prog: [options]")
     parser.add_option("-s", "--param-samp-rate", dest="param_samp_rate", type="eng_float", default=eng_notation.num_to_str(4e6),
@@ -222,6 +186,18 @@ if __name__ == '__main__':
         help="Push channel 2 data to file")
     parser.add_option("--fromfile", action="store_true", default=False,
         help="Read USRP data stream from file")
+    parser.add_option("--sc16", action="store_true", default=False,
+        help="Stream and record raw 16-bit I/Q instead of fc32")
+    parser.add_option("--anchors", dest="anchors", type="string", default="anchors.conf",
+        help="Anchor geometry file, one \"x y z [threshold]\" line per anchor [default=%default]")
+    parser.add_option("--more-addresses", dest="more_addresses", type="string", default="",
+        help="Addresses of the USRPs after the second, separated by ';' [default=%default]")
+    parser.add_option("--max-outliers", dest="max_outliers", type="int", default=0,
+        help="Anchors the localizer may reject from a fix [default=%default]")
+    parser.add_option("--max-tags", dest="max_tags", type="int", default=1,
+        help="Tags to locate at once, told apart by their PRF [default=%default]")
+    parser.add_option("--loc-threads", dest="loc_threads", type="int", default=1,
+        help="Threads searching the anchors' CIRs in parallel [default=%default]")
     (options, args) = parser.parse_args()
     tb = uhd_fft(param_samp_rate=options.param_samp_rate, param_freq=options.param_freq, param_gain=options.param_gain, address=options.address, address2=options.address2)
     tb.run()
@@ -8,6 +8,8 @@
 %include "fast_square_swig_doc.i"
 
 %{
+#include "fast_square/anchor_config.h"
+#include "fast_square/block_stats.h"
 #include "fast_square/harmonic_extractor.h"
 #include "fast_square/harmonic_localizer.h"
 #include "fast_square/prf_estimator.h"
@@ -15,6 +17,9 @@
 %}
 
 
+%include "fast_square/anchor_config.h"
+%include "fast_square/block_stats.h"
+
 %include "fast_square/harmonic_extractor.h"
 GR_SWIG_BLOCK_MAGIC2(fast_square, harmonic_extractor);
 